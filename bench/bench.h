@@ -0,0 +1,28 @@
+#ifndef THINGER_BENCH_H
+#define THINGER_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// results are accumulated here, so the measured code cannot be optimized away
+static volatile size_t bench_sink = 0;
+
+/**
+ * Run the function the given number of times, repeating the measure and keeping the fastest run
+ * @return nanoseconds per call
+ */
+template<class F>
+double bench_ns(size_t iterations, F function){
+    double best = 0;
+    for(int run=0; run<5; run++){
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for(size_t i=0; i<iterations; i++) function();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = elapsed.count() / iterations;
+        if(run==0 || ns<best) best = ns;
+    }
+    return best;
+}
+
+#endif
@@ -0,0 +1,111 @@
+// Decode encoded payloads of several shapes with the default allocator, and over an arena reserved as messages do it
+// (see thinger_message::reserve), reporting the upstream allocations and the time per decoding, including the release
+// of the decoded tree. Both decode with the same decoder, that copies the strings, so only the allocator differs.
+
+#include "thinger/core/thinger_message.hpp"
+#include "bench.h"
+#include <string>
+#include <vector>
+
+using namespace protoson;
+
+// malloc allocator that counts its allocations
+class counting_allocator : public memory_allocator{
+public:
+    size_t allocations;
+
+    counting_allocator() : allocations(0){}
+
+    using memory_allocator::allocate;
+
+    virtual void *allocate(size_t size){
+        allocations++;
+        return malloc(size);
+    }
+
+    virtual void deallocate(void *ptr){
+        free(ptr);
+    }
+};
+
+static void small_request(pson& data){
+    data["temperature"] = 21.5;
+    data["humidity"] = 40;
+    data["name"] = "living room sensor";
+    data["on"] = true;
+    data["location"]["lat"] = 40.4168;
+    data["location"]["lon"] = -3.7038;
+}
+
+static void records(pson& data){
+    pson_array& array = data;
+    for(int i=0; i<50; i++){
+        pson& record = *array.create_item();
+        record["id"] = i;
+        record["name"] = ("device " + std::to_string(i)).c_str();
+        record["online"] = i%2==0;
+        pson_array& readings = record["readings"];
+        readings.add(21.5).add(22).add(i*3);
+    }
+}
+
+static void wide_object(pson& data){
+    for(int i=0; i<200; i++){
+        std::string key = "key_" + std::to_string(i);
+        if(i%2==0) data[key.c_str()] = i*7;
+        else data[key.c_str()] = ("value " + std::to_string(i)).c_str();
+    }
+}
+
+static void run(const char* name, void (*fill)(pson&)){
+    std::vector<uint8_t> encoded;
+    {
+        pson data;
+        fill(data);
+        encoded.resize(pson_encoded_size(data));
+        pson_buffer_encoder encoder(encoded.data(), encoded.size());
+        encoder.encode(data);
+    }
+    size_t size = encoded.size();
+
+    counting_allocator heap;
+    size_t heap_allocations = 0;
+    double heap_ns = bench_ns(2000, [&](){
+        memory_scope scope(heap);
+        size_t start = heap.allocations;
+        {
+            pson value;
+            pson_shared_buffer_decoder decoder(encoded.data(), size);
+            bench_sink += decoder.decode(value);
+        }
+        heap_allocations = heap.allocations - start;
+    });
+
+    counting_allocator upstream;
+    size_t arena_allocations = 0;
+    double arena_ns = bench_ns(2000, [&](){
+        size_t start = upstream.allocations;
+        {
+            arena_memory_allocator arena(upstream);
+            size_t nodes_size = size < THINGER_MESSAGE_TREE_RESERVE/8 ? size*8 + 64 : THINGER_MESSAGE_TREE_RESERVE + 64;
+            arena.reserve(size + nodes_size);
+            memory_scope scope(arena);
+            pson value;
+            pson_shared_buffer_decoder decoder(encoded.data(), size);
+            bench_sink += decoder.decode(value);
+        }
+        arena_allocations = upstream.allocations - start;
+    });
+
+    printf("%-16s %8zu %12zu %12zu %12.0f %12.0f\n", name, size, heap_allocations, arena_allocations, heap_ns,
+           arena_ns);
+}
+
+int main(){
+    printf("%-16s %8s %12s %12s %12s %12s\n", "payload", "bytes", "allocs", "allocs", "default", "arena");
+    printf("%-16s %8s %12s %12s %12s %12s\n", "", "", "(default)", "(arena)", "(ns)", "(ns)");
+    run("small request", small_request);
+    run("records", records);
+    run("wide object", wide_object);
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Resolve request paths in resource trees of several widths and depths, where each level has the given number of
+// resources and the last one holds the next level. The requested path is the last resource of the deepest level.
+// Lookups through the full path index are compared with searching each level by name, and whole requests are
+// dispatched through handle() over an in-memory connection.
+
+#include "thinger/core/thinger.h"
+#include "bench.h"
+#include <string>
+#include <vector>
+
+using namespace thinger;
+using namespace protoson;
+
+static size_t calls = 0;
+
+// client reading the same request frame on every handle()
+class memory_client : public thinger::thinger{
+public:
+    memory_client() : position_(0){}
+
+    std::string input;
+
+    void rewind(){
+        position_ = 0;
+    }
+
+    virtual bool read(char* buffer, size_t size){
+        if(input.size()-position_<size) return false;
+        memcpy(buffer, &input[position_], size);
+        position_ += size;
+        return true;
+    }
+
+    virtual bool read_some(char* buffer, size_t size, size_t& bytes_read, bool wait){
+        bytes_read = input.size()-position_ < size ? input.size()-position_ : size;
+        memcpy(buffer, &input[position_], bytes_read);
+        position_ += bytes_read;
+        return bytes_read>0 || !wait;
+    }
+
+    virtual bool input_pending(){
+        return position_<input.size();
+    }
+
+    virtual bool write(const char* /*buffer*/, size_t size, bool /*flush*/){
+        bench_sink += size;
+        return true;
+    }
+
+private:
+    size_t position_;
+};
+
+static void run(size_t width, size_t depth){
+    std::vector<std::string> names;
+    names.reserve(width);
+    for(size_t i=0; i<width; i++) names.push_back("resource_" + std::to_string(i));
+
+    // the same tree, standalone and in the client
+    thinger_map<thinger_resource> resources;
+    memory_client client;
+    thinger_resource* level = NULL;
+    thinger_resource* client_level = NULL;
+    const char* path[THINGER_RESOURCE_MAX_DEPTH];
+    for(size_t d=0; d<depth; d++){
+        for(size_t i=0; i<width; i++){
+            const char* name = names[i].c_str();
+            thinger_resource& resource = level==NULL ? resources[name] : (*level)[name];
+            thinger_resource& client_resource = client_level==NULL ? client[name] : (*client_level)[name];
+            if(i==width-1){
+                level = &resource;
+                client_level = &client_resource;
+                path[d] = name;
+            }
+        }
+    }
+    (*client_level) >> [](pson& out){
+        out = 1;
+        calls++;
+    };
+
+    thinger_resource_index index(default_allocator());
+    if(!index.update(resources) || index.find(path, depth)!=level){
+        fprintf(stderr, "index lookup failed\n");
+        exit(1);
+    }
+
+    double indexed = bench_ns(200000, [&](){
+        bench_sink += (size_t) index.find(path, depth);
+    });
+
+    double levels = bench_ns(200000, [&](){
+        thinger_resource* resource = resources.find(path[0]);
+        for(size_t i=1; i<depth && resource!=NULL; i++) resource = resource->find(path[i]);
+        bench_sink += (size_t) resource;
+    });
+
+    thinger_message message;
+    message.set_stream_id(1);
+    for(size_t d=0; d<depth; d++) message.resources().add(path[d]);
+    thinger_buffer_encoder encoder;
+    encoder.encode_frame(message);
+    size_t count;
+    const thinger_io_span* spans = encoder.get_spans(count);
+    for(size_t i=0; i<count; i++) client.input.append((const char*) spans[i].data, spans[i].size);
+
+    calls = 0;
+    double dispatch = bench_ns(20000, [&](){
+        client.rewind();
+        client.handle(0, true);
+    });
+    if(calls!=5*20000){
+        fprintf(stderr, "requests were not dispatched\n");
+        exit(1);
+    }
+
+    printf("%-6zu %-6zu %14.0f %14.0f %14.0f\n", width, depth, levels, indexed, dispatch);
+}
+
+int main(){
+    printf("%-6s %-6s %14s %14s %14s\n", "width", "depth", "levels (ns)", "index (ns)", "dispatch (ns)");
+    run(10, 8);
+    run(100, 4);
+    run(100, 8);
+    run(500, 1);
+    run(500, 8);
+    return 0;
+}
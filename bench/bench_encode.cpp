@@ -0,0 +1,89 @@
+// Encode nested objects as the client sends them. Encoders that can rewrite their output write each length after its
+// contents in a single pass; the others size every nested object first, in an additional pass. Unchanged trees are
+// also encoded keeping the sizes cached by the previous encoding, so each length prefix is reserved with its final
+// width and no contents are moved.
+
+#include "thinger/core/pson.h"
+#include "thinger/core/thinger_encoder.hpp"
+#include "bench.h"
+#include <string>
+#include <vector>
+
+using namespace protoson;
+using namespace thinger;
+
+// nested objects with a few values at each level, 4 children per level up to depth 4, then 2
+static void fill_nested(pson& value, int depth){
+    value["id"] = depth;
+    value["name"] = "sensor";
+    value["temperature"] = 21.5f;
+    if(depth==0) return;
+    int width = depth>4 ? 2 : 4;
+    for(int i=0; i<width; i++){
+        std::string key = "child_" + std::to_string(i);
+        fill_nested(value[key.c_str()], depth-1);
+    }
+}
+
+// drop the cached sizes, so each run encodes the tree as after being modified (or just walk the tree, so all the runs
+// take the same walk)
+static void invalidate_sizes(pson& value, bool invalidate = true){
+    if(value.is_object()){
+        pson_object& object = value;
+        if(invalidate) object.invalidate_encoded_size();
+        for(pson_container<pson_pair>::iterator it=object.begin(); it.valid(); it.next()){
+            invalidate_sizes(it.item().value(), invalidate);
+        }
+    }
+}
+
+int main(){
+    std::vector<uint8_t> output(1024*1024);
+    printf("%-6s %8s %16s %16s %16s\n", "depth", "bytes", "two-pass (us)", "single-pass (us)", "cached (us)");
+    for(int depth=1; depth<=8; depth++){
+        pson data;
+        fill_nested(data, depth);
+        size_t iterations = depth<=4 ? 2000 : 200;
+
+        size_t two_pass_size = 0;
+        double two_pass = bench_ns(iterations, [&](){
+            invalidate_sizes(data);
+            pson_buffer_encoder encoder(output.data(), output.size());
+            encoder.encode(data);
+            two_pass_size = encoder.bytes_written();
+        });
+
+        thinger_buffer_encoder buffer_encoder;
+        size_t single_pass_size = 0;
+        double single_pass = bench_ns(iterations, [&](){
+            invalidate_sizes(data);
+            buffer_encoder.reset();
+            buffer_encoder.encode(data);
+            single_pass_size = buffer_encoder.bytes_written();
+        });
+
+        size_t count;
+        const thinger_io_span* spans = buffer_encoder.get_spans(count);
+        if(two_pass_size!=single_pass_size || count!=1 || memcmp(spans[0].data, output.data(), two_pass_size)!=0){
+            fprintf(stderr, "encodings differ at depth %d\n", depth);
+            return 1;
+        }
+
+        double cached = bench_ns(iterations, [&](){
+            invalidate_sizes(data, false);
+            buffer_encoder.reset();
+            buffer_encoder.encode(data);
+            bench_sink += buffer_encoder.bytes_written();
+        });
+
+        spans = buffer_encoder.get_spans(count);
+        if(buffer_encoder.bytes_written()!=two_pass_size || count!=1 ||
+           memcmp(spans[0].data, output.data(), two_pass_size)!=0){
+            fprintf(stderr, "cached encoding differs at depth %d\n", depth);
+            return 1;
+        }
+        printf("%-6d %8zu %16.1f %16.1f %16.1f\n", depth, single_pass_size, two_pass/1000, single_pass/1000,
+               cached/1000);
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Transcode JSON documents to pson and back, reporting the throughput over the JSON text size. The documents cover
+// wide objects, nested records, and long strings (scanned 16 characters at a time when SSE2 is available). As a
+// baseline for the decoder, the decoded tree is also rebuilt appending members as the decoder does, and through
+// operator[], which looks up each key before adding it.
+
+#include "thinger/pson_json.h"
+#include "bench.h"
+#include <string>
+#include <vector>
+
+using namespace protoson;
+
+static std::string wide_object(){
+    std::string json = "{";
+    for(int i=0; i<2000; i++){
+        if(i>0) json += ",";
+        json += "\"key_" + std::to_string(i) + "\":";
+        if(i%3==0) json += std::to_string(i*7);
+        else if(i%3==1) json += std::to_string(i) + ".25";
+        else json += "\"value " + std::to_string(i) + "\"";
+    }
+    return json + "}";
+}
+
+static std::string nested_records(){
+    std::string json = "[";
+    for(int i=0; i<200; i++){
+        if(i>0) json += ",";
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"device " + std::to_string(i) + "\","
+                "\"location\":{\"lat\":40.4168,\"lon\":-3.7038},\"online\":true,"
+                "\"readings\":[21.5,22,23.75,-4],\"tags\":[\"indoor\",\"floor 2\"]}";
+    }
+    return json + "]";
+}
+
+static std::string long_strings(){
+    std::string json = "[";
+    for(int i=0; i<50; i++){
+        if(i>0) json += ",";
+        json += "\"" + std::string(4096, 'a' + i%26) + "\"";
+    }
+    return json + "]";
+}
+
+// copy of the source value, adding object members with create_item, or with operator[] if lookup is set
+static void build(pson& source, pson& destination, bool lookup){
+    if(source.is_object()){
+        pson_object& from = source;
+        pson_object& to = destination;
+        for(pson_container<pson_pair>::iterator it = from.begin(); it.valid(); it.next()){
+            const pson_key* key = it.item().key();
+            if(lookup){
+                build(it.item().value(), to[key->name()], true);
+            }else{
+                pson_pair* pair = to.create_item();
+                pair->set_name(key->name(), key->size);
+                build(it.item().value(), pair->value(), false);
+            }
+        }
+    }else if(source.is_array()){
+        pson_array& from = source;
+        pson_array& to = destination;
+        for(pson_container<pson>::iterator it = from.begin(); it.valid(); it.next()){
+            build(it.item(), *to.create_item(), lookup);
+        }
+    }else{
+        destination = source;
+    }
+}
+
+static void run(const char* name, const std::string& json){
+    // encoded pson of the document, used as the export input
+    pson document;
+    pson_json_decoder json_decoder;
+    if(!json_decoder.decode(json, document)){
+        fprintf(stderr, "invalid document: %s\n", name);
+        exit(1);
+    }
+    std::vector<uint8_t> encoded(pson_encoded_size(document));
+    pson_buffer_encoder encoder(encoded.data(), encoded.size());
+    encoder.encode(document);
+
+    double decode = bench_ns(50, [&](){
+        pson value;
+        pson_json_decoder decoder;
+        bench_sink += decoder.decode(json, value);
+    });
+
+    std::string output;
+    output.reserve(json.size()*2);
+    double encode = bench_ns(50, [&](){
+        output.clear();
+        pson_json_encoder json_encoder;
+        bench_sink += json_encoder.encode(encoded.data(), encoded.size(), output);
+    });
+
+    double append = bench_ns(50, [&](){
+        pson value;
+        build(document, value, false);
+        bench_sink += value.is_empty();
+    });
+
+    double lookup = bench_ns(50, [&](){
+        pson value;
+        build(document, value, true);
+        bench_sink += value.is_empty();
+    });
+
+    printf("%-16s %8zu %12.1f %12.1f %12.1f %12.1f\n", name, json.size(), json.size()*1000/decode,
+           json.size()*1000/encode, append/1000, lookup/1000);
+}
+
+int main(){
+    printf("%-16s %8s %12s %12s %12s %12s\n", "document", "bytes", "json->pson", "pson->json", "append", "operator[]");
+    printf("%-16s %8s %12s %12s %12s %12s\n", "", "", "(MB/s)", "(MB/s)", "(us)", "(us)");
+    run("wide object", wide_object());
+    run("nested records", nested_records());
+    run("long strings", long_strings());
+    return 0;
+}
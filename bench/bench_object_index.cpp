@@ -0,0 +1,48 @@
+// Build objects through operator[] and read every key back, as done by resources filling wide objects. Objects of
+// 16 or more keys are indexed by hash; the linear scan they replaced is measured over the same items.
+
+#include "thinger/core/pson.h"
+#include "bench.h"
+#include <string>
+#include <vector>
+
+using namespace protoson;
+
+static pson& find_linear(pson_object& object, const char* name){
+    size_t name_size = strlen(name);
+    for(pson_container<pson_pair>::iterator it=object.begin(); it.valid(); it.next()){
+        const pson_key* key = it.item().key();
+        if(key!=NULL && key->size==name_size && memcmp(key->name(), name, name_size)==0){
+            return it.item().value();
+        }
+    }
+    pson_pair* pair = object.create_item();
+    pair->set_name(name, name_size);
+    return pair->value();
+}
+
+int main(){
+    const size_t sizes[] = {10, 100, 1000, 5000};
+    printf("%-8s %14s %14s\n", "keys", "linear (us)", "indexed (us)");
+    for(size_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++){
+        std::vector<std::string> keys;
+        for(size_t i=0; i<sizes[s]; i++) keys.push_back("key_" + std::to_string(i));
+        size_t iterations = sizes[s]<=100 ? 2000 : (sizes[s]<=1000 ? 20 : 2);
+
+        double linear = bench_ns(iterations, [&](){
+            pson value;
+            pson_object& object = value;
+            for(size_t i=0; i<keys.size(); i++) find_linear(object, keys[i].c_str()) = (int) i;
+            for(size_t i=0; i<keys.size(); i++) bench_sink += (int) find_linear(object, keys[i].c_str());
+        });
+
+        double indexed = bench_ns(iterations, [&](){
+            pson value;
+            for(size_t i=0; i<keys.size(); i++) value[keys[i].c_str()] = (int) i;
+            for(size_t i=0; i<keys.size(); i++) bench_sink += (int) value[keys[i].c_str()];
+        });
+
+        printf("%-8zu %14.1f %14.1f\n", sizes[s], linear/1000, indexed/1000);
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+// Encode and decode messages through the virtual encoder and decoder adapters, and through the buffer sinks that are
+// resolved at compile time, over the same input. Both decoders reference strings in the input, that is copied before
+// each run as it is modified by the decoding.
+
+#include "thinger/core/pson.h"
+#include "thinger/core/thinger_encoder.hpp"
+#include "thinger/core/thinger_decoder.hpp"
+#include "bench.h"
+#include <string>
+#include <vector>
+
+using namespace protoson;
+using namespace thinger;
+
+static void fill_small(pson& value){
+    value["temperature"] = 21.5f;
+    value["humidity"] = 40;
+}
+
+static void fill_flat(pson& value){
+    for(int i=0; i<20; i++){
+        std::string key = "value_" + std::to_string(i);
+        if(i%3==0) value[key.c_str()] = i;
+        else if(i%3==1) value[key.c_str()] = i + 0.5f;
+        else value[key.c_str()] = "text";
+    }
+    value["name"] = "a device name";
+}
+
+static void fill_api(pson& value){
+    for(int i=0; i<8; i++){
+        std::string key = "resource_" + std::to_string(i);
+        pson& resource = value[key.c_str()];
+        resource["fn"] = key.c_str();
+        resource["in"]["value"] = i;
+        resource["out"]["value"] = i * 1.5f;
+    }
+}
+
+static void run(const char* shape, void (*fill)(pson&)){
+    pson data;
+    fill(data);
+    std::vector<uint8_t> encoded(64*1024);
+    std::vector<uint8_t> input(encoded.size());
+    size_t size = 0;
+
+    double encode_virtual = bench_ns(200000, [&](){
+        thinger_memory_encoder encoder(encoded.data(), encoded.size());
+        encoder.encode(data);
+        size = encoder.bytes_written();
+    });
+
+    double encode_static = bench_ns(200000, [&](){
+        pson_buffer_encoder encoder(encoded.data(), encoded.size());
+        encoder.encode(data);
+        bench_sink += encoder.bytes_written();
+    });
+
+    double decode_virtual = bench_ns(200000, [&](){
+        memcpy(input.data(), encoded.data(), size);
+        thinger_memory_decoder decoder(input.data(), size, true);
+        pson value;
+        bench_sink += decoder.decode(value);
+    });
+
+    double decode_static = bench_ns(200000, [&](){
+        memcpy(input.data(), encoded.data(), size);
+        pson_buffer_decoder decoder(input.data(), size);
+        pson value;
+        bench_sink += decoder.decode(value);
+    });
+
+    printf("%-8s %6zu %10.0f %10.0f %10.0f %10.0f\n", shape, size,
+           encode_virtual, encode_static, decode_virtual, decode_static);
+}
+
+int main(){
+    printf("%-8s %6s %10s %10s %10s %10s\n", "shape", "bytes", "enc virt", "enc static", "dec virt", "dec static");
+    printf("%-8s %6s %10s %10s %10s %10s\n", "", "", "(ns)", "(ns)", "(ns)", "(ns)");
+    run("small", fill_small);
+    run("flat", fill_flat);
+    run("api", fill_api);
+    return 0;
+}
@@ -0,0 +1,110 @@
+// Encode and decode runs of varints of each size with the varint kernels, and with byte by byte loops as a baseline,
+// reporting the time per value. The values of each run take the same number of bytes, so the branches of both
+// implementations are predicted as in payloads that repeat similar numbers, except for the last run, where the values
+// take a random number of bytes.
+
+#include "thinger/core/pson.h"
+#include "bench.h"
+#include <vector>
+
+using namespace protoson;
+
+static const size_t count = 4096;
+
+static uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*, so runs are reproducible
+static uint64_t random64(){
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint8_t scalar_encode(uint8_t* buffer, uint64_t value){
+    uint8_t size = 0;
+    while(value >= 0x80){
+        buffer[size++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[size++] = (uint8_t) value;
+    return size;
+}
+
+static uint8_t scalar_decode(const uint8_t* buffer, size_t available, uint64_t& value){
+    value = 0;
+    for(uint8_t i=0; i<10 && i<available; i++){
+        value |= (uint64_t)(buffer[i] & 0x7F) << (7*i);
+        if(buffer[i] < 0x80) return i+1;
+    }
+    return 0;
+}
+
+// value taking exactly the given number of bytes
+static uint64_t random_value(uint8_t bytes){
+    uint8_t bits = bytes<10 ? 7*bytes : 64;
+    uint64_t value = bits==64 ? random64() : random64() & (((uint64_t)1 << bits) - 1);
+    uint64_t minimum = bytes==1 ? 0 : (uint64_t)1 << (7*(bytes-1));
+    return value | minimum;
+}
+
+// run over values of the given number of bytes, or of random sizes if it is 0
+static void run(uint8_t bytes){
+    std::vector<uint64_t> values(count);
+    size_t size = 0;
+    for(size_t i=0; i<count; i++){
+        values[i] = random_value(bytes>0 ? bytes : (uint8_t) (random64() % 10 + 1));
+        size += pson_varint_size(values[i]);
+    }
+    std::vector<uint8_t> buffer(count*10);
+
+    double kernel_encode = bench_ns(200, [&](){
+        size_t written = 0;
+        for(size_t i=0; i<count; i++) written += pson_varint_encode(&buffer[written], values[i]);
+        bench_sink += written;
+    }) / count;
+
+    double scalar_encode_ns = bench_ns(200, [&](){
+        size_t written = 0;
+        for(size_t i=0; i<count; i++) written += scalar_encode(&buffer[written], values[i]);
+        bench_sink += written;
+    }) / count;
+
+    double kernel_decode = bench_ns(200, [&](){
+        size_t read = 0;
+        uint64_t sum = 0;
+        for(size_t i=0; i<count; i++){
+            uint64_t value;
+            read += pson_varint_decode(&buffer[read], size - read, value);
+            sum += value;
+        }
+        bench_sink += sum;
+    }) / count;
+
+    double scalar_decode_ns = bench_ns(200, [&](){
+        size_t read = 0;
+        uint64_t sum = 0;
+        for(size_t i=0; i<count; i++){
+            uint64_t value;
+            read += scalar_decode(&buffer[read], size - read, value);
+            sum += value;
+        }
+        bench_sink += sum;
+    }) / count;
+
+    char name[8];
+    if(bytes>0) snprintf(name, sizeof(name), "%u", bytes);
+    else snprintf(name, sizeof(name), "mixed");
+    printf("%-8s %12.2f %12.2f %12.2f %12.2f\n", name, kernel_encode, scalar_encode_ns, kernel_decode,
+           scalar_decode_ns);
+}
+
+int main(){
+    printf("%-8s %12s %12s %12s %12s\n", "bytes", "encode", "encode", "decode", "decode");
+    printf("%-8s %12s %12s %12s %12s\n", "", "(ns)", "(scalar ns)", "(ns)", "(scalar ns)");
+    static const uint8_t sizes[] = {1, 2, 3, 4, 5, 8, 10, 0};
+    for(size_t i=0; i<sizeof(sizes); i++){
+        run(sizes[i]);
+    }
+    return 0;
+}
@@ -31,6 +31,11 @@
 
 #ifndef ARDUINO
 #include <string>
+#include <atomic>
+#endif
+
+#ifdef __BMI2__
+#include <immintrin.h>
 #endif
 
 #ifndef UINT32_MAX
@@ -72,6 +77,14 @@ namespace protoson {
                 deallocate(p);
             }
         }
+
+        /**
+         * Allocator that releases the memory served by this one. Allocators that only forward to another allocator
+         * return it, so structures can keep it after the forwarding allocator is gone.
+         */
+        virtual memory_allocator& owner(){
+            return *this;
+        }
     };
 
     template<size_t buffer_size>
@@ -109,7 +122,174 @@ namespace protoson {
         }
     };
 
-    extern memory_allocator& pool;
+    /**
+     * Allocator used by pson structures when there is no memory_scope active. It is defined at the end of this file
+     * as a function local static, so the library can be included from any number of translation units. Define
+     * PSON_CUSTOM_DEFAULT_ALLOCATOR to provide a different definition in the application.
+     */
+    inline memory_allocator& default_allocator();
+
+#ifdef ARDUINO
+    #define PSON_THREAD_LOCAL
+#else
+    #define PSON_THREAD_LOCAL thread_local
+#endif
+
+    /**
+     * Replaces the allocator used by pson structures in the current thread while the scope is alive. Objects and
+     * arrays keep the allocator that was active when they were created, and release their items under it, so they
+     * can be destroyed under any scope. Any other value must be destroyed under the same allocator that built it.
+     */
+    class memory_scope{
+    public:
+        memory_scope(memory_allocator& allocator) : previous_(current()){
+            current() = &allocator;
+        }
+
+        ~memory_scope(){
+            current() = previous_;
+        }
+
+        static memory_allocator*& current(){
+            static PSON_THREAD_LOCAL memory_allocator* current = NULL;
+            return current;
+        }
+
+    private:
+        memory_allocator* previous_;
+    };
+
+    inline memory_allocator& current_allocator(){
+        memory_allocator* allocator = memory_scope::current();
+        return allocator!=NULL ? *allocator : default_allocator();
+    }
+
+    /**
+     * Monotonic allocator that serves memory by bumping a pointer over blocks reserved from an upstream allocator.
+     * Deallocation of its own memory is a no-op, and all blocks are returned to the upstream in one step when the
+     * arena is released. Memory not served by the arena is forwarded to the upstream allocator, so it can be used
+     * over structures that may also contain memory from the upstream.
+     */
+    class arena_memory_allocator : public memory_allocator{
+    private:
+        struct block{
+            block* next_;
+            size_t size_;
+        };
+
+        static const size_t alignment = 8;
+        static const size_t header_size = (sizeof(block) + alignment - 1) & ~(alignment - 1);
+
+        memory_allocator& upstream_;
+        block* blocks_;
+        size_t index_;
+
+        uint8_t* data(block* current) const{
+            return (uint8_t*) current + header_size;
+        }
+
+        bool add_block(size_t size){
+            block* new_block = (block*) upstream_.allocate(header_size + size);
+            if(new_block==NULL) return false;
+            new_block->next_ = blocks_;
+            new_block->size_ = size;
+            blocks_ = new_block;
+            index_ = 0;
+            return true;
+        }
+
+    public:
+        arena_memory_allocator(memory_allocator& upstream) : upstream_(upstream), blocks_(NULL), index_(0){
+        }
+
+        ~arena_memory_allocator(){
+            release();
+        }
+
+        /**
+         * Reserve a new block in the arena for serving, at least, the given size
+         */
+        bool reserve(size_t size){
+            if(size > (size_t)-1 - header_size - alignment) return false;
+            return add_block((size + alignment - 1) & ~(alignment - 1));
+        }
+
+        /**
+         * Return all the arena blocks to the upstream allocator
+         */
+        void release(){
+            while(blocks_!=NULL){
+                block* next = blocks_->next_;
+                upstream_.deallocate(blocks_);
+                blocks_ = next;
+            }
+            index_ = 0;
+        }
+
+        bool owns(const void* ptr) const{
+            for(block* current = blocks_; current!=NULL; current = current->next_){
+                if(ptr>=data(current) && ptr<data(current)+current->size_) return true;
+            }
+            return false;
+        }
+
+        memory_allocator& upstream(){
+            return upstream_;
+        }
+
+        using memory_allocator::allocate;
+
+        virtual void *allocate(size_t size) {
+            size = (size + alignment - 1) & ~(alignment - 1);
+            if(blocks_==NULL || index_ + size > blocks_->size_){
+                // without a reserved arena just behave as the upstream allocator
+                if(blocks_==NULL) return upstream_.allocate(size);
+                // grow geometrically so the number of blocks is kept low
+                size_t block_size = blocks_->size_*2;
+                if(!add_block(block_size > size ? block_size : size)) return NULL;
+            }
+            void* position = data(blocks_) + index_;
+            index_ += size;
+            return position;
+        }
+
+        virtual void deallocate(void *ptr) {
+            if(ptr!=NULL && !owns(ptr)){
+                upstream_.deallocate(ptr);
+            }
+        }
+    };
+
+    /**
+     * Allocator that allocates from its upstream allocator, but does not release the memory owned by an arena, so
+     * values decoded over an arena can be modified or replaced while a different allocator is used for new values
+     */
+    class arena_guard_allocator : public memory_allocator{
+    private:
+        arena_memory_allocator& arena_;
+        memory_allocator& upstream_;
+
+    public:
+        arena_guard_allocator(arena_memory_allocator& arena, memory_allocator& upstream) :
+            arena_(arena), upstream_(upstream){
+        }
+
+        using memory_allocator::allocate;
+
+        virtual void *allocate(size_t size) {
+            return upstream_.allocate(size);
+        }
+
+        virtual void deallocate(void *ptr) {
+            if(ptr!=NULL && !arena_.owns(ptr)){
+                upstream_.deallocate(ptr);
+            }
+        }
+
+        virtual memory_allocator& owner(){
+            return upstream_.owner();
+        }
+    };
 }
 
 namespace protoson {
@@ -122,64 +302,223 @@ namespace protoson {
         pson_type = 6
     };
 
+    /**
+     * Integer base 2 logarithm (position of the most significant bit)
+     */
+    inline uint8_t pson_log2(size_t value){
+#ifdef __GNUC__
+        return (uint8_t)(sizeof(unsigned long)*8 - 1 - __builtin_clzl((unsigned long)value));
+#else
+        uint8_t log = 0;
+        while(value>>=1) log++;
+        return log;
+#endif
+    }
+
+    /*
+     * Varint kernels for encoding to and decoding from memory. Sizes are computed from the position of the highest
+     * bit, and decoding from memory locates the last byte of the varint with a single 8-byte load when possible.
+     * BMI2 deposit/extract instructions are used when the target supports them, with a portable fallback.
+     */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    #define PSON_VARINT_WORD_LOADS
+#endif
+
+    /**
+     * Number of bytes required to encode the value as a varint
+     */
+    inline uint8_t pson_varint_size(uint64_t value){
+#ifdef __GNUC__
+        return (uint8_t)((64 - __builtin_clzll(value | 1) + 6) / 7);
+#else
+        uint8_t size = 1;
+        while(value>>=7) size++;
+        return size;
+#endif
+    }
+
+    /**
+     * Encode the value as a varint in the given buffer, that must have room for, at least, 10 bytes
+     * @return number of bytes written
+     */
+    inline uint8_t pson_varint_encode(uint8_t* buffer, uint64_t value){
+        if(value < 0x80){
+            buffer[0] = (uint8_t) value;
+            return 1;
+        }
+        uint8_t size = pson_varint_size(value);
+#ifdef PSON_VARINT_WORD_LOADS
+        if(size <= 8){
+            // spread the 7 bit groups over the bytes, and set the continuation bit in all but the last one
+#ifdef __BMI2__
+            uint64_t word = _pdep_u64(value, 0x7F7F7F7F7F7F7F7FULL);
+#else
+            uint64_t word = (value & 0x000000000FFFFFFFULL) | ((value & 0x00FFFFFFF0000000ULL) << 4);
+            word = (word & 0x00003FFF00003FFFULL) | ((word & 0x0FFFC0000FFFC000ULL) << 2);
+            word = (word & 0x007F007F007F007FULL) | ((word & 0x3F803F803F803F80ULL) << 1);
+#endif
+            word |= 0x8080808080808080ULL & ((1ULL << (8*(size-1))) - 1);
+            memcpy(buffer, &word, 8);
+            return size;
+        }
+#endif
+        for(uint8_t i=0; i<size-1; i++){
+            buffer[i] = (uint8_t) value | 0x80;
+            value >>= 7;
+        }
+        buffer[size-1] = (uint8_t) value;
+        return size;
+    }
+
+    /**
+     * Decode a varint from memory
+     * @param available number of bytes that can be read from the buffer
+     * @return number of bytes read, or 0 if the varint is not complete within the available bytes (or 10 bytes)
+     */
+    inline uint8_t pson_varint_decode(const uint8_t* buffer, size_t available, uint64_t& value){
+        if(available>0 && buffer[0] < 0x80){
+            value = buffer[0];
+            return 1;
+        }
+#ifdef PSON_VARINT_WORD_LOADS
+        if(available >= 8){
+            uint64_t word;
+            memcpy(&word, buffer, 8);
+            uint64_t stops = ~word & 0x8080808080808080ULL;
+            if(stops){
+                uint8_t size = (uint8_t)(__builtin_ctzll(stops) >> 3) + 1;
+                if(size < 8) word &= (1ULL << (8*size)) - 1;
+#ifdef __BMI2__
+                value = _pext_u64(word, 0x7F7F7F7F7F7F7F7FULL);
+#else
+                // join the 7 bit groups in pairs, then 14 bit groups, then 28 bit groups
+                word &= 0x7F7F7F7F7F7F7F7FULL;
+                word = (word & 0x007F007F007F007FULL) | ((word & 0x7F007F007F007F00ULL) >> 1);
+                word = (word & 0x00003FFF00003FFFULL) | ((word & 0x3FFF00003FFF0000ULL) >> 2);
+                value = (word & 0x000000000FFFFFFFULL) | ((word & 0x0FFFFFFF00000000ULL) >> 4);
+#endif
+                return size;
+            }
+        }
+#endif
+        value = 0;
+        for(uint8_t i=0; i<10 && i<available; i++){
+            value |= (uint64_t)(buffer[i] & 0x7F) << (7*i);
+            if(buffer[i] < 0x80) return i+1;
+        }
+        return 0;
+    }
+
     template<class T>
     class pson_container {
 
-        class list_item{
-        public:
-            list_item() : next_(NULL), previous_(NULL) {}
-            ~list_item(){}
-
-            T item_;
-            list_item* next_;
-            list_item* previous_;
-        };
+        /*
+         * Items are stored in blocks of growing capacity (first block, twice the first block, four times...) that are
+         * never moved, so references to items remain valid while the container grows, and any item can be
+         * reached in O(1) from its index.
+         */
+        static const uint8_t default_block_shift = 2;
 
     public:
 
         class iterator{
         public:
-            iterator(list_item *item) : current_(item) {
+            iterator(const pson_container* container, size_t index) : container_(container), index_(index), item_(NULL), block_end_(NULL){
+                if(valid()) seek();
             }
 
         private:
-            list_item * current_;
+            const pson_container* container_;
+            size_t index_;
+            T* item_;
+            T* block_end_;
+
+            void seek(){
+                uint8_t block = container_->block_index(index_);
+                T* begin = container_->blocks_[block];
+                item_ = begin + (index_ - container_->block_start(block));
+                block_end_ = begin + container_->block_capacity(block);
+            }
 
         public:
 
             bool next(){
-                if(current_==NULL) return false;
-                current_ = current_->next_;
+                if(!valid()) return false;
+                index_++;
+                if(++item_==block_end_ && valid()) seek();
                 return true;
             }
 
             bool has_next(){
-                return current_!=NULL && current_->next_!=NULL;
+                return index_+1 < container_->size_;
             }
 
             bool valid(){
-                return current_!=NULL;
+                return index_ < container_->size_;
             }
 
             T& item(){
-                return current_->item_;
+                return *item_;
             }
         };
 
     private:
-        list_item* item_;
-        list_item* last_;
+        // allocator active when the container was created, that serves and releases its blocks and items
+        memory_allocator* allocator_;
+        T** blocks_;
+        size_t size_;
+        uint8_t block_shift_;
+        uint8_t blocks_count_;
+        // encoded size of the items plus one, or zero if unknown
+        uint32_t encoded_size_;
+
+        size_t block_capacity(uint8_t block) const{
+            return (size_t)1 << (block_shift_ + block);
+        }
+
+        size_t block_start(uint8_t block) const{
+            return ((size_t)1 << (block_shift_ + block)) - ((size_t)1 << block_shift_);
+        }
+
+        uint8_t block_index(size_t index) const{
+            return pson_log2(index + ((size_t)1 << block_shift_)) - block_shift_;
+        }
+
+        size_t capacity() const{
+            return blocks_count_ > 0 ? block_start(blocks_count_) : 0;
+        }
+
+        T* at(size_t index) const{
+            uint8_t block = block_index(index);
+            return &blocks_[block][index - block_start(block)];
+        }
+
+        bool add_block(){
+            T* block = (T*) allocator_->allocate(sizeof(T) * block_capacity(blocks_count_));
+            if(block==NULL) return false;
+            T** blocks = (T**) allocator_->allocate(sizeof(T*) * (blocks_count_+1));
+            if(blocks==NULL){
+                allocator_->deallocate(block);
+                return false;
+            }
+            if(blocks_count_>0) memcpy(blocks, blocks_, sizeof(T*) * blocks_count_);
+            allocator_->deallocate(blocks_);
+            blocks_ = blocks;
+            blocks_[blocks_count_++] = block;
+            return true;
+        }
 
     public:
         iterator begin() const{
-            return iterator(item_);
+            return iterator(this, 0);
         }
 
         iterator end() const{
-            return iterator(last_);
+            return iterator(this, size_ > 0 ? size_-1 : 0);
         }
 
-        pson_container() : item_(NULL), last_(NULL) {
+        pson_container() : allocator_(&current_allocator().owner()), blocks_(NULL), size_(0),
+            block_shift_(default_block_shift), blocks_count_(0), encoded_size_(0) {
         }
 
         ~pson_container(){
@@ -187,47 +526,71 @@ namespace protoson {
         }
 
         size_t size() const{
-            size_t size = 0;
-            list_item* current = item_;
-            while(current!=NULL){
-                current = current->next_;
-                size++;
-            }
-            return size;
+            return size_;
+        }
+
+        memory_allocator& get_allocator() const{
+            return *allocator_;
         }
 
         T* operator[](size_t index){
-            list_item* current = item_;
-            size_t current_index = 0;
-            while(current!=NULL){
-                if(current_index==index){
-                    return &current->item_;
-                }
-                current = current->next_;
-                current_index++;
+            return index<size_ ? at(index) : NULL;
+        }
+
+        /**
+         * Encoded size of the items, as cached by the last encoding. Items can be modified through references at
+         * any time, so encoders that write lengths after their contents only take it as the expected size (saving
+         * a move if it is right), and the other encoders only use the sizes cached while sizing the current encoding.
+         * @return true if an encoded size is cached
+         */
+        bool get_encoded_size(size_t& size) const{
+            if(encoded_size_==0) return false;
+            size = encoded_size_ - 1;
+            return true;
+        }
+
+        void set_encoded_size(size_t size){
+            encoded_size_ = size < UINT32_MAX ? (uint32_t)(size + 1) : 0;
+        }
+
+        void invalidate_encoded_size(){
+            encoded_size_ = 0;
+        }
+
+        /**
+         * Reserve memory for holding, at least, the given number of items. If the container is still empty, the
+         * reserved items are kept in a single block.
+         */
+        bool reserve(size_t items){
+            if(blocks_count_==0 && items > ((size_t)1 << block_shift_)){
+                block_shift_ = pson_log2(items-1) + 1;
             }
-            return NULL;
+            while(capacity()<items){
+                if(!add_block()) return false;
+            }
+            return true;
         }
 
         void clear(){
-            while(last_!=NULL){
-                list_item* previous = last_->previous_;
-                pool.destroy(last_);
-                last_ = previous;
+            encoded_size_ = 0;
+            memory_scope scope(*allocator_);
+            while(size_>0){
+                at(--size_)->~T();
             }
+            for(uint8_t i=0; i<blocks_count_; i++){
+                allocator_->deallocate(blocks_[i]);
+            }
+            allocator_->deallocate(blocks_);
+            blocks_ = NULL;
+            blocks_count_ = 0;
         }
 
         T* create_item(){
-            list_item* new_list_item = pool.allocate<list_item>();
-            if(new_list_item==NULL) return NULL;
-            if(item_==NULL){
-                item_ = new_list_item;
-            }else{
-                last_->next_ = new_list_item;
-                new_list_item->previous_ = last_;
-            }
-            last_ = new_list_item;
-            return &(new_list_item->item_);
+            encoded_size_ = 0;
+            if(size_==capacity() && !add_block()) return NULL;
+            T* item = new (at(size_), NULL) T();
+            size_++;
+            return item;
         }
     };
 
@@ -260,110 +623,178 @@ namespace protoson {
         // interchange two different containers
         static void swap(pson& source, pson& destination){
             // destroy destination container data (if any)
-            destination.~pson();
+            destination.release();
             // override fields
             destination.value_ = source.value_;
-            destination.field_type_ = source.field_type_;
             // 'clear' source container
-            source.value_ = NULL;
-            source.field_type_ = empty;
+            source.clear_value();
         }
 
         bool is_boolean() const{
-            return field_type_ == true_field || field_type_ == false_field;
+            return field_type_() == true_field || field_type_() == false_field;
         }
 
         bool is_string() const{
-            return field_type_ == string_field;
+            return field_type_() == string_field;
         }
 
         bool is_bytes() const{
-            return field_type_ == bytes_field;
+            return field_type_() == bytes_field;
         }
 
         bool is_number() const{
-            return  field_type_ == varint_field     ||
-                    field_type_ == svarint_field    ||
-                    field_type_ == float_field      ||
-                    field_type_ == double_field     ||
-                    field_type_ == zero_field       ||
-                    field_type_ == one_field;
+            return  field_type_() == varint_field     ||
+                    field_type_() == svarint_field    ||
+                    field_type_() == float_field      ||
+                    field_type_() == double_field     ||
+                    field_type_() == zero_field       ||
+                    field_type_() == one_field;
         }
 
         bool is_float() const{
-            return  field_type_ == float_field      ||
-                    field_type_ == double_field;
+            return  field_type_() == float_field      ||
+                    field_type_() == double_field;
         }
 
         bool is_integer() const{
-            return  field_type_ == varint_field     ||
-                    field_type_ == svarint_field    ||
-                    field_type_ == zero_field       ||
-                    field_type_ == one_field;
+            return  field_type_() == varint_field     ||
+                    field_type_() == svarint_field    ||
+                    field_type_() == zero_field       ||
+                    field_type_() == one_field;
         }
 
         bool is_object() const{
-            return field_type_ == object_field;
+            return field_type_() == object_field;
         }
 
         bool is_array() const{
-            return field_type_ == array_field;
+            return field_type_() == array_field;
         }
 
         bool is_null() const{
-            return field_type_ == null_field;
+            return field_type_() == null_field;
         }
 
         bool is_empty() const{
-            return field_type_ == empty;
+            return field_type_() == empty;
         }
 
-        pson() : value_(NULL), field_type_(empty) {
+        pson(){
+            clear_value();
         }
 
         template<class T>
-        pson(T value) : value_(NULL), field_type_(empty){
+        pson(T value){
+            clear_value();
             *this = value;
         }
 
+        /**
+         * Take the value of other pson, that is left empty. The value must be destroyed under the same allocator that
+         * built it, as with any other pson structure.
+         */
+        pson(pson&& other){
+            value_ = other.value_;
+            other.clear_value();
+        }
+
+        /**
+         * Copies are deep (see clone), as containers, strings, and bytes are owned by a single pson
+         */
+        pson(const pson& other){
+            clear_value();
+            other.clone(*this);
+        }
+
         ~pson(){
-            if(field_type_==object_field){
-                pool.destroy((pson_object *) value_);
-            }else if(field_type_==array_field) {
-                pool.destroy((pson_array *) value_);
-            }else{
-                pool.deallocate(value_);
+            release();
+        }
+
+        pson& operator=(pson&& other){
+            if(this!=&other){
+                swap(other, *this);
             }
-            value_ = NULL;
-            field_type_ = empty;
+            return *this;
+        }
+
+        pson& operator=(const pson& other){
+            if(this!=&other){
+                // copy before releasing this value, as the source may be part of it
+                pson copy(other);
+                swap(copy, *this);
+            }
+            return *this;
+        }
+
+        /**
+         * Deep copy of this value in the destination, allocating from the current allocator. Interned object keys are
+         * shared with the source.
+         * @return false if there was not memory to complete the copy
+         */
+        bool clone(pson& destination) const;
+
+        /**
+         * Turn this pson in a non-owning view of the source value, so containers, strings, and bytes are referenced
+         * without copying them. The view never releases the referenced memory, so it must not outlive the source.
+         */
+        void borrow(pson& source){
+            release();
+            value_ = source.value_;
+            if(!is_inline()) set_flags(flags_() | borrowed_flag);
+        }
+
+        bool is_borrowed() const{
+            return (flags_() & borrowed_flag) != 0;
+        }
+
+        /**
+         * Reference a string held by other memory instead of copying it (short strings are still copied inline).
+         * @param str string characters, followed by a null terminator, that must outlive this value
+         * @param size string size, without the null terminator
+         * @return false if the size does not fit in the value (16 MB on 32-bit targets)
+         */
+        bool borrow_string(const char* str, size_t size){
+            if(size < inline_string_size){
+                char* value = allocate_string(size);
+                memcpy(value, str, size);
+                return true;
+            }
+            return borrow_value(string_field, str, size);
+        }
+
+        /**
+         * Reference a bytes value held by other memory, that must outlive this value, instead of copying it
+         * @return false if the size does not fit in the value (16 MB on 32-bit targets)
+         */
+        bool borrow_bytes(const void* bytes, size_t size){
+            return borrow_value(bytes_field, bytes, size);
         }
 
         template<class T>
         void operator=(T value)
         {
+            release();
             if(value==0){
-                field_type_ = zero_field;
+                set_type(zero_field);
             }else if(value==1) {
-                field_type_ = one_field;
+                set_type(one_field);
             }else{
-                uint64_t uint_value = value>0 ? value : -value;
-                if(allocate(pson::get_varint_size(uint_value))){
-                    pb_encode_varint(uint_value);
-                    field_type_ = value>0 ? varint_field : svarint_field;
-                }
+                set_varint(value>0 ? value : -value, value<0);
             }
         }
 
         void operator=(bool value){
-            field_type_ = value ? true_field : false_field;
+            release();
+            set_type(value ? true_field : false_field);
         }
 
         void operator=(float value) {
             if(value==(int32_t)value){
                 *this = (int32_t) value;
             }else{
-                field_type_ = float_field;
+                release();
                 set(value);
+                set_type(float_field);
             }
         }
 
@@ -371,64 +802,93 @@ namespace protoson {
             if(value==(int64_t)value) {
                 *this = (int64_t) value;
             }else if(fabs(value-(float)value)<=0.00001){
-                field_type_ = float_field;
+                release();
                 set((float)value);
+                set_type(float_field);
             }else{
-                field_type_ = double_field;
-                set(value);
+                set_double(value);
             }
         }
 
         void operator=(const char *str) {
             size_t str_size = strlen(str);
             if(str_size==0){
-                field_type_ = empty_string;
-            }else if(allocate(str_size+1)){
-                memcpy(value_, str, str_size+1);
-                field_type_ = string_field;
+                release();
+                set_type(empty_string);
+            }else if(char* value = allocate_string(str_size)){
+                memcpy(value, str, str_size);
             }
         }
 
-        void set_bytes(void* bytes, size_t size) {
+        void set_bytes(const void* bytes, size_t size) {
             if(size>0){
-                size_t varint_size = get_varint_size(size);
-                if(allocate(varint_size+size)){
-                    pb_encode_varint(size);
-                    memcpy(((uint8_t*)value_)+varint_size, bytes, size);
-                    field_type_ = bytes_field;
+                if(uint8_t* value = allocate_bytes(size)){
+                    memcpy(value, bytes, size);
                 }
             }else{
-                field_type_ = empty_bytes;
+                release();
+                set_type(empty_bytes);
             }
         }
 
         bool get_bytes(const void*& bytes, size_t& size){
-            switch(field_type_){
+            switch(field_type_()){
                 case bytes_field:
-                    size = pb_decode_varint();
-                    bytes = (uint8_t*) value_ + get_varint_size(size);
+                    size = get_size();
+                    bytes = value_.pointer_;
                     return true;
                 case empty:
-                    field_type_ = empty_bytes;
+                    set_type(empty_bytes);
                     return false;
                 default:
                     return false;
             }
         }
 
-        bool allocate(size_t size){
-            if(value_ == NULL){
-                value_ = pool.allocate(size);
-                return value_!=NULL;
+        /**
+         * Reserve a string value of the given size (without the null terminator). Short strings are kept inline.
+         * @return buffer to be filled with the string characters, already null terminated, or NULL if there is no memory
+         * or the size does not fit in the value (16 MB on 32-bit targets)
+         */
+        char* allocate_string(size_t size){
+            release();
+            char* str;
+            if(size < inline_string_size){
+                str = (char*) value_.bytes_;
+                set_flags(inline_flag);
+            }else{
+                if(size > max_size) return NULL;
+                str = (char*) current_allocator().allocate(size+1);
+                if(str==NULL) return NULL;
+                value_.pointer_ = str;
+                set_size(size);
             }
-            return false;
+            str[size] = 0;
+            set_type(string_field);
+            return str;
+        }
+
+        /**
+         * Reserve a bytes value of the given size
+         * @return buffer to be filled with the bytes, or NULL if there is no memory or the size does not fit in the value
+         * (16 MB on 32-bit targets)
+         */
+        uint8_t* allocate_bytes(size_t size){
+            release();
+            if(size > max_size) return NULL;
+            uint8_t* bytes = (uint8_t*) current_allocator().allocate(size);
+            if(bytes==NULL) return NULL;
+            value_.pointer_ = bytes;
+            set_size(size);
+            set_type(bytes_field);
+            return bytes;
         }
 
         template <class T>
         bool allocate(){
-            if(value_ == NULL){
-                value_ = pool.allocate<T>();
-                return value_!=NULL;
+            if(value_.pointer_ == NULL){
+                value_.pointer_ = current_allocator().allocate<T>();
+                return value_.pointer_!=NULL;
             }
             return false;
         }
@@ -438,11 +898,11 @@ namespace protoson {
         pson & operator[](const char *name);
 
         operator const char *() {
-            switch(field_type_){
+            switch(field_type_()){
                 case string_field:
-                    return (const char*) value_;
+                    return (const char*) get_value();
                 case empty:
-                    field_type_ = empty_string;
+                    set_type(empty_string);
                     return "";
                 default:
                     return "";
@@ -450,7 +910,7 @@ namespace protoson {
         }
 
         operator bool(){
-            switch(field_type_){
+            switch(field_type_()){
                 case zero_field:
                 case false_field:
                     return false;
@@ -458,7 +918,7 @@ namespace protoson {
                 case true_field:
                     return true;
                 case empty:
-                    field_type_ = false_field;
+                    set_type(false_field);
                     return false;
                 default:
                     return false;
@@ -512,7 +972,7 @@ namespace protoson {
 
         template<class T>
         T get_value(){
-            switch(field_type_){
+            switch(field_type_()){
                 case zero_field:
                 case false_field:
                     return 0;
@@ -520,69 +980,103 @@ namespace protoson {
                 case true_field:
                     return 1;
                 case float_field:
-                    return *(float*)value_;
+                    return get<float>();
                 case double_field:
-                    return *(double*)value_;
+                    return get<double>();
                 case varint_field:
-                    return pb_decode_varint();
+                    return get_varint();
                 case svarint_field:
-                    return -pb_decode_varint();
+                    // negated as unsigned, so the magnitude of INT64_MIN does not overflow
+                    return (int64_t) (0 - get_varint());
                 case empty:
-                    field_type_ = zero_field;
+                    set_type(zero_field);
                     return 0;
                 default:
                     return 0;
             }
         }
 
+        /**
+         * Pointer to the value data: the inline storage for numbers and short strings, or the referenced memory
+         * for containers, long strings, and bytes.
+         */
         void* get_value(){
-            return value_;
+            return is_inline() ? (void*) value_.bytes_ : value_.pointer_;
+        }
+
+        /**
+         * Absolute value of a varint or svarint field
+         */
+        uint64_t get_varint() const{
+            if(sizeof(uint64_t) <= inline_value_size || (flags_() & boxed_flag)) return get<uint64_t>();
+            uint64_t value = 0;
+            for(size_t i=0; i<inline_value_size; i++){
+                value |= (uint64_t) value_.bytes_[i] << (8*i);
+            }
+            return value;
+        }
+
+        /**
+         * Set a varint or svarint field from its absolute value
+         * @return false if there is no memory for a value that does not fit in the storage
+         */
+        bool set_varint(uint64_t value, bool negative=false){
+            release();
+            if(sizeof(uint64_t) <= inline_value_size || (value >> varint_inline_bits) >> varint_inline_bits != 0){
+                if(!set(value)) return false;
+            }else{
+                // smaller storages keep the values that fit inline, one byte at a time
+                for(size_t i=0; i<inline_value_size; i++){
+                    value_.bytes_[i] = (uint8_t) (value >> (8*i));
+                }
+            }
+            set_type(negative ? svarint_field : varint_field);
+            return true;
+        }
+
+        /**
+         * Set a double field, without converting it to a smaller type
+         * @return false if there is no memory for a value that does not fit in the storage
+         */
+        bool set_double(double value){
+            release();
+            if(!set(value)) return false;
+            set_type(double_field);
+            return true;
+        }
+
+        /**
+         * Size of a string (without the null terminator) or bytes field
+         */
+        size_t get_size() const{
+            if(flags_() & inline_flag) return strlen((const char*) value_.bytes_);
+            size_t size = 0;
+            for(size_t i=0; i<size_bytes; i++){
+                size |= (size_t) value_.bytes_[sizeof(void*) + i] << (8*i);
+            }
+            return size;
         }
 
         field_type get_type() const{
-            return field_type_;
+            return field_type_();
         }
 
         void set_null(){
-            field_type_ = null_field;
-            // TODO free existing value_ (if any)
+            release();
+            set_type(null_field);
         }
 
+        /**
+         * Release any memory held by the value, leaving it empty
+         */
+        void release();
+
         void set_type(field_type type){
-            field_type_ = type;
+            value_.bytes_[storage_size-1] = (uint8_t) ((value_.bytes_[storage_size-1] & 0xF0) | type);
         }
 
         uint8_t get_varint_size(uint64_t value) const{
-            uint8_t size = 1;
-            while(value>>=7) size++;
-            return size;
-        }
-
-        void pb_encode_varint(uint64_t value) const
-        {
-            uint8_t count = 0;
-            do
-            {
-                uint8_t byte = (uint8_t)(value & 0x7F);
-                value >>= 7;
-                if(value) byte |= 0x80;
-                ((uint8_t*)value_)[count] = byte;
-                count++;
-            }while(value);
-        }
-
-        uint64_t pb_decode_varint() const
-        {
-            if(value_==NULL) return 0;
-            uint64_t value = 0;
-            uint8_t pos = 0;
-            uint8_t byte = 0;
-            do{
-                byte = ((uint8_t*)value_)[pos];
-                value |= (uint64_t)(byte&0x7F) << pos*7;
-                pos++;
-            }while(byte>=0x80);
-            return value;
+            return pson_varint_size(value);
         }
 
 #ifdef ARDUINO
@@ -604,62 +1098,410 @@ namespace protoson {
 #endif
 
     private:
-        void* value_;
-        field_type field_type_;
+        /*
+         * Values are kept in a fixed storage of two pointers (8 bytes on 32-bit targets), so numbers and short
+         * strings do not require any allocation. Its last byte holds the field type in the low bits and some flags in
+         * the high bits. Containers, long strings, and bytes are referenced by a pointer at the beginning of the
+         * storage, followed by their size (if any). Numbers that do not fit in the storage, as doubles on 32-bit
+         * targets, are boxed in allocated memory.
+         */
+        static const size_t storage_size = sizeof(void*) > 4 ? 16 : 8;
+        static const size_t inline_value_size = storage_size - 1;
+        static const size_t inline_string_size = storage_size - 1;
+        static const size_t size_bytes = storage_size - 1 - sizeof(void*) < 4 ? storage_size - 1 - sizeof(void*) : 4;
+        static const size_t max_size = size_bytes < 4 ? ((size_t)1 << (8*size_bytes)) - 1 : UINT32_MAX;
+        // half the bits of the varints kept inline (shifted twice, so it is never shifted by the type width)
+        static const size_t varint_inline_bits = inline_value_size < 8 ? 4*inline_value_size : 32;
+
+        enum flags{
+            inline_flag     = 1,
+            borrowed_flag   = 2,
+            boxed_flag      = 4
+        };
+
+        union{
+            void* pointer_;
+            uint8_t bytes_[storage_size];
+        } value_;
+
+        field_type field_type_() const{
+            return (field_type) (value_.bytes_[storage_size-1] & 0x0F);
+        }
+
+        uint8_t flags_() const{
+            return value_.bytes_[storage_size-1] >> 4;
+        }
+
+        void set_flags(uint8_t flags){
+            value_.bytes_[storage_size-1] = (uint8_t) ((flags << 4) | (value_.bytes_[storage_size-1] & 0x0F));
+        }
+
+        bool is_inline() const{
+            switch(field_type_()){
+                case varint_field:
+                case svarint_field:
+                case float_field:
+                case double_field:
+                    return (flags_() & boxed_flag) == 0;
+                case string_field:
+                    return (flags_() & inline_flag) != 0;
+                default:
+                    return false;
+            }
+        }
+
+        void set_size(size_t size){
+            for(size_t i=0; i<size_bytes; i++){
+                value_.bytes_[sizeof(void*) + i] = (uint8_t) (size >> (8*i));
+            }
+        }
+
+        bool borrow_value(field_type type, const void* data, size_t size){
+            release();
+            if(size > max_size) return false;
+            value_.pointer_ = (void*) data;
+            set_size(size);
+            set_type(type);
+            set_flags(borrowed_flag);
+            return true;
+        }
+
+        void clear_value(){
+            memset(&value_, 0, sizeof(value_));
+            set_type(empty);
+        }
 
         template<class T>
-        void set(T value) {
-            if(allocate(sizeof(T))){
-                memcpy(value_, &value, sizeof(T));
+        bool set(T value) {
+            if(sizeof(T) <= inline_value_size){
+                memcpy(value_.bytes_, &value, sizeof(T));
+                return true;
             }
+            void* boxed = current_allocator().allocate(sizeof(T));
+            if(boxed==NULL) return false;
+            memcpy(boxed, &value, sizeof(T));
+            value_.pointer_ = boxed;
+            set_flags(boxed_flag);
+            return true;
+        }
+
+        template<class T>
+        T get() const{
+            T value;
+            memcpy(&value, sizeof(T) <= inline_value_size ? value_.bytes_ : value_.pointer_, sizeof(T));
+            return value;
+        }
+    };
+
+    /**
+     * FNV-1a hash used for indexing object keys
+     */
+    inline uint32_t pson_hash(const char* str, size_t size){
+        uint32_t hash = 2166136261u;
+        for(size_t i=0; i<size; i++){
+            hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+/*
+ * Number of slots in the interned key table, that must be a power of two, and the maximum key size that is interned.
+ * Keys not meeting these limits are copied in the pair as before.
+ */
+#ifndef PSON_KEY_TABLE_SIZE
+    #define PSON_KEY_TABLE_SIZE 256
+#endif
+
+#ifndef PSON_KEY_MAX_INTERNED_SIZE
+    #define PSON_KEY_MAX_INTERNED_SIZE 32
+#endif
+
+    class pson_key;
+
+#ifdef ARDUINO
+    typedef pson_key* pson_key_slot;
+
+    inline pson_key* pson_key_load(pson_key_slot& slot){
+        return slot;
+    }
+
+    inline bool pson_key_publish(pson_key_slot& slot, pson_key*& expected, pson_key* key){
+        if(slot!=expected){
+            expected = slot;
+            return false;
+        }
+        slot = key;
+        return true;
+    }
+#else
+    typedef std::atomic<pson_key*> pson_key_slot;
+
+    inline pson_key* pson_key_load(pson_key_slot& slot){
+        return slot.load(std::memory_order_acquire);
+    }
+
+    inline bool pson_key_publish(pson_key_slot& slot, pson_key*& expected, pson_key* key){
+        return slot.compare_exchange_strong(expected, key, std::memory_order_acq_rel, std::memory_order_acquire);
+    }
+#endif
+
+    /**
+     * Object key, stored with its size and hash in front of the NUL terminated characters. A key is either owned by a
+     * single pson_pair and allocated from the current allocator, or interned in a process-wide table and shared, as
+     * an immutable key, by every pair with the same name.
+     */
+    class pson_key{
+    public:
+        uint32_t hash;
+        uint32_t size;
+        bool interned;
+
+        const char* name() const{
+            return (const char*)(this + 1);
+        }
+
+        char* name(){
+            return (char*)(this + 1);
+        }
+
+        bool equals(const char* str, size_t str_size, uint32_t str_hash) const{
+            return hash==str_hash && size==str_size && memcmp(name(), str, str_size)==0;
+        }
+
+        /**
+         * Returns a key for the given name, interned if possible, or owned otherwise.
+         */
+        static pson_key* acquire(const char* str, size_t size, uint32_t hash){
+            pson_key* key = intern(str, size, hash);
+            if(key==NULL && (key = allocate(size))!=NULL){
+                memcpy(key->name(), str, size);
+                key->hash = hash;
+            }
+            return key;
+        }
+
+        /**
+         * Allocates an owned key for a name of the given size. The caller must fill the name and its hash.
+         */
+        static pson_key* allocate(size_t size){
+            return init(current_allocator().allocate(sizeof(pson_key) + size + 1), size, 0, false);
+        }
+
+        static void release(pson_key* key){
+            if(key!=NULL && !key->interned){
+                current_allocator().deallocate(key);
+            }
+        }
+
+        /**
+         * Looks up the name in the interned key table, adding it if there is room in its probe sequence. Interned keys
+         * are never released. Returns NULL if the key cannot be interned. The keys used by the protocol are interned
+         * on first use, so they are always available even if the table gets full with application keys.
+         */
+        static pson_key* intern(const char* str, size_t size, uint32_t hash){
+            static const bool seeded = seed();
+            (void) seeded;
+            return insert(str, size, hash);
+        }
+
+    private:
+        static const uint32_t max_probes = 8;
+
+        static bool seed(){
+            static const char* const keys[] = {"in", "out", "al", "fn", "/"};
+            for(size_t i=0; i<sizeof(keys)/sizeof(keys[0]); i++){
+                size_t size = strlen(keys[i]);
+                insert(keys[i], size, pson_hash(keys[i], size));
+            }
+            return true;
+        }
+
+        static pson_key* insert(const char* str, size_t size, uint32_t hash){
+            if(size > PSON_KEY_MAX_INTERNED_SIZE) return NULL;
+            pson_key* candidate = NULL;
+            for(uint32_t i=0; i<max_probes; i++){
+                pson_key_slot& slot = table()[(hash + i) & (PSON_KEY_TABLE_SIZE - 1)];
+                pson_key* key = pson_key_load(slot);
+                if(key==NULL){
+                    if(candidate==NULL){
+                        candidate = init(malloc(sizeof(pson_key) + size + 1), size, hash, true);
+                        if(candidate==NULL) return NULL;
+                        memcpy(candidate->name(), str, size);
+                    }
+                    // on failure, key is updated with the key published by another thread in this slot
+                    if(pson_key_publish(slot, key, candidate)) return candidate;
+                }
+                if(key->equals(str, size, hash)){
+                    free(candidate);
+                    return key;
+                }
+            }
+            free(candidate);
+            return NULL;
+        }
+
+        static pson_key* init(void* memory, size_t size, uint32_t hash, bool interned){
+            if(memory==NULL) return NULL;
+            pson_key* key = (pson_key*) memory;
+            key->hash = hash;
+            key->size = (uint32_t) size;
+            key->interned = interned;
+            key->name()[size] = 0;
+            return key;
+        }
+
+        static pson_key_slot* table(){
+            static pson_key_slot slots[PSON_KEY_TABLE_SIZE];
+            return slots;
         }
     };
 
     class pson_pair{
     private:
-        char* name_;
+        pson_key* key_;
         pson value_;
     public:
-        pson_pair() : name_(NULL){
+        pson_pair() : key_(NULL){
         }
 
         ~pson_pair(){
-            pool.deallocate(name_);
+            pson_key::release(key_);
         }
 
         void set_name(const char *name) {
-            size_t name_size = strlen(name) + 1;
-            if(allocate_name(name_size)){
-                memcpy(name_, name, name_size);
+            set_name(name, strlen(name));
+        }
+
+        bool set_name(const char *name, size_t size) {
+            set_key(pson_key::acquire(name, size, pson_hash(name, size)));
+            return key_!=NULL;
+        }
+
+        void set_key(pson_key* key){
+            pson_key::release(key_);
+            key_ = key;
+        }
+
+        /**
+         * Set the same name of other pair, sharing its key if interned
+         */
+        bool copy_key(const pson_pair& other){
+            if(other.key_==NULL || other.key_->interned){
+                set_key(other.key_);
+            }else{
+                set_key(pson_key::acquire(other.key_->name(), other.key_->size, other.key_->hash));
             }
+            return key_==other.key_ || key_!=NULL;
         }
 
-        char* allocate_name(size_t size){
-            name_ = (char*)pool.allocate(size);
-            return name_;
+        const pson_key* key() const{
+            return key_;
         }
 
         pson& value(){
             return value_;
         }
 
-        char* name() const{
-            return name_;
+        const char* name() const{
+            return key_!=NULL ? key_->name() : NULL;
         }
     };
 
     class pson_object : public pson_container<pson_pair> {
+
+        /*
+         * Objects with at least this number of keys are looked up with a hash index (open addressing over the item
+         * positions), that is built lazily on lookup, so items are still stored (and encoded) in insertion order.
+         */
+        static const size_t index_threshold = 16;
+
+        uint32_t* index_;
+        uint32_t index_capacity_;
+        uint32_t indexed_;
+
+        void release_index(){
+            get_allocator().deallocate(index_);
+            index_ = NULL;
+            index_capacity_ = 0;
+            indexed_ = 0;
+        }
+
+        void index_item(uint32_t position){
+            const pson_key* key = pson_container<pson_pair>::operator[](position)->key();
+            if(key==NULL) return;
+            uint32_t mask = index_capacity_ - 1;
+            uint32_t slot = key->hash & mask;
+            while(index_[slot]!=0) slot = (slot + 1) & mask;
+            index_[slot] = position + 1;
+        }
+
+        bool update_index(){
+            size_t items = size();
+            // keep the load factor below 0.5
+            if(index_capacity_ < items*2){
+                uint32_t capacity = 32;
+                while(capacity < items*2) capacity <<= 1;
+                uint32_t* index = (uint32_t*) get_allocator().allocate(sizeof(uint32_t) * capacity);
+                if(index==NULL) return false;
+                release_index();
+                memset(index, 0, sizeof(uint32_t) * capacity);
+                index_ = index;
+                index_capacity_ = capacity;
+            }
+            // index any item added since the last lookup
+            while(indexed_ < items){
+                index_item(indexed_++);
+            }
+            return true;
+        }
+
+        pson_pair* find_indexed(const char* name, size_t size){
+            uint32_t hash = pson_hash(name, size);
+            uint32_t mask = index_capacity_ - 1;
+            for(uint32_t slot = hash & mask; index_[slot]!=0; slot = (slot + 1) & mask){
+                pson_pair* pair = pson_container<pson_pair>::operator[](index_[slot] - 1);
+                if(pair->key()->equals(name, size, hash)) return pair;
+            }
+            return NULL;
+        }
+
     public:
+        pson_object() : index_(NULL), index_capacity_(0), indexed_(0){
+        }
 
-        pson &operator[](const char *name) {
+        ~pson_object(){
+            release_index();
+        }
+
+        void clear(){
+            release_index();
+            pson_container<pson_pair>::clear();
+        }
+
+        pson_pair* find(const char* name){
+            return find(name, strlen(name));
+        }
+
+        pson_pair* find(const char* name, size_t name_size){
+            if(size() >= index_threshold && update_index()){
+                return find_indexed(name, name_size);
+            }
             for(iterator it=begin(); it.valid(); it.next()){
-                const char* item_name = it.item().name();
-                if(item_name && strcmp(item_name, name)==0){
-                    return it.item().value();
+                const pson_key* key = it.item().key();
+                if(key!=NULL && key->size==name_size && memcmp(key->name(), name, name_size)==0){
+                    return &it.item();
                 }
             }
+            return NULL;
+        }
+
+        pson &operator[](const char *name) {
+            size_t name_size = strlen(name);
+            if(pson_pair* pair = find(name, name_size)){
+                return pair->value();
+            }
             if(pson_pair* pair = create_item()){
-                pair->set_name(name);
+                pair->set_name(name, name_size);
                 return pair->value();
             }else{
                 static pson value;
@@ -680,13 +1522,36 @@ namespace protoson {
         }
     };
 
+    inline void pson::release(){
+        if(is_borrowed()){
+            clear_value();
+            return;
+        }
+        switch(field_type_()){
+            case object_field:
+                ((pson_object *) value_.pointer_)->get_allocator().destroy((pson_object *) value_.pointer_);
+                break;
+            case array_field:
+                ((pson_array *) value_.pointer_)->get_allocator().destroy((pson_array *) value_.pointer_);
+                break;
+            case string_field:
+            case bytes_field:
+                if(!(flags_() & inline_flag)) current_allocator().deallocate(value_.pointer_);
+                break;
+            default:
+                if(flags_() & boxed_flag) current_allocator().deallocate(value_.pointer_);
+                break;
+        }
+        clear_value();
+    }
+
     inline pson::operator pson_object &() {
-        if (field_type_ != object_field) {
-            value_ = pool.allocate<pson_object>();
-            field_type_ = value_ != NULL ? object_field : empty;
+        if (field_type_() != object_field) {
+            release();
+            if(allocate<pson_object>()) set_type(object_field);
         }
-        if(value_!=NULL && field_type_ == object_field){
-            return *((pson_object *)value_);
+        if(field_type_() == object_field){
+            return *((pson_object *)value_.pointer_);
         }else{
             static pson_object dummy;
             return dummy;
@@ -694,12 +1559,12 @@ namespace protoson {
     }
 
     inline pson::operator pson_array &() {
-        if (field_type_ != array_field) {
-            value_ = pool.allocate<pson_array>();
-            field_type_ = value_!=NULL ? array_field : empty;
+        if (field_type_() != array_field) {
+            release();
+            if(allocate<pson_array>()) set_type(array_field);
         }
-        if(value_!=NULL && field_type_==array_field){
-            return *((pson_array *)value_);
+        if(field_type_()==array_field){
+            return *((pson_array *)value_.pointer_);
         }else{
             static pson_array dummy;
             return dummy;
@@ -710,23 +1575,149 @@ namespace protoson {
         return ((pson_object &) *this)[name];
     }
 
+    inline bool pson::clone(pson& destination) const{
+        if(&destination==this) return true;
+        destination.release();
+        switch(field_type_()){
+            case object_field: {
+                pson_object& source = *(pson_object *) value_.pointer_;
+                pson_object& object = destination;
+                if(!destination.is_object() || !object.reserve(source.size())) return false;
+                for(pson_container<pson_pair>::iterator it = source.begin(); it.valid(); it.next()){
+                    pson_pair* pair = object.create_item();
+                    if(pair==NULL || !pair->copy_key(it.item()) || !it.item().value().clone(pair->value())) return false;
+                }
+                return true;
+            }
+            case array_field: {
+                pson_array& source = *(pson_array *) value_.pointer_;
+                pson_array& array = destination;
+                if(!destination.is_array() || !array.reserve(source.size())) return false;
+                for(pson_container<pson>::iterator it = source.begin(); it.valid(); it.next()){
+                    pson* item = array.create_item();
+                    if(item==NULL || !it.item().clone(*item)) return false;
+                }
+                return true;
+            }
+            case string_field:
+                if(!is_inline()){
+                    char* str = destination.allocate_string(get_size());
+                    if(str==NULL) return false;
+                    memcpy(str, value_.pointer_, get_size());
+                    return true;
+                }
+                break;
+            case bytes_field: {
+                uint8_t* bytes = destination.allocate_bytes(get_size());
+                if(bytes==NULL) return false;
+                memcpy(bytes, value_.pointer_, get_size());
+                return true;
+            }
+            case varint_field:
+            case svarint_field:
+                if(flags_() & boxed_flag) return destination.set_varint(get_varint(), field_type_()==svarint_field);
+                break;
+            case double_field:
+                if(flags_() & boxed_flag) return destination.set_double(get<double>());
+                break;
+            default:
+                break;
+        }
+        // numbers, short strings, and valueless fields are kept in the storage
+        destination.value_ = value_;
+        return true;
+    }
+
     ////////////////////////////
     /////// PSON_DECODER ///////
     ////////////////////////////
 
-    class pson_decoder {
+    /**
+     * Get the size of the pson value encoded at the beginning of a buffer, without decoding it
+     * @return the encoded value size, or 0 if the buffer does not hold a whole value
+     */
+    inline size_t pson_value_size(const uint8_t* buffer, size_t size){
+        uint64_t tag;
+        size_t tag_size = pson_varint_decode(buffer, size, tag);
+        if(tag_size==0) return 0;
+        size_t content_size = 0;
+        switch(tag >> 3){
+            case pson::string_field:
+            case pson::bytes_field:
+            case pson::object_field:
+            case pson::array_field: {
+                uint64_t length;
+                uint8_t length_size = pson_varint_decode(buffer + tag_size, size - tag_size, length);
+                if(length_size==0 || length > size) return 0;
+                content_size = length_size + length;
+                break;
+            }
+            case pson::svarint_field:
+            case pson::varint_field: {
+                uint64_t value;
+                content_size = pson_varint_decode(buffer + tag_size, size - tag_size, value);
+                if(content_size==0) return 0;
+                break;
+            }
+            case pson::float_field:
+                content_size = 4;
+                break;
+            case pson::double_field:
+                content_size = 8;
+                break;
+            default:
+                break;
+        }
+        return tag_size + content_size <= size ? tag_size + content_size : 0;
+    }
+
+    /**
+     * Decoder implementation, where the input methods are resolved at compile time from the Decoder type (that
+     * derives from this class), so they can be inlined. Decoder can redefine read, read_pinned, and peek.
+     */
+    template<class Decoder>
+    class pson_decoder_base {
 
     protected:
         size_t read_;
 
-        virtual bool read(void* buffer, size_t size){
+        Decoder& self(){
+            return static_cast<Decoder&>(*this);
+        }
+
+        bool consume(size_t size){
             read_+=size;
             return true;
         }
 
+        bool read(void* buffer, size_t size){
+            read_+=size;
+            return true;
+        }
+
+        /**
+         * Decoders reading from memory that outlives the decoded values can consume the next bytes in place, so
+         * strings and bytes reference the input instead of being copied. The input is modified to null terminate
+         * strings: string characters are moved one byte back, over their (already decoded) size prefix.
+         * @return address of the next size bytes in the input, or NULL if values must be copied
+         */
+        uint8_t* read_pinned(size_t /*size*/){
+            return NULL;
+        }
+
+        /**
+         * Decoders reading from memory can expose the remaining input, so varints are decoded and skipped from
+         * memory instead of reading them byte by byte. The decoder position is advanced with consume.
+         * @param available number of bytes that can be read from the returned address
+         * @return address of the next input byte, or NULL if not supported
+         */
+        const uint8_t* peek(size_t& /*available*/){
+            return NULL;
+        }
+
     public:
 
-        pson_decoder() : read_(0) {
+        pson_decoder_base() : read_(0) {
 
         }
 
@@ -748,11 +1739,19 @@ namespace protoson {
         }
 
         bool pb_decode_varint32(uint32_t& varint){
+            size_t available;
+            if(const uint8_t* input = self().peek(available)){
+                uint64_t value;
+                uint8_t size = pson_varint_decode(input, available, value);
+                if(size==0 || size>5) return false;
+                varint = (uint32_t) value;
+                return consume(size);
+            }
             varint = 0;
             uint8_t byte;
             uint8_t bit_pos = 0;
             do{
-                if(!read(&byte, 1) || bit_pos>=32){
+                if(!self().read(&byte, 1) || bit_pos>=32){
                     return false;
                 }
                 varint |= (uint32_t)(byte&0x7F) << bit_pos;
@@ -763,39 +1762,68 @@ namespace protoson {
 
         bool pb_decode_varint64(uint64_t& varint)
         {
+            size_t available;
+            if(const uint8_t* input = self().peek(available)){
+                uint8_t size = pson_varint_decode(input, available, varint);
+                return size>0 && consume(size);
+            }
             varint = 0;
             uint8_t byte;
             uint8_t bit_pos = 0;
             do{
-                if(!read(&byte, 1) || bit_pos>=64){
+                if(!self().read(&byte, 1) || bit_pos>=64){
                     return false;
                 }
-                varint |= (uint32_t)(byte&0x7F) << bit_pos;
+                varint |= (uint64_t)(byte&0x7F) << bit_pos;
                 bit_pos += 7;
             }while(byte>=0x80);
             return true;
         }
 
         bool pb_skip(size_t size){
-            uint8_t byte;
-            bool success = true;
-            for(size_t i=0; i<size && success; i++){
-                success = read(&byte, 1);
+            size_t available;
+            if(self().peek(available)!=NULL){
+                return size<=available && consume(size);
             }
-            return success;
+            // skip in chunks, so large values do not take a read per byte
+            uint8_t chunk[64];
+            while(size>0){
+                size_t chunk_size = size < sizeof(chunk) ? size : sizeof(chunk);
+                if(!self().read(chunk, chunk_size)) return false;
+                size -= chunk_size;
+            }
+            return true;
+        }
+
+        /**
+         * Read the next pson value in place, without decoding it, if the decoder input outlives the decoded values
+         * (see read_pinned). Otherwise nothing is read.
+         * @param size size of the encoded value
+         * @return address of the encoded value, or NULL if it cannot be read in place
+         */
+        uint8_t* pb_read_encoded(size_t& size){
+            size_t available;
+            const uint8_t* input = self().peek(available);
+            if(input==NULL) return NULL;
+            size = pson_value_size(input, available);
+            return size>0 ? self().read_pinned(size) : NULL;
         }
 
         bool pb_skip_varint(){
-            uint8_t byte;
-            bool success;
-            do{
-                success = read(&byte, 1);
-            }while(byte>0x80 && success);
-            return success;
+            uint64_t varint;
+            return pb_decode_varint64(varint);
+        }
+
+        bool pb_decode_fixed32(void* value){
+            return self().read(value, 4);
+        }
+
+        bool pb_decode_fixed64(void* value){
+            return self().read(value, 8);
         }
 
         bool pb_read_string(char *str, size_t size){
-            if(str && read(str, size)){
+            if(str && self().read(str, size)){
                 str[size]=0;
                 return true;
             }
@@ -804,20 +1832,9 @@ namespace protoson {
 
         bool pb_read_varint(pson& value)
         {
-            uint8_t temp[10];
-            uint8_t byte=0;
-            uint8_t bytes_read=0;
-            do{
-                if(bytes_read==10 || !read(&byte, 1)) return false;
-                temp[bytes_read] = byte;
-                bytes_read++;
-            }while(byte>=0x80);
-            if(value.allocate(bytes_read)){
-                memcpy(value.get_value(), temp, bytes_read);
-                return true;
-            }else{
-                return false;
-            }
+            uint64_t varint = 0;
+            if(!pb_decode_varint64(varint)) return false;
+            return value.set_varint(varint, value.get_type()==pson::svarint_field);
         }
 
     public:
@@ -846,32 +1863,47 @@ namespace protoson {
 
         bool decode(pson_pair & pair){
             uint32_t name_size;
-            if(pb_decode_varint32(name_size)){
-                return name_size != UINT32_MAX && pair.allocate_name(name_size + 1) && pb_read_string(pair.name(), name_size) && decode(pair.value());
+            if(!pb_decode_varint32(name_size) || name_size == UINT32_MAX) return false;
+            // short names are read in the stack, so the pair can take an interned key without allocating
+            if(name_size <= PSON_KEY_MAX_INTERNED_SIZE){
+                char name[PSON_KEY_MAX_INTERNED_SIZE];
+                return self().read(name, name_size) && pair.set_name(name, name_size) && decode(pair.value());
             }
-            return false;
+            pson_key* key = pson_key::allocate(name_size);
+            if(key==NULL) return false;
+            pair.set_key(key);
+            if(!self().read(key->name(), name_size)) return false;
+            key->hash = pson_hash(key->name(), name_size);
+            return decode(pair.value());
         }
 
         bool decode(pson& value) {
             uint32_t field_number;
             pb_wire_type wire_type;
             if(!pb_decode_tag(wire_type, field_number)) return false;
+            value.release();
             value.set_type((pson::field_type)field_number);
             if(wire_type==length_delimited){
                 uint32_t size = 0;
                 if(!pb_decode_varint32(size)) return false;
                 switch(field_number){
-                    case pson::string_field:
-                        return size!=UINT32_MAX && value.allocate(size+1) && pb_read_string((char*)value.get_value(), size);
+                    case pson::string_field: {
+                        if(size==UINT32_MAX) return false;
+                        if(uint8_t* pinned = self().read_pinned(size)){
+                            char* str = (char*) pinned - 1;
+                            memmove(str, pinned, size);
+                            str[size] = 0;
+                            return value.borrow_string(str, size);
+                        }
+                        char* str = value.allocate_string(size);
+                        return str!=NULL && self().read(str, size);
+                    }
                     case pson::bytes_field: {
-                        uint8_t varint_size = value.get_varint_size(size);
-                        if(size<=UINT32_MAX-varint_size && value.allocate(size + varint_size)){
-                            if(read((char*)value.get_value() + varint_size, size)){
-                                value.pb_encode_varint(size);
-                                return true;
-                            }
+                        if(uint8_t* pinned = self().read_pinned(size)){
+                            return value.borrow_bytes(pinned, size);
                         }
-                        return false;
+                        uint8_t* bytes = value.allocate_bytes(size);
+                        return bytes!=NULL && self().read(bytes, size);
                     }
                     case pson::object_field:
                         if(value.allocate<pson_object>()){
@@ -892,9 +1924,11 @@ namespace protoson {
                     case pson::varint_field:
                         return pb_read_varint(value);
                     case pson::float_field:
-                        return value.allocate(4) && read(value.get_value(), 4);
-                    case pson::double_field:
-                        return value.allocate(8) && read(value.get_value(), 8);
+                        return pb_decode_fixed32(value.get_value());
+                    case pson::double_field: {
+                        double number;
+                        return pb_decode_fixed64(&number) && value.set_double(number);
+                    }
                     case pson::null_field:
                     case pson::true_field:
                     case pson::false_field:
@@ -911,27 +1945,123 @@ namespace protoson {
         }
     };
 
+    /**
+     * Decoder with virtual input methods, that can be extended at runtime
+     */
+    class pson_decoder : public pson_decoder_base<pson_decoder> {
+        friend class pson_decoder_base<pson_decoder>;
+
+    protected:
+        virtual bool read(void* /*buffer*/, size_t size){
+            read_+=size;
+            return true;
+        }
+
+        virtual uint8_t* read_pinned(size_t /*size*/){
+            return NULL;
+        }
+
+        virtual const uint8_t* peek(size_t& /*available*/){
+            return NULL;
+        }
+    };
+
+    /**
+     * Decoder over a memory buffer, where the input methods are resolved at compile time. Decoded strings and bytes
+     * reference the buffer, so it must outlive the decoded values, and its contents are modified.
+     */
+    template<class Decoder>
+    class pson_buffer_decoder_base : public pson_decoder_base<Decoder>{
+        friend class pson_decoder_base<Decoder>;
+
+    public:
+        pson_buffer_decoder_base(uint8_t* buffer, size_t size) : buffer_(buffer), size_(size){}
+
+    protected:
+        bool read(void* buffer, size_t size){
+            if(this->read_+size<=size_){
+                memcpy(buffer, buffer_ + this->read_, size);
+                this->read_ += size;
+                return true;
+            }
+            return false;
+        }
+
+        const uint8_t* peek(size_t& available){
+            available = size_ - this->read_;
+            return buffer_ + this->read_;
+        }
+
+        uint8_t* read_pinned(size_t size){
+            if(this->read_+size>size_) return NULL;
+            uint8_t* data = buffer_ + this->read_;
+            this->read_ += size;
+            return data;
+        }
+
+    private:
+        uint8_t* buffer_;
+        size_t size_;
+    };
+
+    class pson_buffer_decoder : public pson_buffer_decoder_base<pson_buffer_decoder>{
+    public:
+        pson_buffer_decoder(uint8_t* buffer, size_t size) : pson_buffer_decoder_base<pson_buffer_decoder>(buffer, size){}
+    };
+
+    /**
+     * Decoder over a memory buffer that is never modified, so it can be shared (i.e., with views or writers). Decoded
+     * strings and bytes are copied instead of referencing the buffer.
+     */
+    class pson_shared_buffer_decoder : public pson_buffer_decoder_base<pson_shared_buffer_decoder>{
+        friend class pson_decoder_base<pson_shared_buffer_decoder>;
+
+    public:
+        pson_shared_buffer_decoder(const uint8_t* buffer, size_t size) :
+            pson_buffer_decoder_base<pson_shared_buffer_decoder>((uint8_t*) buffer, size){}
+
+    protected:
+        uint8_t* read_pinned(size_t){
+            return NULL;
+        }
+    };
+
     ////////////////////////////
     /////// PSON_ENCODER ///////
     ////////////////////////////
 
-    class pson_encoder {
+    template<class T>
+    size_t pson_encoded_size(T& element);
+
+    /**
+     * Encoder implementation, where the output methods are resolved at compile time from the Encoder type (that
+     * derives from this class), so they can be inlined. Encoder can redefine write, reserve_length, and commit_length.
+     */
+    template<class Encoder>
+    class pson_encoder_base {
 
     protected:
         size_t written_;
+        // the submessage being encoded was sized in this encoding, so the cached sizes of its items are up to date
+        bool sized_;
+
+        Encoder& self(){
+            return static_cast<Encoder&>(*this);
+        }
 
-        virtual bool write(const void* buffer, size_t size){
+        bool write(const void* /*buffer*/, size_t size){
             written_+=size;
             return true;
         }
 
     public:
 
-        pson_encoder() : written_(0) {
+        pson_encoder_base() : written_(0), sized_(false) {
         }
 
         void reset(){
             written_ = 0;
+            sized_ = false;
         }
 
         size_t bytes_written(){
@@ -957,19 +2087,14 @@ namespace protoson {
                 byte = *((uint8_t*)buffer + bytes_written);
                 bytes_written++;
             }while(byte>=0x80);
-            write(buffer, bytes_written);
+            self().write(buffer, bytes_written);
             return bytes_written;
         }
 
         void pb_encode_varint(uint64_t value)
         {
-            do
-            {
-                uint8_t byte = (uint8_t)(value & 0x7F);
-                value >>= 7;
-                if(value>0) byte |= 0x80;
-                write(&byte, 1);
-            }while(value>0);
+            uint8_t buffer[10];
+            self().write(buffer, pson_varint_encode(buffer, value));
         }
 
         void pb_encode_string(const char* str, uint32_t field_number){
@@ -981,26 +2106,83 @@ namespace protoson {
             if(str!=NULL){
                 size_t string_size = strlen(str);
                 pb_encode_varint(string_size);
-                write(str, string_size);
+                self().write(str, string_size);
             }
         }
 
+        /**
+         * Write an object key: its size followed by its characters
+         */
+        void pb_encode_key(const char* name, size_t size){
+            pb_encode_varint(size);
+            self().write(name, size);
+        }
+
         template<class T>
         void pb_encode_submessage(T& element, uint32_t field_number)
         {
             pb_encode_tag(length_delimited, field_number);
-            pson_encoder sink;
-            sink.encode(element);
-            pb_encode_varint(sink.bytes_written());
-            encode(element);
+            size_t size = 0;
+            bool cached = element.get_encoded_size(size);
+            size_t mark;
+            // a size cached by a previous encoding is just the expected size, as items may have been modified since
+            if(self().reserve_length(mark, size)){
+                encode(element);
+                // the size is only cached if the content was completely written
+                if(self().commit_length(mark, size)) element.set_encoded_size(size);
+            }else if(sized_ && cached){
+                pb_encode_varint(size);
+                encode(element);
+            }else{
+                // size the whole submessage once, caching the size of every nested container for this encoding
+                size = pson_encoded_size(element);
+                element.set_encoded_size(size);
+                bool outermost = !sized_;
+                sized_ = true;
+                pb_encode_varint(size);
+                encode(element);
+                if(outermost) sized_ = false;
+            }
+        }
+
+        /**
+         * Write the contents of a string or bytes value. Encoders may reference the value instead of copying it, as
+         * long as it is used before the encoded pson is modified or released.
+         */
+        bool write_value(const void* buffer, size_t size){
+            return self().write(buffer, size);
+        }
+
+        /**
+         * Encoders that can modify the written data may reserve the length prefix of a submessage and write it once
+         * its content has been encoded, so nested structures are encoded in a single pass. Otherwise, the content
+         * is sized with an additional pass, once per encoding.
+         * @param mark position to be passed to commit_length
+         * @param expected_size expected content size (if known), to reserve the right prefix size
+         * @return true if the length was reserved
+         */
+        bool reserve_length(size_t& /*mark*/, size_t /*expected_size*/){
+            return false;
+        }
+
+        /**
+         * Write the length of the content written since the given mark in its reserved prefix
+         * @param mark position returned by reserve_length
+         * @param length length of the content
+         * @return true if the content and its length were written, or false if the encoder failed. Encoders keep
+         * their failure state (see thinger_buffer_encoder::is_valid and pson_writer::is_valid), so the encoding of a
+         * whole value can be checked once, after it is done.
+         */
+        bool commit_length(size_t /*mark*/, size_t& /*length*/){
+            return false;
         }
 
         void pb_encode_fixed32(void* value){
-            write(value, 4);
+            self().write(value, 4);
         }
 
         void pb_encode_fixed64(void* value){
-            write(value, 8);
+            self().write(value, 8);
         }
 
         void pb_encode_fixed32(uint32_t field, void*value)
@@ -1034,23 +2216,24 @@ namespace protoson {
         }
 
         void encode(pson_pair & pair){
-            pb_encode_string(pair.name());
+            const pson_key* key = pair.key();
+            if(key!=NULL){
+                pb_encode_key(key->name(), key->size);
+            }
             encode(pair.value());
         }
 
         void encode(pson & value) {
             switch (value.get_type()) {
                 case pson::string_field:
-                    pb_encode_string((const char*)value.get_value(), pson::string_field);
-                    break;
                 case pson::bytes_field:
-                    pb_encode_tag(length_delimited, pson::bytes_field);
-                    write(((const char *) value.get_value()) + pb_write_varint(value.get_value()), value.pb_decode_varint());
+                    pb_encode_tag(length_delimited, value.get_type());
+                    pb_encode_varint(value.get_size());
+                    self().write_value(value.get_value(), value.get_size());
                     break;
                 case pson::svarint_field:
                 case pson::varint_field:
-                    pb_encode_tag(varint, value.get_type());
-                    pb_write_varint(value.get_value());
+                    pb_encode_varint(value.get_type(), value.get_varint());
                     break;
                 case pson::float_field:
                     pb_encode_fixed32(pson::float_field, value.get_value());
@@ -1070,6 +2253,88 @@ namespace protoson {
             }
         }
     };
+
+    /**
+     * Encoder that only counts the encoded bytes. Lengths are counted once their contents are known, so nested
+     * structures are sized in a single pass.
+     */
+    class pson_size_encoder : public pson_encoder_base<pson_size_encoder> {
+    public:
+        bool reserve_length(size_t& mark, size_t){
+            mark = written_;
+            return true;
+        }
+
+        bool commit_length(size_t mark, size_t& length){
+            length = written_ - mark;
+            written_ += pson_varint_size(length);
+            return true;
+        }
+    };
+
+    /**
+     * Size of an encoded pson structure
+     */
+    template<class T>
+    size_t pson_encoded_size(T& element){
+        pson_size_encoder sink;
+        sink.encode(element);
+        return sink.bytes_written();
+    }
+
+    /**
+     * Encoder over a memory buffer, where the output methods are resolved at compile time. Writes that do not fit in
+     * the buffer are discarded, so the output is complete only if bytes_written matches the expected size.
+     */
+    class pson_buffer_encoder : public pson_encoder_base<pson_buffer_encoder> {
+        friend class pson_encoder_base<pson_buffer_encoder>;
+
+    public:
+        pson_buffer_encoder(uint8_t* buffer, size_t size) : buffer_(buffer), size_(size){}
+
+    protected:
+        bool write(const void* buffer, size_t size){
+            if(written_+size>size_) return false;
+            memcpy(buffer_ + written_, buffer, size);
+            written_ += size;
+            return true;
+        }
+
+    private:
+        uint8_t* buffer_;
+        size_t size_;
+    };
+
+    /**
+     * Encoder with virtual output methods, that can be extended at runtime
+     */
+    class pson_encoder : public pson_encoder_base<pson_encoder> {
+        friend class pson_encoder_base<pson_encoder>;
+
+    protected:
+        virtual bool write(const void* /*buffer*/, size_t size){
+            written_+=size;
+            return true;
+        }
+
+    public:
+        // see pson_encoder_base::reserve_length
+        virtual bool reserve_length(size_t& /*mark*/, size_t /*expected_size*/){
+            return false;
+        }
+
+        // see pson_encoder_base::commit_length
+        virtual bool commit_length(size_t /*mark*/, size_t& /*length*/){
+            return false;
+        }
+    };
+
+#ifndef PSON_CUSTOM_DEFAULT_ALLOCATOR
+    inline memory_allocator& default_allocator(){
+        static dynamic_memory_allocator allocator;
+        return allocator;
+    }
+#endif
 }
 
 #endif
\ No newline at end of file
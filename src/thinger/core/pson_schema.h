@@ -0,0 +1,618 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS S.L.
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef PSON_SCHEMA_H
+#define PSON_SCHEMA_H
+
+#include <stddef.h>
+#include "pson.h"
+
+/**
+ * Describe a struct member as an object field named as the member, i.e., PSON_FIELD(sample, temp)
+ */
+#define PSON_FIELD(type, member) \
+    protoson::pson_field<decltype(((type*)0)->member)>(#member, offsetof(type, member))
+
+/**
+ * Describe a struct member as an object field with the given name, i.e., PSON_NAMED_FIELD(sample, timestamp, "ts")
+ */
+#define PSON_NAMED_FIELD(type, member, name) \
+    protoson::pson_field<decltype(((type*)0)->member)>(name, offsetof(type, member))
+
+/**
+ * Describe a nested struct member with its own schema, i.e., PSON_OBJECT_FIELD(sample, location, location_schema)
+ */
+#define PSON_OBJECT_FIELD(type, member, schema) \
+    protoson::pson_object_field(#member, offsetof(type, member), schema)
+
+namespace protoson {
+
+    class pson_schema_base;
+
+    /**
+     * Description of a struct member encoded as an object field. Fields are built at compile time, so the key
+     * of each field, and the tag of fixed size values, are constants written as they are.
+     */
+    struct pson_schema_field{
+        enum field_kind{
+            bool_kind,
+            int_kind,
+            uint_kind,
+            float_kind,
+            double_kind,
+            string_kind,        // char array holding a null terminated string
+            string_ptr_kind,    // const char* (only encoded)
+            object_kind         // nested struct with its own schema
+        };
+
+        const char* name;
+        size_t offset;
+        // member size, or the capacity of char arrays
+        size_t size;
+        const pson_schema_base* schema;
+        uint8_t name_size;
+        uint8_t kind;
+
+        constexpr pson_schema_field(const char* name, uint8_t name_size, uint8_t kind, size_t size, size_t offset,
+                                    const pson_schema_base* schema) :
+            name(name), offset(offset), size(size), schema(schema), name_size(name_size), kind(kind)
+        {}
+    };
+
+    template<class T>
+    struct pson_field_kind;
+
+    template<> struct pson_field_kind<bool>{ static const uint8_t value = pson_schema_field::bool_kind; };
+    template<> struct pson_field_kind<char>{ static const uint8_t value = pson_schema_field::int_kind; };
+    template<> struct pson_field_kind<signed char>{ static const uint8_t value = pson_schema_field::int_kind; };
+    template<> struct pson_field_kind<short>{ static const uint8_t value = pson_schema_field::int_kind; };
+    template<> struct pson_field_kind<int>{ static const uint8_t value = pson_schema_field::int_kind; };
+    template<> struct pson_field_kind<long>{ static const uint8_t value = pson_schema_field::int_kind; };
+    template<> struct pson_field_kind<long long>{ static const uint8_t value = pson_schema_field::int_kind; };
+    template<> struct pson_field_kind<unsigned char>{ static const uint8_t value = pson_schema_field::uint_kind; };
+    template<> struct pson_field_kind<unsigned short>{ static const uint8_t value = pson_schema_field::uint_kind; };
+    template<> struct pson_field_kind<unsigned int>{ static const uint8_t value = pson_schema_field::uint_kind; };
+    template<> struct pson_field_kind<unsigned long>{ static const uint8_t value = pson_schema_field::uint_kind; };
+    template<> struct pson_field_kind<unsigned long long>{ static const uint8_t value = pson_schema_field::uint_kind; };
+    template<> struct pson_field_kind<float>{ static const uint8_t value = pson_schema_field::float_kind; };
+    template<> struct pson_field_kind<double>{ static const uint8_t value = pson_schema_field::double_kind; };
+    template<> struct pson_field_kind<const char*>{ static const uint8_t value = pson_schema_field::string_ptr_kind; };
+    template<> struct pson_field_kind<char*>{ static const uint8_t value = pson_schema_field::string_ptr_kind; };
+    template<size_t N> struct pson_field_kind<char[N]>{ static const uint8_t value = pson_schema_field::string_kind; };
+
+    /**
+     * Field for a struct member of type T (numbers, booleans, char arrays, or string pointers)
+     */
+    template<class T, size_t N>
+    constexpr pson_schema_field pson_field(const char (&name)[N], size_t offset){
+        static_assert(N>1 && N<=128, "field names must have between 1 and 127 characters");
+        return pson_schema_field(name, N-1, pson_field_kind<T>::value, sizeof(T), offset, NULL);
+    }
+
+    /**
+     * Field for a nested struct member, encoded with its own schema
+     */
+    template<size_t N>
+    constexpr pson_schema_field pson_object_field(const char (&name)[N], size_t offset, const pson_schema_base& schema){
+        static_assert(N>1 && N<=128, "field names must have between 1 and 127 characters");
+        return pson_schema_field(name, N-1, pson_schema_field::object_kind, 0, offset, &schema);
+    }
+
+    /**
+     * Schema of a fixed-shape struct, described by a table of fields. Structs are encoded as pson objects straight
+     * from their members, and decoded straight into them, without building a pson tree or allocating memory.
+     * The untyped interface takes the struct address, so it can be kept by messages and resources.
+     */
+    class pson_schema_base{
+    public:
+        template<size_t N>
+        constexpr pson_schema_base(const pson_schema_field (&fields)[N]) : fields_(fields), count_(N)
+        {}
+
+        constexpr pson_schema_base(const pson_schema_field* fields, size_t count) : fields_(fields), count_(count)
+        {}
+
+        size_t size() const{
+            return count_;
+        }
+
+        const pson_schema_field& field(size_t index) const{
+            return fields_[index];
+        }
+
+        /**
+         * Encode the struct as a pson object
+         */
+        template<class Encoder>
+        void encode(Encoder& encoder, const void* object) const{
+            encoder.pb_encode_tag(length_delimited, pson::object_field);
+            size_t mark;
+            if(encoder.reserve_length(mark, 0)){
+                size_t length;
+                encode_fields(encoder, object);
+                // a failure is kept by the encoder, to be checked once the enclosing value is encoded
+                encoder.commit_length(mark, length);
+            }else{
+                pson_size_encoder sink;
+                encode_fields(sink, object);
+                encoder.pb_encode_varint(sink.bytes_written());
+                encode_fields(encoder, object);
+            }
+        }
+
+        /**
+         * Size of the struct encoded as a pson object
+         */
+        size_t encoded_size(const void* object) const{
+            pson_size_encoder sink;
+            encode(sink, object);
+            return sink.bytes_written();
+        }
+
+        /**
+         * Decode a pson object into the struct. Object keys without a field are skipped, and fields without a key,
+         * or holding a value of another type (i.e., a string in a number field), are left unchanged.
+         * @return false if the input is not a valid pson object
+         */
+        template<class Decoder>
+        bool decode(Decoder& decoder, void* object) const{
+            pb_wire_type wire_type;
+            uint32_t field_number;
+            uint32_t size;
+            if(!decoder.pb_decode_tag(wire_type, field_number)) return false;
+            if(wire_type!=length_delimited || field_number!=pson::object_field) return false;
+            return decoder.pb_decode_varint32(size) && decode_fields(decoder, object, size);
+        }
+
+        /**
+         * Fill a pson value with the struct contents (for the code paths that still need a pson tree)
+         */
+        void fill(const void* object, pson& value) const{
+            pson_object& content = value;
+            if(!value.is_object()) return;
+            for(size_t i=0; i<count_; i++){
+                const pson_schema_field& field = fields_[i];
+                const uint8_t* member = (const uint8_t*) object + field.offset;
+                pson_pair* pair = content.create_item();
+                if(pair==NULL || !pair->set_name(field.name, field.name_size)) return;
+                pson& item = pair->value();
+                switch(field.kind){
+                    case pson_schema_field::bool_kind:
+                        item = *(const bool*) member;
+                        break;
+                    case pson_schema_field::int_kind:
+                        item = read_int(member, field.size);
+                        break;
+                    case pson_schema_field::uint_kind:
+                        item = read_uint(member, field.size);
+                        break;
+                    case pson_schema_field::float_kind: {
+                        float number;
+                        memcpy(&number, member, sizeof(number));
+                        item = number;
+                        break;
+                    }
+                    case pson_schema_field::double_kind: {
+                        double number;
+                        memcpy(&number, member, sizeof(number));
+                        item = number;
+                        break;
+                    }
+                    case pson_schema_field::string_kind: {
+                        size_t size = string_size((const char*) member, field.size);
+                        if(size==0){
+                            item = "";
+                        }else if(char* str = item.allocate_string(size)){
+                            memcpy(str, member, size);
+                        }
+                        break;
+                    }
+                    case pson_schema_field::string_ptr_kind: {
+                        const char* str = *(const char* const*) member;
+                        item = str!=NULL ? str : "";
+                        break;
+                    }
+                    case pson_schema_field::object_kind:
+                        field.schema->fill(member, item);
+                        break;
+                }
+            }
+        }
+
+        /**
+         * Read the struct from a pson object, with the same rules of decode
+         * @return false if the value is not an object
+         */
+        bool read(pson& value, void* object) const{
+            if(!value.is_object()) return false;
+            pson_object& content = value;
+            for(size_t i=0; i<count_; i++){
+                const pson_schema_field& field = fields_[i];
+                pson_pair* pair = content.find(field.name, field.name_size);
+                if(pair==NULL) continue;
+                pson& item = pair->value();
+                uint8_t* member = (uint8_t*) object + field.offset;
+                switch(field.kind){
+                    case pson_schema_field::object_kind:
+                        field.schema->read(item, member);
+                        break;
+                    case pson_schema_field::string_kind:
+                        if(item.is_string()){
+                            size_t size = item.get_size();
+                            if(size>=field.size) size = field.size-1;
+                            memcpy(member, item.get_value(), size);
+                            member[size] = 0;
+                        }else if(item.get_type()==pson::empty_string){
+                            member[0] = 0;
+                        }
+                        break;
+                    case pson_schema_field::string_ptr_kind:
+                        break;
+                    default:
+                        switch(item.get_type()){
+                            case pson::zero_field:
+                            case pson::false_field:
+                                store_number(field, member, false, 0, 0, false);
+                                break;
+                            case pson::one_field:
+                            case pson::true_field:
+                                store_number(field, member, false, 0, 1, false);
+                                break;
+                            case pson::varint_field:
+                            case pson::svarint_field:
+                                store_number(field, member, false, 0, item.get_varint(),
+                                             item.get_type()==pson::svarint_field);
+                                break;
+                            case pson::float_field:
+                            case pson::double_field:
+                                store_number(field, member, true, item.get_value<double>(), 0, false);
+                                break;
+                            default:
+                                break;
+                        }
+                }
+            }
+            return true;
+        }
+
+    private:
+        const pson_schema_field* fields_;
+        size_t count_;
+
+        template<class Encoder>
+        void encode_fields(Encoder& encoder, const void* object) const{
+            for(size_t i=0; i<count_; i++){
+                const pson_schema_field& field = fields_[i];
+                const uint8_t* member = (const uint8_t*) object + field.offset;
+                encoder.pb_encode_key(field.name, field.name_size);
+                switch(field.kind){
+                    case pson_schema_field::bool_kind:
+                        encoder.pb_encode_tag(varint, *(const bool*) member ? pson::true_field : pson::false_field);
+                        break;
+                    case pson_schema_field::int_kind: {
+                        int64_t value = read_int(member, field.size);
+                        encode_integer(encoder, value<0 ? -(uint64_t)value : (uint64_t)value, value<0);
+                        break;
+                    }
+                    case pson_schema_field::uint_kind:
+                        encode_integer(encoder, read_uint(member, field.size), false);
+                        break;
+                    case pson_schema_field::float_kind: {
+                        float value;
+                        memcpy(&value, member, sizeof(value));
+                        encode_float(encoder, value);
+                        break;
+                    }
+                    case pson_schema_field::double_kind: {
+                        double value;
+                        memcpy(&value, member, sizeof(value));
+                        encode_double(encoder, value);
+                        break;
+                    }
+                    case pson_schema_field::string_kind:
+                        encode_string(encoder, (const char*) member, string_size((const char*) member, field.size));
+                        break;
+                    case pson_schema_field::string_ptr_kind: {
+                        const char* str = *(const char* const*) member;
+                        encode_string(encoder, str, str!=NULL ? strlen(str) : 0);
+                        break;
+                    }
+                    case pson_schema_field::object_kind:
+                        field.schema->encode(encoder, member);
+                        break;
+                }
+            }
+        }
+
+        template<class Decoder>
+        bool decode_fields(Decoder& decoder, void* object, size_t size) const{
+            size_t end = decoder.bytes_read() + size;
+            size_t next = 0;
+            while(decoder.bytes_read()<end){
+                uint32_t name_size;
+                if(!decoder.pb_decode_varint32(name_size)) return false;
+                const pson_schema_field* field = NULL;
+                if(name_size<128){
+                    char name[128];
+                    if(!decoder.pb_read_string(name, name_size)) return false;
+                    field = find(name, name_size, next);
+                }else if(!decoder.pb_skip(name_size)){
+                    return false;
+                }
+                if(!(field!=NULL ? decode_value(decoder, *field, object) : skip_value(decoder))) return false;
+            }
+            return decoder.bytes_read()==end;
+        }
+
+        /**
+         * Find the field with the given name. Keys usually come in the field order, so the search starts after the
+         * last field found.
+         */
+        const pson_schema_field* find(const char* name, size_t size, size_t& next) const{
+            for(size_t i=0; i<count_; i++){
+                size_t index = next + i < count_ ? next + i : next + i - count_;
+                const pson_schema_field& field = fields_[index];
+                if(field.name_size==size && memcmp(field.name, name, size)==0){
+                    next = index + 1;
+                    return &field;
+                }
+            }
+            return NULL;
+        }
+
+        template<class Decoder>
+        bool decode_value(Decoder& decoder, const pson_schema_field& field, void* object) const{
+            pb_wire_type wire_type;
+            uint32_t field_number;
+            if(!decoder.pb_decode_tag(wire_type, field_number)) return false;
+            uint8_t* member = (uint8_t*) object + field.offset;
+            uint32_t size;
+            switch(field.kind){
+                case pson_schema_field::object_kind:
+                    if(wire_type==length_delimited && field_number==pson::object_field){
+                        return decoder.pb_decode_varint32(size) && field.schema->decode_fields(decoder, member, size);
+                    }
+                    return skip_content(decoder, wire_type, field_number);
+                case pson_schema_field::string_kind:
+                    if(wire_type==length_delimited && field_number==pson::string_field){
+                        if(!decoder.pb_decode_varint32(size)) return false;
+                        size_t copy = size<field.size ? size : field.size-1;
+                        return decoder.pb_read_string((char*) member, copy) && decoder.pb_skip(size-copy);
+                    }
+                    if(field_number==pson::empty_string) member[0] = 0;
+                    return skip_content(decoder, wire_type, field_number);
+                case pson_schema_field::string_ptr_kind:
+                    return skip_content(decoder, wire_type, field_number);
+                default:
+                    break;
+            }
+            switch(field_number){
+                case pson::zero_field:
+                case pson::false_field:
+                    store_number(field, member, false, 0, 0, false);
+                    return true;
+                case pson::one_field:
+                case pson::true_field:
+                    store_number(field, member, false, 0, 1, false);
+                    return true;
+                case pson::varint_field:
+                case pson::svarint_field: {
+                    uint64_t value;
+                    if(wire_type!=varint || !decoder.pb_decode_varint64(value)) return false;
+                    store_number(field, member, false, 0, value, field_number==pson::svarint_field);
+                    return true;
+                }
+                case pson::float_field: {
+                    float value;
+                    if(wire_type!=fixed_32 || !decoder.pb_decode_fixed32(&value)) return false;
+                    store_number(field, member, true, value, 0, false);
+                    return true;
+                }
+                case pson::double_field: {
+                    double value;
+                    if(wire_type!=fixed_64 || !decoder.pb_decode_fixed64(&value)) return false;
+                    store_number(field, member, true, value, 0, false);
+                    return true;
+                }
+                default:
+                    return skip_content(decoder, wire_type, field_number);
+            }
+        }
+
+        template<class Decoder>
+        static bool skip_value(Decoder& decoder){
+            pb_wire_type wire_type;
+            uint32_t field_number;
+            return decoder.pb_decode_tag(wire_type, field_number) && skip_content(decoder, wire_type, field_number);
+        }
+
+        template<class Decoder>
+        static bool skip_content(Decoder& decoder, pb_wire_type wire_type, uint32_t field_number){
+            switch(wire_type){
+                case varint:
+                    // only varint numbers have content, other types are just encoded in the tag
+                    return (field_number!=pson::varint_field && field_number!=pson::svarint_field) ||
+                           decoder.pb_skip_varint();
+                case fixed_32:
+                    return decoder.pb_skip(4);
+                case fixed_64:
+                    return decoder.pb_skip(8);
+                case length_delimited: {
+                    uint32_t size;
+                    return decoder.pb_decode_varint32(size) && decoder.pb_skip(size);
+                }
+                default:
+                    return false;
+            }
+        }
+
+        template<class Encoder>
+        static void encode_integer(Encoder& encoder, uint64_t value, bool negative){
+            if(value==0){
+                encoder.pb_encode_tag(varint, pson::zero_field);
+            }else if(value==1 && !negative){
+                encoder.pb_encode_tag(varint, pson::one_field);
+            }else{
+                encoder.pb_encode_varint(negative ? pson::svarint_field : pson::varint_field, value);
+            }
+        }
+
+        /**
+         * Numbers are encoded as a pson value would store them (as fill does): integral values as integers, and
+         * doubles that fit a float as floats
+         */
+        template<class Encoder>
+        static void encode_float(Encoder& encoder, float value){
+            if(value==(int32_t)value){
+                int32_t number = (int32_t) value;
+                encode_integer(encoder, number<0 ? -(uint64_t)number : (uint64_t)number, number<0);
+            }else{
+                encoder.pb_encode_fixed32(pson::float_field, &value);
+            }
+        }
+
+        template<class Encoder>
+        static void encode_double(Encoder& encoder, double value){
+            if(value==(int64_t)value){
+                int64_t number = (int64_t) value;
+                encode_integer(encoder, number<0 ? -(uint64_t)number : (uint64_t)number, number<0);
+            }else if(fabs(value-(float)value)<=0.00001){
+                float single = (float) value;
+                encoder.pb_encode_fixed32(pson::float_field, &single);
+            }else{
+                encoder.pb_encode_fixed64(pson::double_field, &value);
+            }
+        }
+
+        template<class Encoder>
+        static void encode_string(Encoder& encoder, const char* str, size_t size){
+            if(size==0){
+                encoder.pb_encode_tag(varint, pson::empty_string);
+            }else{
+                encoder.pb_encode_tag(length_delimited, pson::string_field);
+                encoder.pb_encode_varint(size);
+                encoder.write_value(str, size);
+            }
+        }
+
+        static size_t string_size(const char* str, size_t capacity){
+            const char* end = (const char*) memchr(str, 0, capacity);
+            return end!=NULL ? end - str : capacity;
+        }
+
+        static int64_t read_int(const uint8_t* member, size_t size){
+            switch(size){
+                case 1: { int8_t value; memcpy(&value, member, 1); return value; }
+                case 2: { int16_t value; memcpy(&value, member, 2); return value; }
+                case 4: { int32_t value; memcpy(&value, member, 4); return value; }
+                default: { int64_t value; memcpy(&value, member, 8); return value; }
+            }
+        }
+
+        static uint64_t read_uint(const uint8_t* member, size_t size){
+            switch(size){
+                case 1: { uint8_t value; memcpy(&value, member, 1); return value; }
+                case 2: { uint16_t value; memcpy(&value, member, 2); return value; }
+                case 4: { uint32_t value; memcpy(&value, member, 4); return value; }
+                default: { uint64_t value; memcpy(&value, member, 8); return value; }
+            }
+        }
+
+        /**
+         * Store a decoded number in a numeric or boolean member, either from a float, or from an integer magnitude
+         */
+        static void store_number(const pson_schema_field& field, uint8_t* member, bool is_float, double number,
+                                 uint64_t magnitude, bool negative){
+            switch(field.kind){
+                case pson_schema_field::bool_kind:
+                    *(bool*) member = is_float ? number!=0 : magnitude!=0;
+                    break;
+                case pson_schema_field::int_kind:
+                case pson_schema_field::uint_kind: {
+                    uint64_t value = is_float ? (uint64_t)(int64_t) number : (negative ? -magnitude : magnitude);
+                    switch(field.size){
+                        case 1: { uint8_t truncated = (uint8_t) value; memcpy(member, &truncated, 1); break; }
+                        case 2: { uint16_t truncated = (uint16_t) value; memcpy(member, &truncated, 2); break; }
+                        case 4: { uint32_t truncated = (uint32_t) value; memcpy(member, &truncated, 4); break; }
+                        default: memcpy(member, &value, 8);
+                    }
+                    break;
+                }
+                case pson_schema_field::float_kind: {
+                    float value = is_float ? (float) number : (negative ? -(float) magnitude : (float) magnitude);
+                    memcpy(member, &value, sizeof(value));
+                    break;
+                }
+                case pson_schema_field::double_kind: {
+                    double value = is_float ? number : (negative ? -(double) magnitude : (double) magnitude);
+                    memcpy(member, &value, sizeof(value));
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    };
+
+    /**
+     * Schema of a struct of type T, i.e.:
+     *
+     *   struct sample{ float temp; float hum; uint32_t ts; };
+     *   static const protoson::pson_schema_field sample_fields[] = {
+     *       PSON_FIELD(sample, temp), PSON_FIELD(sample, hum), PSON_FIELD(sample, ts)
+     *   };
+     *   static const protoson::pson_schema<sample> sample_schema(sample_fields);
+     */
+    template<class T>
+    class pson_schema : public pson_schema_base{
+    public:
+        template<size_t N>
+        constexpr pson_schema(const pson_schema_field (&fields)[N]) : pson_schema_base(fields)
+        {}
+
+        template<class Encoder>
+        void encode(Encoder& encoder, const T& object) const{
+            pson_schema_base::encode(encoder, &object);
+        }
+
+        size_t encoded_size(const T& object) const{
+            return pson_schema_base::encoded_size(&object);
+        }
+
+        template<class Decoder>
+        bool decode(Decoder& decoder, T& object) const{
+            return pson_schema_base::decode(decoder, &object);
+        }
+
+        void fill(const T& object, pson& value) const{
+            pson_schema_base::fill(&object, value);
+        }
+
+        bool read(pson& value, T& object) const{
+            return pson_schema_base::read(value, &object);
+        }
+    };
+
+}
+
+#endif
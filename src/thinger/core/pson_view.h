@@ -0,0 +1,346 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS S.L.
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef PSON_VIEW_H
+#define PSON_VIEW_H
+
+#include "pson.h"
+
+#ifndef PSON_VISIT_MAX_DEPTH
+    #define PSON_VISIT_MAX_DEPTH 32
+#endif
+
+namespace protoson {
+
+    /**
+     * Base for the visitors of encoded pson, with handlers that ignore every event. Visitors redefine the handlers
+     * they need, which are resolved at compile time, and return false from any handler to stop the visit. Strings
+     * and bytes reference the encoded input, and strings are not null terminated.
+     */
+    class pson_visitor{
+    public:
+        bool begin_object(){ return true; }
+        bool end_object(){ return true; }
+        bool begin_array(){ return true; }
+        bool end_array(){ return true; }
+        bool on_key(const char* /*name*/, size_t /*size*/){ return true; }
+        bool on_null(){ return true; }
+        bool on_bool(bool /*value*/){ return true; }
+        // integers above INT64_MAX are received as negative numbers
+        bool on_int(int64_t /*value*/){ return true; }
+        bool on_float(double /*value*/){ return true; }
+        bool on_string(const char* /*str*/, size_t /*size*/){ return true; }
+        bool on_bytes(const void* /*bytes*/, size_t /*size*/){ return true; }
+    };
+
+    /**
+     * Walk an encoded pson value, calling the visitor for each element, without decoding it or allocating memory
+     * @return true if the whole value was visited, or false if it is not valid or the visitor stopped the visit
+     */
+    template<class Visitor>
+    bool pson_visit(const uint8_t* data, size_t size, Visitor& visitor, uint8_t depth=0){
+        const uint8_t* end = data + size;
+        const uint8_t* input = data;
+        uint64_t tag;
+        uint8_t tag_size = pson_varint_decode(input, end-input, tag);
+        if(tag_size==0) return false;
+        input += tag_size;
+        uint64_t value = 0;
+        switch(tag >> 3){
+            case pson::string_field:
+            case pson::bytes_field:
+            case pson::object_field:
+            case pson::array_field: {
+                uint8_t length_size = pson_varint_decode(input, end-input, value);
+                if(length_size==0 || value>(uint64_t)(end-input-length_size)) return false;
+                input += length_size;
+                end = input + value;
+                break;
+            }
+            case pson::varint_field:
+            case pson::svarint_field: {
+                uint8_t value_size = pson_varint_decode(input, end-input, value);
+                if(value_size==0) return false;
+                input += value_size;
+                break;
+            }
+            default:
+                break;
+        }
+        switch(tag >> 3){
+            case pson::null_field:
+            case pson::empty:
+                return visitor.on_null();
+            case pson::true_field:
+                return visitor.on_bool(true);
+            case pson::false_field:
+                return visitor.on_bool(false);
+            case pson::zero_field:
+                return visitor.on_int(0);
+            case pson::one_field:
+                return visitor.on_int(1);
+            case pson::varint_field:
+                return visitor.on_int((int64_t) value);
+            case pson::svarint_field:
+                return visitor.on_int(-(int64_t) value);
+            case pson::float_field: {
+                float number;
+                if((size_t)(end-input)<sizeof(number)) return false;
+                memcpy(&number, input, sizeof(number));
+                return visitor.on_float(number);
+            }
+            case pson::double_field: {
+                double number;
+                if((size_t)(end-input)<sizeof(number)) return false;
+                memcpy(&number, input, sizeof(number));
+                return visitor.on_float(number);
+            }
+            case pson::empty_string:
+                return visitor.on_string("", 0);
+            case pson::empty_bytes:
+                return visitor.on_bytes(input, 0);
+            case pson::string_field:
+                return visitor.on_string((const char*) input, value);
+            case pson::bytes_field:
+                return visitor.on_bytes(input, value);
+            case pson::object_field:
+                if(depth>=PSON_VISIT_MAX_DEPTH || !visitor.begin_object()) return false;
+                while(input<end){
+                    uint64_t name_size;
+                    uint8_t name_size_size = pson_varint_decode(input, end-input, name_size);
+                    if(name_size_size==0 || name_size>(uint64_t)(end-input-name_size_size)) return false;
+                    input += name_size_size;
+                    if(!visitor.on_key((const char*) input, name_size)) return false;
+                    input += name_size;
+                    size_t value_size = pson_value_size(input, end-input);
+                    if(value_size==0 || !pson_visit(input, value_size, visitor, depth+1)) return false;
+                    input += value_size;
+                }
+                return visitor.end_object();
+            case pson::array_field:
+                if(depth>=PSON_VISIT_MAX_DEPTH || !visitor.begin_array()) return false;
+                while(input<end){
+                    size_t value_size = pson_value_size(input, end-input);
+                    if(value_size==0 || !pson_visit(input, value_size, visitor, depth+1)) return false;
+                    input += value_size;
+                }
+                return visitor.end_array();
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * Read-only view of an encoded pson value, whose elements can be read in place, without decoding the value
+     * into a pson tree. The encoded value must outlive the view.
+     */
+    class pson_view{
+    public:
+        pson_view() : data_(NULL), size_(0){
+        }
+
+        pson_view(const uint8_t* data, size_t size) : data_(data), size_(size){
+        }
+
+        const uint8_t* data() const{
+            return data_;
+        }
+
+        size_t size() const{
+            return size_;
+        }
+
+        pson::field_type get_type() const{
+            uint64_t tag;
+            if(pson_varint_decode(data_, size_, tag)==0 || (tag >> 3) > pson::empty) return pson::empty;
+            return (pson::field_type)(tag >> 3);
+        }
+
+        template<class Visitor>
+        bool visit(Visitor& visitor) const{
+            return size_>0 && pson_visit(data_, size_, visitor);
+        }
+
+        /**
+         * Find a nested value from a path of object keys and array indexes separated by '/', i.e., "sensors/0/temp"
+         * @return true if the value exists
+         */
+        bool find(const char* path, pson_view& value) const{
+            const uint8_t* data = data_;
+            size_t size = size_;
+            while(*path!=0){
+                const char* separator = strchr(path, '/');
+                size_t segment = separator!=NULL ? separator - path : strlen(path);
+                if(!find_child(data, size, path, segment)) return false;
+                path += segment;
+                if(*path=='/') path++;
+            }
+            value = pson_view(data, size);
+            return size>0;
+        }
+
+        /**
+         * Find a nested number or boolean, converted to T
+         * @return true if the value exists and is a number or a boolean
+         */
+        template<class T>
+        bool find(const char* path, T& value) const{
+            pson_view item;
+            return find(path, item) && item.get(value);
+        }
+
+        /**
+         * Find a nested string, that is not null terminated
+         */
+        bool find(const char* path, const char*& str, size_t& size) const{
+            pson_view item;
+            return find(path, item) && item.get(str, size);
+        }
+
+        /**
+         * Read a number or boolean value, converted to T
+         */
+        template<class T>
+        bool get(T& value) const{
+            uint64_t tag;
+            uint8_t tag_size = pson_varint_decode(data_, size_, tag);
+            if(tag_size==0) return false;
+            const uint8_t* input = data_ + tag_size;
+            size_t available = size_ - tag_size;
+            switch(tag >> 3){
+                case pson::zero_field:
+                case pson::false_field:
+                    value = 0;
+                    return true;
+                case pson::one_field:
+                case pson::true_field:
+                    value = 1;
+                    return true;
+                case pson::varint_field:
+                case pson::svarint_field: {
+                    uint64_t varint;
+                    if(pson_varint_decode(input, available, varint)==0) return false;
+                    value = (tag >> 3)==pson::svarint_field ? (T) -(int64_t) varint : (T) varint;
+                    return true;
+                }
+                case pson::float_field: {
+                    float number;
+                    if(available<sizeof(number)) return false;
+                    memcpy(&number, input, sizeof(number));
+                    value = (T) number;
+                    return true;
+                }
+                case pson::double_field: {
+                    double number;
+                    if(available<sizeof(number)) return false;
+                    memcpy(&number, input, sizeof(number));
+                    value = (T) number;
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        }
+
+        /**
+         * Read a string value, that is not null terminated
+         */
+        bool get(const char*& str, size_t& size) const{
+            const uint8_t* content;
+            switch(get_type()){
+                case pson::empty_string:
+                    str = "";
+                    size = 0;
+                    return true;
+                case pson::string_field:
+                    if(!read_content(data_, size_, content, size)) return false;
+                    str = (const char*) content;
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+    private:
+        const uint8_t* data_;
+        size_t size_;
+
+        /**
+         * Range of the contents of a length delimited value
+         */
+        static bool read_content(const uint8_t* data, size_t size, const uint8_t*& content, size_t& content_size){
+            uint64_t tag, length;
+            uint8_t tag_size = pson_varint_decode(data, size, tag);
+            if(tag_size==0) return false;
+            uint8_t length_size = pson_varint_decode(data + tag_size, size - tag_size, length);
+            if(length_size==0 || length>size-tag_size-length_size) return false;
+            content = data + tag_size + length_size;
+            content_size = length;
+            return true;
+        }
+
+        /**
+         * Replace the range of an object or array with the range of the child named by the path segment
+         */
+        static bool find_child(const uint8_t*& data, size_t& size, const char* name, size_t name_size){
+            uint64_t tag;
+            if(size==0 || pson_varint_decode(data, size, tag)==0) return false;
+            const uint8_t* input;
+            size_t content_size;
+            bool object = (tag >> 3)==pson::object_field;
+            if((!object && (tag >> 3)!=pson::array_field) || !read_content(data, size, input, content_size)) return false;
+            const uint8_t* end = input + content_size;
+            size_t index = 0;
+            if(!object){
+                if(name_size==0) return false;
+                for(size_t i=0; i<name_size; i++){
+                    if(name[i]<'0' || name[i]>'9') return false;
+                    index = index * 10 + (name[i] - '0');
+                }
+            }
+            while(input<end){
+                bool found = !object && index--==0;
+                if(object){
+                    uint64_t key_size;
+                    uint8_t key_size_size = pson_varint_decode(input, end-input, key_size);
+                    if(key_size_size==0 || key_size>(uint64_t)(end-input-key_size_size)) return false;
+                    input += key_size_size;
+                    found = key_size==name_size && memcmp(input, name, name_size)==0;
+                    input += key_size;
+                }
+                size_t value_size = pson_value_size(input, end-input);
+                if(value_size==0) return false;
+                if(found){
+                    data = input;
+                    size = value_size;
+                    return true;
+                }
+                input += value_size;
+            }
+            return false;
+        }
+    };
+
+}
+
+#endif
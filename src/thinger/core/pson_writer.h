@@ -0,0 +1,321 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS S.L.
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef PSON_WRITER_H
+#define PSON_WRITER_H
+
+#include "pson.h"
+
+#ifndef PSON_WRITER_MAX_DEPTH
+    #define PSON_WRITER_MAX_DEPTH 16
+#endif
+
+namespace protoson {
+
+    /**
+     * Writer that encodes pson values as they are written, without building a pson tree, i.e.:
+     *
+     *   writer.begin_object().field("temp", 21.5).key("tags").begin_array().value("a").end_array().end_object();
+     *
+     * Objects and arrays are length delimited, so their lengths are written when they are closed. Values are encoded
+     * in a buffer that is kept between uses (see reset), so a writer that is reused does not allocate memory.
+     */
+    class pson_writer : public pson_encoder_base<pson_writer>{
+        friend class pson_encoder_base<pson_writer>;
+
+    public:
+        pson_writer() : buffer_(NULL), capacity_(0), depth_(0), error_(false), key_pending_(false), allocator_(current_allocator())
+        {}
+
+        explicit pson_writer(memory_allocator& allocator) :
+            buffer_(NULL), capacity_(0), depth_(0), error_(false), key_pending_(false), allocator_(allocator)
+        {}
+
+        ~pson_writer(){
+            allocator_.deallocate(buffer_);
+        }
+
+        /**
+         * Discard the written values, keeping the buffer memory
+         */
+        void reset(){
+            written_ = 0;
+            depth_ = 0;
+            error_ = false;
+            key_pending_ = false;
+        }
+
+        uint8_t* data(){
+            return buffer_;
+        }
+
+        size_t size() const{
+            return written_;
+        }
+
+        /**
+         * @return true if all the values could be written, and all the objects and arrays were closed
+         */
+        bool is_valid() const{
+            return !error_ && depth_==0 && written_>0;
+        }
+
+        pson_writer& begin_object(){
+            return begin(pson::object_field);
+        }
+
+        pson_writer& end_object(){
+            return end(pson::object_field);
+        }
+
+        pson_writer& begin_array(){
+            return begin(pson::array_field);
+        }
+
+        pson_writer& end_array(){
+            return end(pson::array_field);
+        }
+
+        /**
+         * Write the key of the next object value
+         */
+        pson_writer& key(const char* name){
+            return key(name, strlen(name));
+        }
+
+        pson_writer& key(const char* name, size_t size){
+            if(depth_==0 || types_[depth_-1]!=pson::object_field || key_pending_){
+                error_ = true;
+            }else{
+                pb_encode_key(name, size);
+                key_pending_ = true;
+            }
+            return *this;
+        }
+
+        template<class T>
+        pson_writer& value(T number){
+            if(!allow_value()){
+                return *this;
+            }else if(number==0){
+                pb_encode_tag(varint, pson::zero_field);
+            }else if(number==1){
+                pb_encode_tag(varint, pson::one_field);
+            }else if(number<0){
+                pb_encode_varint(pson::svarint_field, -(uint64_t) number);
+            }else{
+                pb_encode_varint(pson::varint_field, (uint64_t) number);
+            }
+            return *this;
+        }
+
+        pson_writer& value(bool boolean){
+            if(allow_value()) pb_encode_tag(varint, boolean ? pson::true_field : pson::false_field);
+            return *this;
+        }
+
+        /**
+         * Numbers are encoded as a pson value would store them: integral values as integers, and doubles that fit a
+         * float as floats
+         */
+        pson_writer& value(float number){
+            if(number==(int32_t)number){
+                return value((int32_t) number);
+            }
+            if(allow_value()) pb_encode_fixed32(pson::float_field, &number);
+            return *this;
+        }
+
+        pson_writer& value(double number){
+            if(number==(int64_t)number){
+                return value((int64_t) number);
+            }else if(!allow_value()){
+                return *this;
+            }else if(fabs(number-(float)number)<=0.00001){
+                float single = (float) number;
+                pb_encode_fixed32(pson::float_field, &single);
+            }else{
+                pb_encode_fixed64(pson::double_field, &number);
+            }
+            return *this;
+        }
+
+        pson_writer& value(const char* str){
+            return value(str, str!=NULL ? strlen(str) : 0);
+        }
+
+        pson_writer& value(const char* str, size_t size){
+            if(!allow_value()){
+                return *this;
+            }else if(size==0){
+                pb_encode_tag(varint, pson::empty_string);
+            }else{
+                pb_encode_tag(length_delimited, pson::string_field);
+                pb_encode_varint(size);
+                write(str, size);
+            }
+            return *this;
+        }
+
+        pson_writer& bytes(const void* bytes, size_t size){
+            if(!allow_value()){
+                return *this;
+            }else if(size==0){
+                pb_encode_tag(varint, pson::empty_bytes);
+            }else{
+                pb_encode_tag(length_delimited, pson::bytes_field);
+                pb_encode_varint(size);
+                write(bytes, size);
+            }
+            return *this;
+        }
+
+        pson_writer& null(){
+            if(allow_value()) pb_encode_tag(varint, pson::null_field);
+            return *this;
+        }
+
+        /**
+         * Write an existing pson value
+         */
+        pson_writer& value(pson& value){
+            if(allow_value()) encode(value);
+            return *this;
+        }
+
+        /**
+         * Write an object key and its value
+         */
+        template<class T>
+        pson_writer& field(const char* name, T value){
+            return key(name).value(value);
+        }
+
+        pson_writer& field(const char* name, pson& value){
+            return key(name).value(value);
+        }
+
+        bool reserve_length(size_t& mark, size_t expected_size){
+            // the reserved prefix is a varint placeholder, so its size can be found backwards from the mark
+            uint8_t placeholder[10];
+            uint8_t reserved = pson_varint_size(expected_size);
+            memset(placeholder, 0x80, reserved-1);
+            placeholder[reserved-1] = 0;
+            write(placeholder, reserved);
+            mark = written_;
+            return true;
+        }
+
+        bool commit_length(size_t mark, size_t& length){
+            if(error_) return false;
+            size_t reserved = 1;
+            while(reserved < mark && (buffer_[mark-reserved-1] & 0x80) && reserved < 10) reserved++;
+            length = written_ - mark;
+            uint8_t length_size = pson_varint_size(length);
+            // move the contents if the reserved prefix has not the right size (keeping the encoding canonical)
+            if(length_size!=reserved){
+                if(!ensure(written_ + length_size - reserved)) return false;
+                memmove(buffer_ + mark + length_size - reserved, buffer_ + mark, length);
+                written_ = written_ + length_size - reserved;
+            }
+            uint8_t prefix[10];
+            pson_varint_encode(prefix, length);
+            memcpy(buffer_ + mark - reserved, prefix, length_size);
+            return true;
+        }
+
+    protected:
+        bool write(const void* buffer, size_t size){
+            if(!ensure(written_ + size)) return false;
+            memcpy(buffer_ + written_, buffer, size);
+            written_ += size;
+            return true;
+        }
+
+    private:
+        pson_writer(const pson_writer&);
+        pson_writer& operator=(const pson_writer&);
+
+        uint8_t* buffer_;
+        size_t capacity_;
+        size_t marks_[PSON_WRITER_MAX_DEPTH];
+        uint8_t types_[PSON_WRITER_MAX_DEPTH];
+        uint8_t depth_;
+        bool error_;
+        bool key_pending_;
+        memory_allocator& allocator_;
+
+        bool ensure(size_t size){
+            if(size<=capacity_) return !error_;
+            size_t capacity = capacity_>0 ? capacity_ : 64;
+            while(capacity<size) capacity *= 2;
+            uint8_t* buffer = (uint8_t*) allocator_.allocate(capacity);
+            if(buffer==NULL){
+                error_ = true;
+                return false;
+            }
+            if(written_>0) memcpy(buffer, buffer_, written_);
+            allocator_.deallocate(buffer_);
+            buffer_ = buffer;
+            capacity_ = capacity;
+            return !error_;
+        }
+
+        /**
+         * Object values must follow a key, and a single value can be written outside objects and arrays
+         */
+        bool allow_value(){
+            if(depth_>0 ? types_[depth_-1]==pson::object_field && !key_pending_ : written_>0){
+                error_ = true;
+            }
+            key_pending_ = false;
+            return !error_;
+        }
+
+        pson_writer& begin(pson::field_type type){
+            if(depth_>=PSON_WRITER_MAX_DEPTH){
+                error_ = true;
+                return *this;
+            }else if(!allow_value()){
+                return *this;
+            }
+            pb_encode_tag(length_delimited, type);
+            reserve_length(marks_[depth_], 0);
+            types_[depth_++] = type;
+            return *this;
+        }
+
+        pson_writer& end(pson::field_type type){
+            if(depth_==0 || types_[depth_-1]!=type || key_pending_){
+                error_ = true;
+                return *this;
+            }
+            size_t length;
+            commit_length(marks_[--depth_], length);
+            return *this;
+        }
+    };
+
+}
+
+#endif
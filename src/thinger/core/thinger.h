@@ -32,6 +32,9 @@
 #include "thinger_decoder.hpp"
 #include "thinger_message.hpp"
 #include "thinger_io.hpp"
+#include "thinger_requests.hpp"
+#include "thinger_streams.hpp"
+#include "thinger_resource_index.hpp"
 
 #define KEEP_ALIVE_MILLIS 60000
 
@@ -51,11 +54,16 @@ namespace thinger{
 
     class thinger : public thinger_io{
     public:
-        thinger() :
-                encoder(*this),
-                decoder(*this),
+        thinger(protoson::memory_allocator& allocator = protoson::default_allocator()) :
+                frame_reader(*this),
                 last_keep_alive(0),
-                keep_alive_response(true)
+                keep_alive_response(true),
+                coalesce_writes_(false),
+                streams_(allocator),
+                index_(allocator),
+                request_timeout_(THINGER_REQUEST_TIMEOUT_MILLIS),
+                allocator_(allocator),
+                writer_(allocator)
         {
 #ifdef THINGER_FREE_RTOS_MULTITASK
             semaphore_ = xSemaphoreCreateMutex();
@@ -67,11 +75,23 @@ namespace thinger{
         }
 
     private:
-        thinger_write_encoder encoder;
-        thinger_read_decoder decoder;
+        thinger_buffer_encoder encoder;
+        thinger_frame_reader frame_reader;
         unsigned long last_keep_alive;
         bool keep_alive_response;
+        bool coalesce_writes_;
         thinger_map<thinger_resource> resources_;
+        // requests waiting for a server response, completed or expired in handle
+        thinger_requests requests_;
+        // resources streamed periodically, ordered by their next sample
+        thinger_streams streams_;
+        // full path index of the resources, to find the requested ones
+        thinger_resource_index index_;
+        unsigned long request_timeout_;
+        // allocator used by all the messages and pson structures built by this instance
+        protoson::memory_allocator& allocator_;
+        // writer returned by get_writer, whose buffer is kept between messages
+        protoson::pson_writer writer_;
 
 #if defined(THINGER_FREE_RTOS_MULTITASK)
         SemaphoreHandle_t semaphore_;
@@ -87,6 +107,10 @@ namespace thinger{
          * Can be override to start reconnection process
          */
         virtual void disconnected(){
+            // discard any partially received frame
+            frame_reader.reset();
+            // responses will not arrive, so pending requests fail in the next handle call
+            requests_.expire();
             // stop all streaming resources after disconnect
             if(thinger_resource::get_streaming_counter()>0) {
                 thinger_map<thinger_resource>::entry* current = resources_.begin();
@@ -95,9 +119,12 @@ namespace thinger{
                     current = current->next_;
                 }
             }
+            // including the periodic streams of sub resources
+            streams_.clear();
         }
 
         bool connect(const char* username, const char* device_id, const char* credential){
+            protoson::memory_scope scope(allocator_);
             // reset keep alive status for each connection
             keep_alive_response = true;
             thinger_message message;
@@ -105,9 +132,9 @@ namespace thinger{
             message.resources().add(username).add(device_id).add(credential);
 
             /** temporal fix for old production server **/
-            if(!send_message(message)) return false;
+            if(!send_message(message) || !flush()) return false;
             thinger_message response;
-            return read_message(response) && response.get_signal_flag() == thinger_message::REQUEST_OK;
+            return read_message(response, true, true) && response.get_signal_flag() == thinger_message::REQUEST_OK;
 
             /*
              *
@@ -144,6 +171,14 @@ namespace thinger{
             return resources_[res];
         }
 
+        /**
+         * Allocator used by the messages and pson structures built by this instance. Resource callbacks are called
+         * with this allocator active, so any pson they modify must be destroyed with this allocator.
+         */
+        protoson::memory_allocator& get_allocator(){
+            return allocator_;
+        }
+
         /**
          * Read a property stored in the server
          * @param property_identifier property identifier
@@ -151,10 +186,13 @@ namespace thinger{
          * @return true if the property read was ok
          */
         bool get_property(const char* property_identifier, protoson::pson& data){
+            // the property is handed over to the caller, so it is decoded with the caller allocator
+            protoson::memory_allocator& data_allocator = protoson::current_allocator();
+            protoson::memory_scope scope(allocator_);
             thinger_message request;
             request.set_signal_flag(thinger_message::GET_PROPERTY);
             request.set_identifier(property_identifier);
-            return send_message(request, data);
+            return send_message(request, data, data_allocator);
         }
 
         /**
@@ -165,6 +203,7 @@ namespace thinger{
          * @return
          */
         bool set_property(const char* property_identifier, pson& data, bool confirm_write=false){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_signal_flag(thinger_message::SET_PROPERTY);
             message.set_identifier(property_identifier);
@@ -179,6 +218,7 @@ namespace thinger{
          * @return
          */
         bool call_device(const char* device_name, const char* resource_name, bool confirm_call=false){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_signal_flag(thinger_message::CALL_DEVICE);
             message.set_identifier(device_name);
@@ -194,6 +234,7 @@ namespace thinger{
         * @return
         */
         bool call_device(const char* device_name, const char* resource_name, pson& data, bool confirm_call=false){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_signal_flag(thinger_message::CALL_DEVICE);
             message.set_identifier(device_name);
@@ -210,11 +251,12 @@ namespace thinger{
         * @return
         */
         bool call_device(const char* device_name, const char* resource_name, thinger_resource& resource, bool confirm_call=false){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_signal_flag(thinger_message::CALL_DEVICE);
             message.set_identifier(device_name);
             message.resources().add(resource_name);
-            resource.fill_output(message.get_data());
+            resource.fill_output(message);
             return send_message_with_ack(message, confirm_call);
         }
 
@@ -224,6 +266,7 @@ namespace thinger{
          * @return
          */
         bool call_endpoint(const char* endpoint_name, bool confirm_call=false){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_signal_flag(thinger_message::CALL_ENDPOINT);
             message.set_identifier(endpoint_name);
@@ -237,6 +280,7 @@ namespace thinger{
          * @return
          */
         bool call_endpoint(const char* endpoint_name, pson& data, bool confirm_call=false){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_signal_flag(thinger_message::CALL_ENDPOINT);
             message.set_identifier(endpoint_name);
@@ -244,6 +288,22 @@ namespace thinger{
             return send_message_with_ack(message, confirm_call);
         }
 
+        /**
+         * Call a server endpoint
+         * @param endpoint_name endpoint identifier, as defined in the server
+         * @param writer writer holding the data for the endpoint call, i.e., the one returned by get_writer
+         * @return false if the writer does not hold a complete value, or the call failed
+         */
+        bool call_endpoint(const char* endpoint_name, protoson::pson_writer& writer, bool confirm_call=false){
+            if(!writer.is_valid()) return false;
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::CALL_ENDPOINT);
+            message.set_identifier(endpoint_name);
+            message.set_data(writer);
+            return send_message_with_ack(message, confirm_call);
+        }
+
         /**
          * Call a server endpoint
          * @param endpoint_name endpoint identifier, as defined in the server
@@ -251,10 +311,11 @@ namespace thinger{
          * @return
          */
         bool call_endpoint(const char* endpoint_name, thinger_resource& resource, bool confirm_call=false){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_signal_flag(thinger_message::CALL_ENDPOINT);
             message.set_identifier(endpoint_name);
-            resource.fill_output(message.get_data());
+            resource.fill_output(message);
             return send_message_with_ack(message, confirm_call);
         }
 
@@ -275,6 +336,7 @@ namespace thinger{
          * @return
          */
         bool write_bucket(const char* bucket_id, pson& data, bool confirm_write=false){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_signal_flag(thinger_message::BUCKET_DATA);
             message.set_identifier(bucket_id);
@@ -282,6 +344,22 @@ namespace thinger{
             return send_message_with_ack(message, confirm_write);
         }
 
+        /**
+         * Write the data encoded by a writer to a given bucket identifier
+         * @param bucket_id bucket identifier
+         * @param writer writer holding the data to write, i.e., the one returned by get_writer
+         * @return false if the writer does not hold a complete value, or the write failed
+         */
+        bool write_bucket(const char* bucket_id, protoson::pson_writer& writer, bool confirm_write=false){
+            if(!writer.is_valid()) return false;
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::BUCKET_DATA);
+            message.set_identifier(bucket_id);
+            message.set_data(writer);
+            return send_message_with_ack(message, confirm_write);
+        }
+
         /**
          * Write a resource to a given bucket identifier
          * @param bucket_id bucket identifier
@@ -289,10 +367,11 @@ namespace thinger{
          * @return
          */
         bool write_bucket(const char* bucket_id, thinger_resource& resource, bool confirm_write=false){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_signal_flag(thinger_message::BUCKET_DATA);
             message.set_identifier(bucket_id);
-            resource.fill_output(message.get_data());
+            resource.fill_output(message);
             return send_message_with_ack(message, confirm_write);
         }
 
@@ -306,17 +385,160 @@ namespace thinger{
             return write_bucket(bucket_id, resources_[resource_name], confirm_write);
         }
 
+        /**
+         * Write data to a given bucket identifier without waiting for the server response
+         * @param bucket_id bucket identifier
+         * @param data data to write defined in a pson structure
+         * @param callback called from handle with the write result (can be NULL)
+         * @return true if the write was sent (see send_message_async)
+         */
+        bool write_bucket_async(const char* bucket_id, pson& data, request_callback callback=NULL){
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::BUCKET_DATA);
+            message.set_identifier(bucket_id);
+            message.set_data(data);
+            return send_message_async(message, callback);
+        }
+
+        /**
+         * Write the data encoded by a writer to a given bucket identifier without waiting for the server response
+         * @param bucket_id bucket identifier
+         * @param writer writer holding the data to write, i.e., the one returned by get_writer
+         * @param callback called from handle with the write result (can be NULL)
+         * @return true if the write was sent (see send_message_async)
+         */
+        bool write_bucket_async(const char* bucket_id, protoson::pson_writer& writer, request_callback callback=NULL){
+            if(!writer.is_valid()) return false;
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::BUCKET_DATA);
+            message.set_identifier(bucket_id);
+            message.set_data(writer);
+            return send_message_async(message, callback);
+        }
+
+        /**
+         * Set a property in the server without waiting for the server response
+         * @param property_identifier property identifier
+         * @param data pson structure with the data to be stored in the server
+         * @param callback called from handle with the write result (can be NULL)
+         * @return true if the request was sent (see send_message_async)
+         */
+        bool set_property_async(const char* property_identifier, pson& data, request_callback callback=NULL){
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::SET_PROPERTY);
+            message.set_identifier(property_identifier);
+            message.set_data(data);
+            return send_message_async(message, callback);
+        }
+
+        /**
+         * Read a property stored in the server without waiting for the server response
+         * @param property_identifier property identifier
+         * @param callback called from handle with the read result and the property data
+         * @return true if the request was sent (see send_message_async)
+         */
+        bool get_property_async(const char* property_identifier, request_callback callback){
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::GET_PROPERTY);
+            message.set_identifier(property_identifier);
+            return send_message_async(message, callback);
+        }
+
+        /**
+         * Call a server endpoint (without any data) without waiting for the server response
+         * @param endpoint_name endpoint identifier, as defined in the server
+         * @param callback called from handle with the call result (can be NULL)
+         * @return true if the call was sent (see send_message_async)
+         */
+        bool call_endpoint_async(const char* endpoint_name, request_callback callback=NULL){
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::CALL_ENDPOINT);
+            message.set_identifier(endpoint_name);
+            return send_message_async(message, callback);
+        }
+
+        /**
+         * Call a server endpoint without waiting for the server response
+         * @param endpoint_name endpoint identifier, as defined in the server
+         * @param data data in pson format to be used as data source for the endpoint call
+         * @param callback called from handle with the call result (can be NULL)
+         * @return true if the call was sent (see send_message_async)
+         */
+        bool call_endpoint_async(const char* endpoint_name, pson& data, request_callback callback=NULL){
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::CALL_ENDPOINT);
+            message.set_identifier(endpoint_name);
+            message.set_data(data);
+            return send_message_async(message, callback);
+        }
+
+        /**
+         * Execute a resource in a remote device (without data) without waiting for the server response
+         * @param device_name remote device identifier (must be connected to your account)
+         * @param resource_name remote resource identifier (must be defined in the remote device)
+         * @param callback called from handle with the call result (can be NULL)
+         * @return true if the call was sent (see send_message_async)
+         */
+        bool call_device_async(const char* device_name, const char* resource_name, request_callback callback=NULL){
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::CALL_DEVICE);
+            message.set_identifier(device_name);
+            message.resources().add(resource_name);
+            return send_message_async(message, callback);
+        }
+
+        /**
+         * Execute a resource in a remote device without waiting for the server response
+         * @param device_name remote device identifier (must be connected to your account)
+         * @param resource_name remote resource identifier (must be defined in the remote device)
+         * @param data pson structure to be sent to the remote resource input
+         * @param callback called from handle with the call result (can be NULL)
+         * @return true if the call was sent (see send_message_async)
+         */
+        bool call_device_async(const char* device_name, const char* resource_name, pson& data, request_callback callback=NULL){
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_signal_flag(thinger_message::CALL_DEVICE);
+            message.set_identifier(device_name);
+            message.resources().add(resource_name);
+            message.set_data(data);
+            return send_message_async(message, callback);
+        }
+
+        /**
+         * Set the time the asynchronous requests wait for their response before failing
+         * @param timeout timeout in the time base of handle, i.e., milliseconds
+         */
+        void set_request_timeout(unsigned long timeout){
+            request_timeout_ = timeout;
+        }
+
+        /**
+         * @return number of asynchronous requests waiting for a response
+         */
+        size_t pending_requests(){
+            return requests_.size();
+        }
+
         /**
          * Stream the given resource
          * @param resource resource defined in the code, i.e, thing["location"]
          * @param type STREAM_EVENT or STREAM_SAMPLE, depending if the stream was an event or a scheduled sampling
          */
         void stream_resource(thinger_resource& resource, thinger_message::signal_flag type){
+            protoson::memory_scope scope(allocator_);
             thinger_message message;
             message.set_stream_id(resource.get_stream_id());
             message.set_signal_flag(type);
             // TODO modify and update servers to support resource.fill_output(message.get_data());
-            th_synchronized(resource.fill_api_io(message.get_data());)
+            th_synchronized(resource.fill_api_io(message);)
             send_message(message);
         }
 
@@ -342,6 +564,83 @@ namespace thinger{
             return stream(resources_[resource]);
         }
 
+        /**
+         * Stream the data encoded by a writer as the given resource, instead of the resource value.
+         * @param resource resource defined in the code, i.e, thing["location"]
+         * @param writer writer holding the resource value, i.e., the one returned by get_writer
+         * @return true if there was some external process listening for this resource and the data was transmitted
+         */
+        bool stream(thinger_resource& resource, protoson::pson_writer& writer){
+            if(!resource.stream_enabled() || !writer.is_valid()) return false;
+            protoson::memory_scope scope(allocator_);
+            thinger_message message;
+            message.set_stream_id(resource.get_stream_id());
+            message.set_signal_flag(thinger_message::STREAM_EVENT);
+            message.set_data(writer, resource.get_io_type() == thinger_resource::pson_in ? "in" : "out");
+            send_message(message);
+            return true;
+        }
+
+        /**
+         * Stream the data encoded by a writer as the given resource, instead of the resource value.
+         * @param resource resource identifier defined in the code, i.e, "location"
+         * @param writer writer holding the resource value, i.e., the one returned by get_writer
+         * @return true if there was some external process listening for this resource and the data was transmitted
+         */
+        bool stream(const char* resource, protoson::pson_writer& writer){
+            return stream(resources_[resource], writer);
+        }
+
+        /**
+         * Time of the next periodic work of handle (a stream sample, a request timeout, or a keep alive), so the
+         * event loop can wait for input until then instead of polling
+         * @return deadline in the time base of handle, i.e., milliseconds
+         */
+        unsigned long next_deadline(){
+            unsigned long deadline = last_keep_alive + KEEP_ALIVE_MILLIS + 1;
+            unsigned long sample, timeout;
+            th_synchronized(
+                bool streaming = streams_.next_deadline(sample);
+                bool waiting = requests_.next_deadline(timeout);
+            )
+            if(streaming && (long)(sample - deadline) < 0) deadline = sample;
+            if(waiting && (long)(timeout - deadline) < 0) deadline = timeout;
+            return deadline;
+        }
+
+        /**
+         * Writer for encoding the data of write_bucket, call_endpoint, or stream without building a pson tree. It is
+         * reset on each call, and keeps its memory between messages.
+         */
+        protoson::pson_writer& get_writer(){
+            writer_.reset();
+            return writer_;
+        }
+
+        /**
+         * Enable or disable write coalescing. When enabled, the messages that do not wait for a server response
+         * (streams, responses to requests, keep alives, or writes without confirmation) are kept in the output buffer
+         * and flushed together once per handle call, after processing the buffered input, so a burst of messages
+         * is sent with a single write. The io implementation may flush them earlier.
+         */
+        void set_write_coalescing(bool coalesce){
+            coalesce_writes_ = coalesce;
+            if(!coalesce) flush();
+        }
+
+        bool is_write_coalescing() const{
+            return coalesce_writes_;
+        }
+
+        /**
+         * Write any buffered output to the connection
+         * @return true if there was no output pending or it was written
+         */
+        bool flush(){
+            th_synchronized(bool result = write(NULL, 0, true);)
+            return result;
+        }
+
         /**
          * This method should be called periodically, indicating the current timestamp, and if there are bytes
          * available in the connection
@@ -350,11 +649,17 @@ namespace thinger{
          */
         void handle(unsigned long current_time, bool bytes_available)
         {
+            protoson::memory_scope scope(allocator_);
+
             // handle input
+            request_callback callback;
             if(bytes_available){
                 thinger_message message;
-                th_synchronized(bool result = read_message(message)==MESSAGE;)
-                if(result) handle_request_received(message);
+                th_synchronized(
+                    bool result = read_message(message)==MESSAGE;
+                    bool response = result && remove_request(message, callback);
+                )
+                if(result) handle_message_received(message, response, callback);
             }
 
             // handle keep alive (send keep alive to server to prevent disconnection)
@@ -368,79 +673,103 @@ namespace thinger{
                 }
             }
 
-            // handle streaming resources
-            if(thinger_resource::get_streaming_counter()>0){
-                handle_streaming(resources_, current_time);
+            // fail the requests without a response in time
+            while(requests_.size()>0){
+                th_synchronized(bool expired = requests_.remove_expired(current_time, callback);)
+                if(!expired) break;
+                complete_request(callback, false);
             }
-        }
 
-    private:
+            // sample the streams that are due
+            while(true){
+                th_synchronized(thinger_resource* resource = streams_.next_due(current_time);)
+                if(resource==NULL) break;
+                stream_resource(*resource, thinger_message::STREAM_SAMPLE);
+            }
 
-        /**
-         * Iterates over all resources and subresources to determine when a streaming is required.
-         * @param resources
-         * @param current_time
-         */
-        void handle_streaming(thinger_map<thinger_resource>& resources, unsigned long current_time){
-            thinger_map<thinger_resource>::entry* current = resources.begin();
-            while(current!=NULL){
-                thinger_resource& resource = current->value_;
-                if(resource.stream_required(current_time)){
-                    stream_resource(resource, thinger_message::STREAM_SAMPLE);
-                }
-                thinger_map<thinger_resource>& sub_resources = resource.get_resources();
-                if(!sub_resources.empty()){
-                    handle_streaming(sub_resources, current_time);
-                }
-                current = current->next_;
+            // flush the coalesced output once there is no more input to answer
+            if(coalesce_writes_ && !input_pending()){
+                flush();
             }
         }
 
+    private:
+
         /**
-         * Decode a message from the current connection. It should be called when there are bytes available for reading.
+         * Decode a message from the current connection, continuing the frame partially read in previous calls, if
+         * any. It should be called when there are bytes available for reading.
          * @param message reference to the message that will be filled with the decoded information
-         * @return true or false if the message passed in reference was filled with a valid message.
+         * @param reserve_memory decode the message over a memory arena sized from the frame length, holding the frame
+         * itself, so strings and bytes reference it. Must be false if the message contents will outlive the message.
+         * @param wait block until a whole frame is read, instead of returning NONE while it is incomplete
+         * @return the type of the message read, or NONE if there was no complete or valid message.
          */
-        message_type read_message(thinger_message& message){
-            uint32_t type = 0;
-            if(decoder.pb_decode_varint32(type)){
-                switch(type){
+        message_type read_message(thinger_message& message, bool reserve_memory=true, bool wait=false){
+            thinger_frame_reader::status status = frame_reader.read_header(wait);
+            uint8_t* frame = NULL;
+            if(status==thinger_frame_reader::FRAME_COMPLETE){
+                // read the message in its own memory, so strings and bytes are not copied again
+                if(frame_reader.type()==MESSAGE && reserve_memory && !frame_reader.body_started()){
+                    frame = message.reserve_frame(frame_reader.size());
+                }
+                status = frame_reader.read_body(frame, wait);
+            }
+            if(status==thinger_frame_reader::FRAME_INCOMPLETE) return NONE;
+            message_type type = NONE;
+            if(status==thinger_frame_reader::FRAME_COMPLETE){
+                switch(frame_reader.type()){
                     case MESSAGE: {
-                        // decode message size & message itself
-                        uint32_t size = 0;
-                        return decoder.pb_decode_varint32(size) && decoder.decode(message, size) ? MESSAGE : NONE;
+                        uint32_t size = frame_reader.size();
+                        // a body received in several calls is copied to the message memory once complete
+                        if(frame==NULL && reserve_memory){
+                            frame = message.reserve_frame(size);
+                            if(frame!=NULL && size>0) memcpy(frame, frame_reader.body(), size);
+                        }
+                        if(frame!=NULL){
+                            thinger_buffer_decoder frame_decoder(frame, size);
+                            type = frame_decoder.decode(message, size) ? MESSAGE : NONE;
+                        }else{
+                            thinger_memory_decoder frame_decoder(frame_reader.body(), size);
+                            type = frame_decoder.decode(message, size) ? MESSAGE : NONE;
+                        }
+                        break;
                     }
-                    case KEEP_ALIVE: {
+                    case KEEP_ALIVE:
                         // update our keep_alive flag (connection active)
                         keep_alive_response = true;
-                        // skip size bytes in keep alive (always 0)
-                        return decoder.pb_skip_varint() ? KEEP_ALIVE : NONE;
-                    }
+                        type = KEEP_ALIVE;
+                        break;
                 }
             }
-            return NONE;
+            frame_reader.reset();
+            return type;
         }
 
         /**
          * Wait for a server response, and optionally store the response payload on the provided PSON structure
          * @param request source message that will be used forf
          * @param payload
+         * @param payload_allocator allocator the payload must be decoded with (defaults to the current allocator)
          * @return true if the response was received and succeed (REQUEST_OK in signal flag)
          */
-        bool wait_response(thinger_message& request, protoson::pson* payload = NULL){
+        bool wait_response(thinger_message& request, protoson::pson* payload = NULL, protoson::memory_allocator* payload_allocator = NULL){
             do{
                 // try to read an incoming message
-                thinger_message response;
-                message_type type = read_message(response);
+                thinger_message response(payload_allocator!=NULL ? *payload_allocator : protoson::current_allocator());
+                // the response payload is handed over to the caller, so it cannot live in the message arena
+                message_type type = read_message(response, payload==NULL, true);
                 switch(type){
                     // message received
                     case MESSAGE:
-                        if(request.get_stream_id() == response.get_stream_id()){
+                        if(request.get_stream_id() == response.get_stream_id() && !response.has_resource()){
                             // copy response payload to provided structure
                             if(payload != NULL && response.has_data()) pson::swap(response.get_data(), *payload);
                             return response.get_signal_flag()==thinger_message::REQUEST_OK;
                         }
-                        handle_request_received(response);
+                        {
+                            request_callback callback;
+                            handle_message_received(response, remove_request(response, callback), callback);
+                        }
                         break;
                         // keep alive is handled inside read_message automatically
                     case KEEP_ALIVE:
@@ -455,15 +784,26 @@ namespace thinger{
         /**
          * Write a message to the socket
          * @param message
+         * @param flush write it right away, with any previously buffered output
          * @return true if success
          */
-        bool write_message(thinger_message& message){
-            thinger_encoder sink;
-            sink.encode(message);
-            encoder.pb_encode_varint(MESSAGE);
-            encoder.pb_encode_varint(sink.bytes_written());
-            encoder.encode(message);
-            return write(NULL, 0, true);
+        bool write_message(thinger_message& message, bool flush=true){
+            encoder.encode_frame(message);
+            return write_encoded(flush);
+        }
+
+        /**
+         * Write the data encoded in the output buffer, along with the large values it references
+         * @param flush write it right away, with any previously buffered output
+         * @return true if the data was written
+         */
+        bool write_encoded(bool flush=true){
+            size_t count = 0;
+            const thinger_io_span* spans = encoder.is_valid() ? encoder.get_spans(count) : NULL;
+            // buffering would copy the borrowed values (that come as extra spans), so such messages are not buffered
+            bool result = spans!=NULL && writev(spans, count, flush || count>1);
+            encoder.reset();
+            return result;
         }
 
         /**
@@ -472,7 +812,7 @@ namespace thinger{
          * @return true if the message was written to the socket
          */
         bool send_message(thinger_message& message){
-            th_synchronized(bool result = write_message(message);)
+            th_synchronized(bool result = write_message(message, !coalesce_writes_);)
             return result;
         }
 
@@ -483,8 +823,29 @@ namespace thinger{
          * @return true if the message was acknowledged by the server.
          */
         bool send_message_with_ack(thinger_message& message, bool wait_ack=true){
-            if(wait_ack) message.set_random_stream_id();
-            th_synchronized(bool result = write_message(message) && (!wait_ack || wait_response(message));)
+            th_synchronized(
+                if(wait_ack) message.set_stream_id(requests_.next_stream_id());
+                bool result = write_message(message, wait_ack || !coalesce_writes_) && (!wait_ack || wait_response(message));
+            )
+            return result;
+        }
+
+        /**
+         * Send a message without waiting for the server response, that completes the callback in a later handle call
+         * @param message message to be sent
+         * @param callback called with the response, or when the request fails or times out (can be NULL)
+         * @return true if the message was written, or false if it could not be written, or there are too many
+         * pending requests (then the callback is not called)
+         */
+        bool send_message_async(thinger_message& message, request_callback callback){
+            th_synchronized(
+                bool result = !requests_.full();
+                if(result){
+                    message.set_stream_id(requests_.next_stream_id());
+                    result = write_message(message, !coalesce_writes_) &&
+                             requests_.add(message.get_stream_id(), request_timeout_, callback);
+                }
+            )
             return result;
         }
 
@@ -492,13 +853,56 @@ namespace thinger{
          * Send a message and wait for server ack and response payload
          * @param message message to be sent
          * @param data protoson::pson structure to be filled with the response payload
+         * @param data_allocator allocator used to decode the response payload
          * @return true if the message was acknowledged by the server.
          */
-        bool send_message(thinger_message& message, protoson::pson& data){
-            th_synchronized(bool result = write_message(message) && wait_response(message, &data););
+        bool send_message(thinger_message& message, protoson::pson& data, protoson::memory_allocator& data_allocator){
+            th_synchronized(
+                message.set_stream_id(requests_.next_stream_id());
+                bool result = write_message(message) && wait_response(message, &data, &data_allocator);
+            )
             return result;
         }
 
+        /**
+         * Call the callback of a request that was removed from the pending requests
+         */
+        void complete_request(request_callback& callback, bool success, protoson::pson* data=NULL){
+            if(!callback) return;
+            if(data!=NULL){
+                callback(success, *data);
+            }else{
+                protoson::pson empty;
+                callback(success, empty);
+            }
+        }
+
+        /**
+         * Remove the pending request a received message responds to, if any
+         * @param callback set to the callback of the request
+         * @return true if the message is the response to a pending request
+         */
+        bool remove_request(thinger_message& message, request_callback& callback){
+            // requests always address a resource, so messages without resources are responses
+            return !message.has_resource() && requests_.remove(message.get_stream_id(), callback);
+        }
+
+        /**
+         * Handle a message received from the server, that can be the response to a pending request, or a request
+         * @param message the message sent by the server
+         * @param response true if the message responds to the request of the given callback
+         */
+        void handle_message_received(thinger_message& message, bool response, request_callback& callback){
+            // the callbacks allocate as usual, but may replace values decoded in the message memory, that is not freed
+            protoson::arena_guard_allocator guard(message.get_allocator(), protoson::current_allocator());
+            protoson::memory_scope scope(guard);
+            if(response){
+                complete_request(callback, message.get_signal_flag()==thinger_message::REQUEST_OK, &message.get_data());
+            }else{
+                handle_request_received(message);
+            }
+        }
+
         /**
          * Send a keep alive to the server
          * @return true if the keep alive was written to the socket
@@ -508,11 +912,25 @@ namespace thinger{
             th_synchronized(
                 encoder.pb_encode_varint(KEEP_ALIVE);
                 encoder.pb_encode_varint(0);
-                result = write(NULL, 0, true);
+                result = write_encoded(!coalesce_writes_);
             )
             return result;
         }
 
+        /**
+         * Find a resource by its path, with a single lookup in the resource index, or searching each level by name
+         * if there is no memory for the index
+         * @return the resource, or NULL if it does not exist
+         */
+        thinger_resource* find_resource(const char* const* path, size_t depth){
+            if(index_.update(resources_)) return index_.find(path, depth);
+            thinger_resource* resource = resources_.find(path[0]);
+            for(size_t i=1; i<depth && resource!=NULL; i++){
+                resource = resource->find(path[i]);
+            }
+            return resource;
+        }
+
         /**
          * Handle an incoming request from the server
          * @param request the message sent by the server
@@ -532,68 +950,59 @@ namespace thinger{
              * concatenated, i.e., temperature/degrees; tire1/pressure.
              */
             else{
-                // pointer to the requested resource (not initialized by default)
-                thinger_resource * thing_resource = NULL;
-
+                const char* path[THINGER_RESOURCE_MAX_DEPTH];
+                size_t depth = 0;
+                bool valid = true;
                 for(pson_array::iterator it = request.resources().begin(); it.valid(); it.next()){
-
-                    // if the resource name is not a string.. stop!
-                    if(!it.item().is_string()){
-                        response.set_signal_flag(thinger_message::REQUEST_ERROR);
+                    // if the resource name is not a string, or the path is too deep.. stop!
+                    if(!it.item().is_string() || depth==THINGER_RESOURCE_MAX_DEPTH){
+                        valid = false;
                         break;
                     }
+                    path[depth++] = it.item();
+                }
 
-                    // get current resource, and check if there are more remaining resources
-                    const char* resource = it.item();
+                // check if the last resource name is the special word "api" to fill the resource state
+                bool api = depth>0 && strcmp("api", path[depth-1])==0;
+                size_t resource_depth = api ? depth-1 : depth;
 
-                    // there are more sub resources in the array
-                    if(it.has_next()){
+                // pointer to the requested resource (the device root if NULL)
+                thinger_resource * thing_resource = valid && resource_depth>0 ? find_resource(path, resource_depth) : NULL;
 
-                        // search the requested resource in the root, or just in the current resource (kept in thing_resource)
-                        thing_resource = thing_resource == NULL ? resources_.find(resource) : thing_resource->find(resource);
+                // the requested resource is not available in the device.. stop!
+                if(!valid || (resource_depth>0 && thing_resource==NULL)){
+                    response.set_signal_flag(thinger_message::REQUEST_ERROR);
+                }
 
-                        // the requested resource is not available in the device or the resource... stop!
-                        if(thing_resource==NULL) {
-                            response.set_signal_flag(thinger_message::REQUEST_ERROR);
-                            break;
+                else if(api){
+                    // just fill the api over the device root
+                    if(thing_resource==NULL){
+                        thinger_map<thinger_resource>::entry* current = resources_.begin();
+                        while(current!=NULL){
+                            current->value_.fill_api(response.get_data()[current->key_]);
+                            current = current->next_;
                         }
-
-                    // the current item is the latest resource name
+                    // fll the api over the specified resource
                     }else{
+                        th_synchronized(thing_resource->fill_api_io(response);)
+                    }
+                }
 
-                        // check if resource name is the special word "api" to fill the current resource state
-                        if(strcmp("api", resource)==0){
-                            // just fill the api over the device root
-                            if(thing_resource==NULL){
-                                thinger_map<thinger_resource>::entry* current = resources_.begin();
-                                while(current!=NULL){
-                                    current->value_.fill_api(response.get_data()[current->key_]);
-                                    current = current->next_;
-                                }
-                            // fll the api over the specified resource
-                            }else{
-                                th_synchronized(thing_resource->fill_api_io(response.get_data());)
-                            }
-
-                        // just want to interact with the resource itself...
-                        }else{
-                            thing_resource = thing_resource == NULL ? resources_.find(resource) : thing_resource->find(resource);
-                            // the resource is not available.. stop!
-                            if(thing_resource==NULL){
-                                response.set_signal_flag(thinger_message::REQUEST_ERROR);
-
-                            // the resource is available, so, handle its i/o.
-                            }else{
-                                th_synchronized(thing_resource->handle_request(request, response);)
-                                // stream enabled over a resource input -> notify the current state
-                                if(thing_resource->stream_enabled() && (thing_resource->get_io_type()==thinger_resource::pson_in || thing_resource->get_io_type()==thinger_resource::pson_in_pson_out)){
-                                    // send normal response
-                                    send_message(response);
-                                    // stream the event to notify the change
-                                    return stream_resource(*thing_resource, thinger_message::STREAM_EVENT);
-                                }
-                            }
+                // just want to interact with the resource itself, so, handle its i/o.
+                else if(thing_resource!=NULL){
+                    th_synchronized(
+                        thing_resource->handle_request(request, response);
+                        // schedule the samples of a periodic stream
+                        if(request.get_signal_flag()==thinger_message::START_STREAM && thing_resource->get_stream_interval()>0){
+                            streams_.add(*thing_resource);
                         }
+                    )
+                    // stream enabled over a resource input -> notify the current state
+                    if(thing_resource->stream_enabled() && (thing_resource->get_io_type()==thinger_resource::pson_in || thing_resource->get_io_type()==thinger_resource::pson_in_pson_out)){
+                        // send normal response
+                        send_message(response);
+                        // stream the event to notify the change
+                        return stream_resource(*thing_resource, thinger_message::STREAM_EVENT);
                     }
                 }
             }
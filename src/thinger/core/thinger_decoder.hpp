@@ -26,71 +26,89 @@
 
 #include "pson.h"
 #include "thinger_message.hpp"
+#include "thinger_io.hpp"
 
 namespace thinger{
 
-    class thinger_decoder : public protoson::pson_decoder{
-    public:
-        bool decode(thinger_message&  message, size_t size){
-            size_t start_read = bytes_read();
-            while(size-(bytes_read()-start_read)>0) {
-                protoson::pb_wire_type wire_type;
-                uint32_t field_number=0;
-                if(!pb_decode_tag(wire_type, field_number)) return false;
-                switch (wire_type) {
-                    case protoson::length_delimited:{
-                        uint32_t size = 0;
-                        if(!pb_decode_varint32(size) || !pb_skip(size)) return false;
-                    }
-                        break;
-                    case protoson::varint: {
-                        switch (field_number) {
-                            case thinger_message::SIGNAL_FLAG:
-                            {
-                                uint32_t signal_flag = 0;
-                                if(!pb_decode_varint32(signal_flag)) return false;
-                                message.set_signal_flag((thinger_message::signal_flag)(signal_flag));
-                            }
-                                break;
-                            case thinger_message::STREAM_ID:
-                            {
-                                uint32_t stream_id = 0;
-                                if(!pb_decode_varint32(stream_id)) return false;
-                                message.set_stream_id(stream_id);
-                            }
-                                break;
-                            default:
-                                if(!pb_skip_varint()) return false;
-                                break;
+    /**
+     * Decode a thinger message of the given size with any pson decoder
+     */
+    template<class Decoder>
+    bool decode_message(Decoder& decoder, thinger_message& message, size_t size){
+        // build the message contents with the message allocator
+        protoson::memory_scope scope(message.get_allocator());
+        size_t start_read = decoder.bytes_read();
+        while(size-(decoder.bytes_read()-start_read)>0) {
+            protoson::pb_wire_type wire_type;
+            uint32_t field_number=0;
+            if(!decoder.pb_decode_tag(wire_type, field_number)) return false;
+            switch (wire_type) {
+                case protoson::length_delimited:{
+                    uint32_t size = 0;
+                    if(!decoder.pb_decode_varint32(size) || !decoder.pb_skip(size)) return false;
+                }
+                    break;
+                case protoson::varint: {
+                    switch (field_number) {
+                        case thinger_message::SIGNAL_FLAG:
+                        {
+                            uint32_t signal_flag = 0;
+                            if(!decoder.pb_decode_varint32(signal_flag)) return false;
+                            message.set_signal_flag((thinger_message::signal_flag)(signal_flag));
                         }
-                        break;
-                    }
-                    case protoson::pson_type:
-                        switch(field_number){
-                            case thinger_message::IDENTIFIER:
-                                if(!protoson::pson_decoder::decode(message.get_identifier())) return false;
-                                break;
-                            case thinger_message::RESOURCE:
-                                if(!protoson::pson_decoder::decode(message.get_resources())) return false;
-                                break;
-                            case thinger_message::PAYLOAD:
-                                if(!protoson::pson_decoder::decode(((protoson::pson&) message))) return false;
-                                break;
-                            default:
-                                break;
+                            break;
+                        case thinger_message::STREAM_ID:
+                        {
+                            uint32_t stream_id = 0;
+                            if(!decoder.pb_decode_varint32(stream_id)) return false;
+                            message.set_stream_id(stream_id);
                         }
-                        break;
-                    case protoson::fixed_32:
-                        if(!pb_skip(4)) return false;
-                        break;
-                    case protoson::fixed_64:
-                        if(!pb_skip(8)) return false;
-                        break;
-                    default:
-                        break;
+                            break;
+                        default:
+                            if(!decoder.pb_skip_varint()) return false;
+                            break;
+                    }
+                    break;
                 }
+                case protoson::pson_type:
+                    switch(field_number){
+                        case thinger_message::IDENTIFIER:
+                            if(!decoder.decode(message.get_identifier())) return false;
+                            break;
+                        case thinger_message::RESOURCE:
+                            if(!decoder.decode(message.get_resources())) return false;
+                            break;
+                        case thinger_message::PAYLOAD: {
+                            // keep the payload encoded in the input, if possible, until it is used
+                            size_t encoded_size = 0;
+                            if(uint8_t* encoded = decoder.pb_read_encoded(encoded_size)){
+                                message.set_encoded_data(encoded, encoded_size);
+                            }else if(!decoder.decode(((protoson::pson&) message))) return false;
+                            break;
+                        }
+                        default:
+                            break;
+                    }
+                    break;
+                case protoson::fixed_32:
+                    if(!decoder.pb_skip(4)) return false;
+                    break;
+                case protoson::fixed_64:
+                    if(!decoder.pb_skip(8)) return false;
+                    break;
+                default:
+                    break;
             }
-            return true;
+        }
+        return true;
+    }
+
+    class thinger_decoder : public protoson::pson_decoder{
+    public:
+        using protoson::pson_decoder::decode;
+
+        bool decode(thinger_message&  message, size_t size){
+            return decode_message(*this, message, size);
         }
     };
 
@@ -108,10 +126,142 @@ namespace thinger{
         thinger_io& io_;
     };
 
+    /**
+     * Resumable reader of the frames received from a thinger_io: a message type, a size, and a body of that size.
+     * It only reads the available data, keeping a partial frame between calls, so a slow sender does not block the
+     * caller. A body received in several calls is kept in an internal buffer.
+     */
+    class thinger_frame_reader{
+    public:
+        enum status{
+            FRAME_INCOMPLETE,
+            FRAME_COMPLETE,
+            FRAME_ERROR
+        };
+
+        thinger_frame_reader(thinger_io& io) : io_(io){
+            reset();
+        }
+
+        /**
+         * Read the frame type and size
+         * @param wait block until there is some data available
+         */
+        status read_header(bool wait=false){
+            while(field_<2){
+                uint8_t byte;
+                size_t read = 0;
+                if(!io_.read_some((char*) &byte, 1, read, wait)) return FRAME_ERROR;
+                if(read==0) return FRAME_INCOMPLETE;
+                uint32_t& value = field_==0 ? type_ : size_;
+                value |= (uint32_t)(byte & 0x7F) << shift_;
+                if(byte & 0x80){
+                    shift_ += 7;
+                    if(shift_>=32) return FRAME_ERROR;
+                }else{
+                    shift_ = 0;
+                    field_++;
+                }
+            }
+            return FRAME_COMPLETE;
+        }
+
+        /**
+         * Read the frame body, once the header is complete
+         * @param destination buffer of size() bytes the body should be read into. If NULL, or if the body was already
+         * started in a previous call, it is read into the internal buffer (and copied to destination once complete).
+         * @param wait block until the whole body is read
+         */
+        status read_body(uint8_t* destination, bool wait=false){
+            if(offset_==0 && destination!=NULL){
+                status result = read_to(destination, wait);
+                if(result!=FRAME_INCOMPLETE){
+                    body_ = destination;
+                    return result;
+                }
+                // keep the partial body, as the destination may not survive until the next call
+                if(offset_>0){
+                    if(!buffer_.ensure(size_)) return FRAME_ERROR;
+                    memcpy(buffer_.data(), destination, offset_);
+                }
+                return FRAME_INCOMPLETE;
+            }
+            if(!buffer_.ensure(size_)) return FRAME_ERROR;
+            status result = read_to(buffer_.data(), wait);
+            if(result==FRAME_COMPLETE){
+                body_ = buffer_.data();
+                if(destination!=NULL){
+                    memcpy(destination, body_, size_);
+                    body_ = destination;
+                }
+            }
+            return result;
+        }
+
+        /**
+         * @return true if part of the body has been read in a previous call
+         */
+        bool body_started() const{
+            return offset_>0;
+        }
+
+        uint32_t type() const{
+            return type_;
+        }
+
+        uint32_t size() const{
+            return size_;
+        }
+
+        /**
+         * @return the frame body, once it has been completely read
+         */
+        uint8_t* body(){
+            return body_;
+        }
+
+        /**
+         * Discard the current frame, to start reading the next one
+         */
+        void reset(){
+            buffer_.release(offset_);
+            type_ = 0;
+            size_ = 0;
+            field_ = 0;
+            shift_ = 0;
+            offset_ = 0;
+            body_ = NULL;
+        }
+
+    private:
+        status read_to(uint8_t* buffer, bool wait){
+            while(offset_<size_){
+                size_t read = 0;
+                if(!io_.read_some((char*) buffer + offset_, size_ - offset_, read, wait)) return FRAME_ERROR;
+                if(read==0) return FRAME_INCOMPLETE;
+                offset_ += read;
+            }
+            return FRAME_COMPLETE;
+        }
+
+        thinger_io& io_;
+        thinger_io_buffer buffer_;
+        uint32_t type_;
+        uint32_t size_;
+        uint8_t field_;
+        uint8_t shift_;
+        uint32_t offset_;
+        uint8_t* body_;
+    };
+
     class thinger_memory_decoder : public thinger_decoder{
 
     public:
-        thinger_memory_decoder(uint8_t* buffer, size_t size) : buffer_(buffer), size_(size){}
+        /**
+         * @param pinned if true, decoded strings and bytes reference the buffer instead of being copied, so it must
+         * outlive the decoded values. The buffer contents are modified in this mode.
+         */
+        thinger_memory_decoder(uint8_t* buffer, size_t size, bool pinned=false) : buffer_(buffer), size_(size), pinned_(pinned){}
 
     protected:
         virtual bool read(void* buffer, size_t size){
@@ -123,9 +273,38 @@ namespace thinger{
             }
         }
 
+        virtual const uint8_t* peek(size_t& available){
+            available = size_ - read_;
+            return buffer_ + read_;
+        }
+
+        virtual uint8_t* read_pinned(size_t size){
+            if(!pinned_ || read_+size>size_) return NULL;
+            uint8_t* data = buffer_ + read_;
+            protoson::pson_decoder::read(data, size);
+            return data;
+        }
+
     private:
         uint8_t* buffer_;
         size_t size_;
+        bool pinned_;
+    };
+
+    /**
+     * Memory decoder where the input methods are resolved at compile time. Decoded strings and bytes reference the
+     * buffer, so it must outlive the decoded values, and its contents are modified.
+     */
+    class thinger_buffer_decoder : public protoson::pson_buffer_decoder_base<thinger_buffer_decoder>{
+    public:
+        thinger_buffer_decoder(uint8_t* buffer, size_t size) :
+            protoson::pson_buffer_decoder_base<thinger_buffer_decoder>(buffer, size){}
+
+        using protoson::pson_buffer_decoder_base<thinger_buffer_decoder>::decode;
+
+        bool decode(thinger_message&  message, size_t size){
+            return decode_message(*this, message, size);
+        }
     };
 
 }
@@ -27,8 +27,57 @@
 #include "thinger_message.hpp"
 #include "thinger_io.hpp"
 
+#ifndef THINGER_ENCODER_BORROW_SIZE
+    #define THINGER_ENCODER_BORROW_SIZE 512
+#endif
+
 namespace thinger{
 
+    /**
+     * Encode a thinger message with any pson encoder
+     */
+    template<class Encoder>
+    void encode_message(Encoder& encoder, thinger_message& message){
+        if(message.get_stream_id()!=0){
+            encoder.pb_encode_varint(thinger_message::STREAM_ID, message.get_stream_id());
+        }
+        if(message.get_signal_flag()!=thinger_message::NONE){
+            encoder.pb_encode_varint(thinger_message::SIGNAL_FLAG, message.get_signal_flag());
+        }
+        if(message.has_identifier()){
+            encoder.pb_encode_tag(protoson::pson_type, thinger_message::IDENTIFIER);
+            encoder.encode(message.get_identifier());
+        }
+        if(message.has_resource()){
+            encoder.pb_encode_tag(protoson::pson_type, thinger_message::RESOURCE);
+            encoder.encode(message.get_resources());
+        }
+        if(message.has_data()){
+            encoder.pb_encode_tag(protoson::pson_type, thinger_message::PAYLOAD);
+            message.encode_data(encoder);
+        }
+    }
+
+    /**
+     * Encode a message as sent over the wire: the message type, its size, and the message itself
+     */
+    template<class Encoder>
+    void encode_frame(Encoder& encoder, thinger_message& message){
+        encoder.pb_encode_varint(MESSAGE);
+        size_t mark;
+        if(encoder.reserve_length(mark, 0)){
+            size_t length;
+            encode_message(encoder, message);
+            // any failure is kept by the encoder, and the whole frame is checked once before writing it
+            encoder.commit_length(mark, length);
+        }else{
+            protoson::pson_size_encoder sink;
+            encode_message(sink, message);
+            encoder.pb_encode_varint(sink.bytes_written());
+            encode_message(encoder, message);
+        }
+    }
+
     class thinger_encoder : public protoson::pson_encoder{
 
     protected:
@@ -37,25 +86,14 @@ namespace thinger{
         }
 
     public:
+        using protoson::pson_encoder::encode;
+
         void encode(thinger_message& message){
-            if(message.get_stream_id()!=0){
-                pb_encode_varint(thinger_message::STREAM_ID, message.get_stream_id());
-            }
-            if(message.get_signal_flag()!=thinger_message::NONE){
-                pb_encode_varint(thinger_message::SIGNAL_FLAG, message.get_signal_flag());
-            }
-            if(message.has_identifier()){
-                pb_encode_tag(protoson::pson_type, thinger_message::IDENTIFIER);
-                protoson::pson_encoder::encode(message.get_identifier());
-            }
-            if(message.has_resource()){
-                pb_encode_tag(protoson::pson_type, thinger_message::RESOURCE);
-                protoson::pson_encoder::encode(message.get_resources());
-            }
-            if(message.has_data()){
-                pb_encode_tag(protoson::pson_type, thinger_message::PAYLOAD);
-                protoson::pson_encoder::encode((protoson::pson&) message);
-            }
+            encode_message(*this, message);
+        }
+
+        void encode_frame(thinger_message& message){
+            thinger::encode_frame(*this, message);
         }
     };
 
@@ -73,6 +111,160 @@ namespace thinger{
         thinger_io& io_;
     };
 
+    /**
+     * Encoder that writes to a growable memory buffer. As the written data can be modified, lengths are written after
+     * their contents, so messages are encoded in a single pass. The buffer is kept between messages. Its output
+     * methods are resolved at compile time. String and bytes values of THINGER_ENCODER_BORROW_SIZE bytes or more are
+     * not copied to the buffer, but referenced from the output spans, so they must be written before the encoded pson
+     * is modified or released.
+     */
+    class thinger_buffer_encoder : public protoson::pson_encoder_base<thinger_buffer_encoder>{
+        friend class protoson::pson_encoder_base<thinger_buffer_encoder>;
+
+        /**
+         * Value referenced at a given offset of the buffer
+         */
+        struct borrowed_value{
+            size_t offset;
+            const void* data;
+            size_t size;
+        };
+
+    public:
+        thinger_buffer_encoder() : size_(0), borrowed_count_(0), error_(false){}
+
+        using protoson::pson_encoder_base<thinger_buffer_encoder>::encode;
+
+        void encode(thinger_message& message){
+            encode_message(*this, message);
+        }
+
+        void encode_frame(thinger_message& message){
+            thinger::encode_frame(*this, message);
+        }
+
+        void reset(){
+            buffer_.release(size_);
+            written_ = 0;
+            size_ = 0;
+            borrowed_count_ = 0;
+            error_ = false;
+        }
+
+        /**
+         * Get the encoded data as a sequence of spans, interleaving the buffer contents with the borrowed values
+         * @param count number of returned spans
+         * @return the spans, valid until the next write or reset, or NULL if they could not be allocated
+         */
+        const thinger_io_span* get_spans(size_t& count){
+            count = 0;
+            if(!spans_.ensure((2*borrowed_count_+1)*sizeof(thinger_io_span))) return NULL;
+            thinger_io_span* spans = (thinger_io_span*) spans_.data();
+            const uint8_t* buffer = buffer_.data();
+            size_t offset = 0;
+            for(size_t i=0; i<borrowed_count_; i++){
+                const borrowed_value& value = borrowed()[i];
+                if(value.offset>offset){
+                    spans[count].data = buffer + offset;
+                    spans[count++].size = value.offset - offset;
+                    offset = value.offset;
+                }
+                spans[count].data = value.data;
+                spans[count++].size = value.size;
+            }
+            if(size_>offset){
+                spans[count].data = buffer + offset;
+                spans[count++].size = size_ - offset;
+            }
+            return spans;
+        }
+
+        /**
+         * @return false if the buffer could not grow to hold any of the written data
+         */
+        bool is_valid(){
+            return !error_;
+        }
+
+        bool write_value(const void* buffer, size_t size){
+            if(size<THINGER_ENCODER_BORROW_SIZE) return write(buffer, size);
+            if(!ensure(borrowed_, (borrowed_count_+1)*sizeof(borrowed_value))) return false;
+            borrowed_value& value = borrowed()[borrowed_count_++];
+            value.offset = size_;
+            value.data = buffer;
+            value.size = size;
+            written_ += size;
+            return true;
+        }
+
+        bool reserve_length(size_t& mark, size_t expected_size){
+            // the reserved prefix is a varint placeholder, so its size can be found backwards from the mark
+            uint8_t placeholder[10];
+            uint8_t reserved = protoson::pson_varint_size(expected_size);
+            memset(placeholder, 0x80, reserved-1);
+            placeholder[reserved-1] = 0;
+            write(placeholder, reserved);
+            mark = size_;
+            return true;
+        }
+
+        bool commit_length(size_t mark, size_t& length){
+            if(error_) return false;
+            uint8_t* buffer = buffer_.data();
+            size_t reserved = 1;
+            while(reserved < mark && (buffer[mark-reserved-1] & 0x80) && reserved < 10) reserved++;
+            // the content length includes the values borrowed after the mark
+            length = size_ - mark;
+            size_t first = borrowed_count_;
+            while(first>0 && borrowed()[first-1].offset>=mark){
+                length += borrowed()[--first].size;
+            }
+            uint8_t length_size = protoson::pson_varint_size(length);
+            // move the contents if the reserved prefix has not the right size (keeping the encoding canonical)
+            if(length_size!=reserved){
+                if(!ensure(buffer_, size_ + length_size - reserved)) return false;
+                buffer = buffer_.data();
+                memmove(buffer + mark + length_size - reserved, buffer + mark, size_ - mark);
+                size_ = size_ + length_size - reserved;
+                written_ = written_ + length_size - reserved;
+                for(size_t i=first; i<borrowed_count_; i++){
+                    borrowed()[i].offset = borrowed()[i].offset + length_size - reserved;
+                }
+            }
+            uint8_t prefix[10];
+            protoson::pson_varint_encode(prefix, length);
+            memcpy(buffer + mark - reserved, prefix, length_size);
+            return true;
+        }
+
+    protected:
+        bool write(const void *buffer, size_t size){
+            if(!ensure(buffer_, size_ + size)) return false;
+            memcpy(buffer_.data() + size_, buffer, size);
+            size_ += size;
+            written_ += size;
+            return true;
+        }
+
+    private:
+        bool ensure(thinger_io_buffer& buffer, size_t size){
+            if(error_) return false;
+            if(!buffer.ensure(size)) error_ = true;
+            return !error_;
+        }
+
+        borrowed_value* borrowed(){
+            return (borrowed_value*) borrowed_.data();
+        }
+
+        thinger_io_buffer buffer_;
+        thinger_io_buffer borrowed_;
+        thinger_io_buffer spans_;
+        size_t size_;
+        size_t borrowed_count_;
+        bool error_;
+    };
+
     class thinger_memory_encoder : public thinger_encoder{
 
     public:
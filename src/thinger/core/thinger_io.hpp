@@ -24,8 +24,96 @@
 #ifndef THINGER_IO_HPP
 #define THINGER_IO_HPP
 
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef THINGER_BUFFER_MIN_SIZE
+    #define THINGER_BUFFER_MIN_SIZE 64
+#endif
+
+#ifndef THINGER_BUFFER_SHRINK_PERIOD
+    #define THINGER_BUFFER_SHRINK_PERIOD 32
+#endif
+
 namespace thinger {
 
+    /**
+     * Contiguous piece of output data, so a message can be written from several memory regions (i.e., its encoded
+     * headers and the large values it references) without copying them together
+     */
+    struct thinger_io_span{
+        const void* data;
+        size_t size;
+    };
+
+    /**
+     * Growable output buffer. It grows geometrically, and it is shrunk again if it stays used below a quarter of its
+     * capacity for THINGER_BUFFER_SHRINK_PERIOD consecutive uses, so a single large message does not keep its memory
+     * reserved forever.
+     */
+    class thinger_io_buffer{
+    public:
+        thinger_io_buffer() : buffer_(NULL), capacity_(0), peak_(0), idle_(0){}
+
+        ~thinger_io_buffer(){
+            free(buffer_);
+        }
+
+        uint8_t* data(){
+            return buffer_;
+        }
+
+        size_t capacity() const{
+            return capacity_;
+        }
+
+        /**
+         * Ensure the buffer can hold the given size, keeping its contents
+         * @return false if the buffer could not grow
+         */
+        bool ensure(size_t size){
+            if(size<=capacity_) return true;
+            size_t capacity = capacity_>0 ? capacity_ : THINGER_BUFFER_MIN_SIZE;
+            while(capacity<size) capacity *= 2;
+            return resize(capacity);
+        }
+
+        /**
+         * Notify that the buffer contents are no longer needed, after being used up to the given size
+         */
+        void release(size_t used){
+            if(used*4 > capacity_ || capacity_ <= THINGER_BUFFER_MIN_SIZE){
+                idle_ = 0;
+                peak_ = 0;
+                return;
+            }
+            if(used>peak_) peak_ = used;
+            if(++idle_ < THINGER_BUFFER_SHRINK_PERIOD) return;
+            size_t capacity = capacity_;
+            while(capacity/2 >= THINGER_BUFFER_MIN_SIZE && capacity/2 >= peak_*2) capacity /= 2;
+            resize(capacity);
+            idle_ = 0;
+            peak_ = 0;
+        }
+
+    private:
+        thinger_io_buffer(const thinger_io_buffer&);
+        thinger_io_buffer& operator=(const thinger_io_buffer&);
+
+        bool resize(size_t capacity){
+            uint8_t* buffer = (uint8_t*) realloc(buffer_, capacity);
+            if(buffer==NULL) return false;
+            buffer_ = buffer;
+            capacity_ = capacity;
+            return true;
+        }
+
+        uint8_t* buffer_;
+        size_t capacity_;
+        size_t peak_;
+        unsigned idle_;
+    };
+
     class thinger_io {
     public:
         thinger_io(){}
@@ -34,6 +122,39 @@ namespace thinger {
     public:
         virtual bool read(char *buffer, size_t size) = 0;
         virtual bool write(const char *buffer, size_t size, bool flush = false) = 0;
+
+        /**
+         * Write several spans of data, in order, as if they were a single buffer. The default implementation writes
+         * them one by one, but implementations may send them with a single scatter-gather operation.
+         */
+        virtual bool writev(const thinger_io_span* spans, size_t count, bool flush = false){
+            for(size_t i=0; i<count; i++){
+                if(!write((const char*) spans[i].data, spans[i].size, flush && i+1==count)) return false;
+            }
+            return count>0 || !flush || write(NULL, 0, true);
+        }
+
+        /**
+         * Read up to size bytes without blocking, unless wait is true and there is no data available at all. The
+         * default implementation reads a single byte with a blocking read, so implementations should override it to
+         * not block the caller while a frame is partially received.
+         * @param bytes_read number of bytes read, that is 0 if there was no data available
+         * @return false if the connection was closed or failed
+         */
+        virtual bool read_some(char* buffer, size_t size, size_t& bytes_read, bool /*wait*/ = false){
+            bytes_read = 0;
+            if(size==0) return true;
+            if(!read(buffer, 1)) return false;
+            bytes_read = 1;
+            return true;
+        }
+
+        /**
+         * @return true if there is received data already buffered, pending to be processed
+         */
+        virtual bool input_pending(){
+            return false;
+        }
     };
 
 }
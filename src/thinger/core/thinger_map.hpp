@@ -66,6 +66,7 @@ public:
         }
         // TODO replace with memory allocator for allowing static memory/dynamic memory
         current = new entry(key);
+        get_insertions()++;
 
         if(head_==NULL) head_ = current;
         if(last_!=NULL) last_->next_ = current;
@@ -73,6 +74,14 @@ public:
         return current->value_;
     }
 
+    /**
+     * Number of entries added to the maps of this type, so indexes over them can detect changes
+     */
+    static unsigned long& get_insertions(){
+        static unsigned long insertions_ = 0;
+        return insertions_;
+    }
+
     entry* begin(){
         return head_;
     }
@@ -25,6 +25,13 @@
 #define THINGER_MESSAGE_HPP
 
 #include "pson.h"
+#include "pson_schema.h"
+#include "pson_view.h"
+#include "pson_writer.h"
+
+#ifndef THINGER_MESSAGE_TREE_RESERVE
+    #define THINGER_MESSAGE_TREE_RESERVE 4096
+#endif
 
 namespace thinger{
 
@@ -82,7 +89,16 @@ namespace thinger{
             identifier(NULL),
             resource(NULL),
             data(NULL),
-            data_allocated(false)
+            data_allocated(false),
+            frame_(NULL),
+            encoded_data_(NULL),
+            encoded_size_(0),
+            encoded_shared_(false),
+            schema_(NULL),
+            schema_object_(NULL),
+            data_key_(NULL),
+            view_data_(NULL),
+            allocator_(protoson::current_allocator())
         {}
 
         /**
@@ -94,18 +110,52 @@ namespace thinger{
             identifier(NULL),
             resource(NULL),
             data(NULL),
-            data_allocated(false)
+            data_allocated(false),
+            frame_(NULL),
+            encoded_data_(NULL),
+            encoded_size_(0),
+            encoded_shared_(false),
+            schema_(NULL),
+            schema_object_(NULL),
+            data_key_(NULL),
+            view_data_(NULL),
+            allocator_(protoson::current_allocator())
+        {}
+
+        /**
+         * Initialize a default empty message that will hold its contents in the given allocator
+         */
+        thinger_message(protoson::memory_allocator& allocator) :
+            stream_id(0),
+            flag(NONE),
+            identifier(NULL),
+            resource(NULL),
+            data(NULL),
+            data_allocated(false),
+            frame_(NULL),
+            encoded_data_(NULL),
+            encoded_size_(0),
+            encoded_shared_(false),
+            schema_(NULL),
+            schema_object_(NULL),
+            data_key_(NULL),
+            view_data_(NULL),
+            allocator_(allocator)
         {}
 
         ~thinger_message(){
+            protoson::memory_scope scope(allocator_);
             // deallocate identifier
-            protoson::pool.destroy(identifier);
+            allocator_.destroy(identifier);
             // deallocate resource
-            protoson::pool.destroy(resource);
+            allocator_.destroy(resource);
             // deallocate paylaod if was allocated here
             if(data_allocated){
-                protoson::pool.destroy(data);
+                allocator_.destroy(data);
             }
+            // release the encoded message after any value referencing it
+            allocator_.deallocate(frame_);
+            allocator_.deallocate(view_data_);
         }
 
     private:
@@ -121,6 +171,22 @@ namespace thinger{
         protoson::pson* data;
         /// flag to determine when the payload has been reserved
         bool data_allocated;
+        /// encoded message, when decoded values reference it
+        uint8_t* frame_;
+        /// encoded payload, kept in the frame until the payload is used
+        uint8_t* encoded_data_;
+        size_t encoded_size_;
+        /// the encoded payload is also referenced by a view or a writer, so it cannot be decoded in place
+        bool encoded_shared_;
+        /// struct payload, encoded with its schema instead of building a pson tree
+        const protoson::pson_schema_base* schema_;
+        const void* schema_object_;
+        /// key of the object holding the struct or encoded payload, if any
+        const char* data_key_;
+        /// payload encoded to be read in place, when it was not kept encoded
+        uint8_t* view_data_;
+        /// memory used by the message contents (can be reserved to hold a whole decoded message)
+        protoson::arena_memory_allocator allocator_;
 
     public:
 
@@ -133,7 +199,7 @@ namespace thinger{
         }
 
         bool has_data(){
-            return data!=NULL;
+            return data!=NULL || encoded_data_!=NULL || schema_!=NULL;
         }
 
         bool has_identifier(){
@@ -144,42 +210,209 @@ namespace thinger{
             return resource!=NULL;
         }
 
+        protoson::arena_memory_allocator& get_allocator(){
+            return allocator_;
+        }
+
+        /**
+         * Reserve the memory for decoding a message from its encoded size, so the whole message tree is built over
+         * a single memory block that is released in one step when the message is destroyed. The block holds the
+         * encoded message and an estimation of the tree nodes, that is capped to THINGER_MESSAGE_TREE_RESERVE, as
+         * strings and bytes do not take node memory, and the arena grows if more nodes are decoded.
+         * @param encoded_size size of the encoded message
+         */
+        bool reserve(size_t encoded_size){
+            // decoded nodes take up to 8 times their encoded size (node headers, names, and values)
+            size_t nodes_size = encoded_size < THINGER_MESSAGE_TREE_RESERVE/8 ?
+                                encoded_size*8 + 64 : THINGER_MESSAGE_TREE_RESERVE + 64;
+            if(encoded_size > (size_t)-1 - nodes_size) return false;
+            return allocator_.reserve(encoded_size + nodes_size);
+        }
+
+        /**
+         * Reserve the memory for decoding a message, including a buffer to hold the encoded message, so decoded strings
+         * and bytes can reference it instead of being copied
+         * @param encoded_size size of the encoded message
+         * @return buffer for the encoded message, that is kept while the message exists, or NULL if there is no memory
+         */
+        uint8_t* reserve_frame(size_t encoded_size){
+            reserve(encoded_size);
+            if(frame_==NULL){
+                frame_ = (uint8_t*) allocator_.allocate(encoded_size);
+            }
+            return frame_;
+        }
+
     public:
         void set_stream_id(uint16_t stream_id) {
             thinger_message::stream_id = stream_id;
         }
 
-        void set_random_stream_id(){
-            // TODO, random seed
-            thinger_message::stream_id = rand();
-        }
-
         void set_signal_flag(signal_flag const &flag) {
             thinger_message::flag = flag;
         }
 
         void set_identifier(const char* id){
             if(identifier==NULL){
-                identifier = protoson::pool.allocate<protoson::pson>();
+                identifier = allocator_.allocate<protoson::pson>();
             }
             (*identifier) = id;
         }
 
         void clean_identifier(){
-            protoson::pool.destroy(identifier);
+            protoson::memory_scope scope(allocator_);
+            allocator_.destroy(identifier);
             identifier = NULL;
         }
 
         void clean_resource(){
-            protoson::pool.destroy(resource);
+            protoson::memory_scope scope(allocator_);
+            allocator_.destroy(resource);
             resource = NULL;
         }
 
         void clean_data(){
+            protoson::memory_scope scope(allocator_);
             if(data_allocated){
-                protoson::pool.destroy(data);
+                allocator_.destroy(data);
             }
             data = NULL;
+            encoded_data_ = NULL;
+            schema_ = NULL;
+            data_key_ = NULL;
+        }
+
+        /**
+         * Keep the payload encoded, so it is only decoded if it is used. The encoded value must outlive the message
+         * (i.e., be part of its frame), and it is modified when decoded, unless a view over it was taken before, so
+         * strings are decoded in place. A malformed payload is decoded as empty.
+         */
+        void set_encoded_data(uint8_t* encoded_data, size_t encoded_size){
+            clean_data();
+            encoded_data_ = encoded_data;
+            encoded_size_ = encoded_size;
+            encoded_shared_ = false;
+        }
+
+        /**
+         * Use a struct as the payload, encoded straight from its members with its schema instead of building a pson
+         * tree. The struct must outlive the message.
+         * @param key if not NULL, the payload is an object holding the struct in this key
+         */
+        void set_data(const protoson::pson_schema_base& schema, const void* object, const char* key=NULL){
+            clean_data();
+            schema_ = &schema;
+            schema_object_ = object;
+            data_key_ = key;
+        }
+
+        template<class T>
+        void set_data(const protoson::pson_schema<T>& schema, const T& object, const char* key=NULL){
+            set_data((const protoson::pson_schema_base&) schema, &object, key);
+        }
+
+        /**
+         * Use the values encoded by a writer as the payload, that are written as they are. The writer must not be
+         * modified or reset while the message exists, and it is never modified by the message: accessing the payload
+         * as a pson copies its strings and bytes from the writer.
+         * @param key if not NULL, the payload is an object holding the written value in this key
+         */
+        void set_data(protoson::pson_writer& writer, const char* key=NULL){
+            clean_data();
+            encoded_data_ = writer.data();
+            encoded_size_ = writer.size();
+            encoded_shared_ = true;
+            data_key_ = key;
+        }
+
+        /*
+         * The payload accessors can be called in any order, and as many times as needed: get_data(schema) and
+         * get_data(view) only read the encoded payload, and accessing the payload as a pson decodes it in place only
+         * if no view was taken over it before. Once accessed as a pson, the payload is no longer kept encoded, so the
+         * other accessors work over the pson value, including any changes made to it.
+         */
+
+        /**
+         * Read the payload into a struct described by the schema. An encoded payload is decoded straight into the
+         * struct, without building a pson tree or modifying the encoded payload, that is kept for any later use.
+         * @return true if the payload is an object
+         */
+        bool get_data(const protoson::pson_schema_base& schema, void* object){
+            if(encoded_data_!=NULL && data_key_==NULL){
+                protoson::pson_shared_buffer_decoder decoder(encoded_data_, encoded_size_);
+                return schema.decode(decoder, object);
+            }
+            return has_data() && schema.read(*this, object);
+        }
+
+        template<class T>
+        bool get_data(const protoson::pson_schema<T>& schema, T& object){
+            return get_data((const protoson::pson_schema_base&) schema, &object);
+        }
+
+        /**
+         * Access the encoded payload, to be read in place without building a pson tree. The view remains valid while
+         * the message exists. A payload that is not encoded (i.e., it was built locally, or accessed as a pson) is
+         * encoded in the message memory, and that view is valid until the next call to this method.
+         * @return true if there is a payload
+         */
+        bool get_data(protoson::pson_view& view){
+            if(encoded_data_!=NULL && data_key_==NULL){
+                view = protoson::pson_view(encoded_data_, encoded_size_);
+                encoded_shared_ = true;
+                return true;
+            }
+            if(!has_data()) return false;
+            protoson::pson_size_encoder sink;
+            encode_data(sink);
+            allocator_.deallocate(view_data_);
+            view_data_ = (uint8_t*) allocator_.allocate(sink.bytes_written());
+            if(view_data_==NULL) return false;
+            protoson::pson_buffer_encoder encoder(view_data_, sink.bytes_written());
+            encode_data(encoder);
+            view = protoson::pson_view(view_data_, encoder.bytes_written());
+            return true;
+        }
+
+        /**
+         * Encode the payload from its pson value, its struct and schema, or its encoded value, that is written as it is
+         */
+        template<class Encoder>
+        void encode_data(Encoder& encoder){
+            if(data_key_==NULL){
+                encode_payload(encoder);
+                return;
+            }
+            size_t key_size = strlen(data_key_);
+            encoder.pb_encode_tag(protoson::length_delimited, protoson::pson::object_field);
+            size_t mark;
+            if(encoder.reserve_length(mark, 0)){
+                encoder.pb_encode_key(data_key_, key_size);
+                size_t length;
+                encode_payload(encoder);
+                // a failure is kept by the encoder, that is checked once the frame holding the payload is encoded
+                encoder.commit_length(mark, length);
+            }else{
+                protoson::pson_size_encoder sink;
+                sink.pb_encode_key(data_key_, key_size);
+                encode_payload(sink);
+                encoder.pb_encode_varint(sink.bytes_written());
+                encoder.pb_encode_key(data_key_, key_size);
+                encode_payload(encoder);
+            }
+        }
+
+    private:
+
+        template<class Encoder>
+        void encode_payload(Encoder& encoder){
+            if(data!=NULL){
+                encoder.encode(*data);
+            }else if(schema_!=NULL){
+                schema_->encode(encoder, schema_object_);
+            }else if(encoded_data_!=NULL){
+                encoder.write_value(encoded_data_, encoded_size_);
+            }
         }
 
     public:
@@ -190,8 +423,24 @@ namespace thinger{
 
         operator protoson::pson&(){
             if(data==NULL){
-                data = protoson::pool.allocate<protoson::pson>();
+                data = allocator_.allocate<protoson::pson>();
                 data_allocated = true;
+                if(encoded_data_!=NULL || schema_!=NULL){
+                    protoson::memory_scope scope(allocator_);
+                    protoson::pson& value = data_key_!=NULL ? (*data)[data_key_] : *data;
+                    if(encoded_data_!=NULL && encoded_shared_){
+                        protoson::pson_shared_buffer_decoder decoder(encoded_data_, encoded_size_);
+                        if(!decoder.decode(value)) value.release();
+                    }else if(encoded_data_!=NULL){
+                        protoson::pson_buffer_decoder decoder(encoded_data_, encoded_size_);
+                        if(!decoder.decode(value)) value.release();
+                    }else{
+                        schema_->fill(schema_object_, value);
+                    }
+                    encoded_data_ = NULL;
+                    schema_ = NULL;
+                    data_key_ = NULL;
+                }
             }
             return *data;
         }
@@ -202,14 +451,14 @@ namespace thinger{
 
         protoson::pson& get_resources(){
             if(resource==NULL){
-                resource = protoson::pool.allocate<protoson::pson>();
+                resource = allocator_.allocate<protoson::pson>();
             }
             return *resource;
         }
 
         protoson::pson& get_identifier(){
             if(identifier==NULL){
-                identifier = protoson::pool.allocate<protoson::pson>();
+                identifier = allocator_.allocate<protoson::pson>();
             }
             return *identifier;
         }
@@ -218,11 +467,32 @@ namespace thinger{
             return *this;
         }
 
+        /**
+         * Use the given value as the message payload without copying it. The value must outlive the message.
+         */
         void set_data(protoson::pson& pson_data){
             if(data==NULL){
                 data = &pson_data;
                 data_allocated = false;
+                encoded_data_ = NULL;
+                schema_ = NULL;
+                data_key_ = NULL;
+            }
+        }
+
+        /**
+         * Move the given value to the message payload, that is released with the message. The value must have been
+         * built with the message allocator, or with the allocator it forwards to (the current one by default).
+         */
+        void set_data(protoson::pson&& pson_data){
+            protoson::memory_scope scope(allocator_);
+            if(!data_allocated){
+                data = NULL;
             }
+            encoded_data_ = NULL;
+            schema_ = NULL;
+            data_key_ = NULL;
+            protoson::pson::swap(pson_data, get_data());
         }
 
     };
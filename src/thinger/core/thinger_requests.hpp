@@ -0,0 +1,184 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS S.L.
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef THINGER_REQUESTS_HPP
+#define THINGER_REQUESTS_HPP
+
+#include "pson.h"
+#include "thinger_message.hpp"
+#include "thinger_resource.hpp"
+
+#ifndef THINGER_MAX_PENDING_REQUESTS
+    #define THINGER_MAX_PENDING_REQUESTS 8
+#endif
+
+#ifndef THINGER_REQUEST_TIMEOUT_MILLIS
+    #define THINGER_REQUEST_TIMEOUT_MILLIS 10000
+#endif
+
+namespace thinger{
+
+    /**
+     * Callback for an asynchronous request, called once with the request result, and the response payload (empty if
+     * the request failed or timed out). The payload is only valid during the call.
+     */
+#ifdef THINGER_USE_FUNCTIONAL
+    typedef std::function<void(bool success, protoson::pson& data)> request_callback;
+#else
+    typedef void (*request_callback)(bool success, protoson::pson& data);
+#endif
+
+    /**
+     * Requests waiting for a server response, identified by their stream id. It holds a fixed number of requests,
+     * and provides the stream ids for new requests, so a response can only match a single request.
+     */
+    class thinger_requests {
+
+    public:
+        thinger_requests() : count_(0), last_stream_id_(0)
+        {}
+
+        bool full() const{
+            return count_>=THINGER_MAX_PENDING_REQUESTS;
+        }
+
+        size_t size() const{
+            return count_;
+        }
+
+        /**
+         * Stream id that is not used by any pending request. Ids are assigned in sequence, and 0 is never used, as
+         * it identifies messages that do not expect a response.
+         */
+        uint16_t next_stream_id(){
+            do{
+                ++last_stream_id_;
+            }while(last_stream_id_==0 || find(last_stream_id_)!=NULL);
+            return last_stream_id_;
+        }
+
+        /**
+         * Register a request waiting for a response
+         * @param timeout time the request waits for its response, counted from the next remove_expired call
+         * @return false if there are too many pending requests
+         */
+        bool add(uint16_t stream_id, unsigned long timeout, request_callback callback){
+            if(full()) return false;
+            entry& request = entries_[count_++];
+            request.stream_id = stream_id;
+            request.timeout = timeout;
+            request.started = false;
+            request.callback = callback;
+            return true;
+        }
+
+        /**
+         * Remove the request with the given stream id
+         * @param callback set to the request callback
+         * @return false if there is no pending request with such id
+         */
+        bool remove(uint16_t stream_id, request_callback& callback){
+            entry* request = find(stream_id);
+            if(request==NULL) return false;
+            remove(*request, callback);
+            return true;
+        }
+
+        /**
+         * Remove a request whose deadline has passed
+         * @param callback set to the request callback
+         * @return false if there is no expired request
+         */
+        bool remove_expired(unsigned long current_time, request_callback& callback){
+            for(size_t i=0; i<count_; i++){
+                // the time is only known when handling, so deadlines are set on the first call after the request
+                if(!entries_[i].started){
+                    entries_[i].deadline = current_time + entries_[i].timeout;
+                    entries_[i].started = true;
+                }
+                // the difference is signed, so deadlines keep working when the time base wraps around
+                if((long)(current_time - entries_[i].deadline) >= 0){
+                    remove(entries_[i], callback);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Deadline of the first request to expire, among the requests whose deadline is already set
+         * @return false if there is no such request
+         */
+        bool next_deadline(unsigned long& deadline){
+            bool found = false;
+            for(size_t i=0; i<count_; i++){
+                if(entries_[i].started && (!found || (long)(entries_[i].deadline - deadline) < 0)){
+                    deadline = entries_[i].deadline;
+                    found = true;
+                }
+            }
+            return found;
+        }
+
+        /**
+         * Make all the pending requests expire in the next remove_expired call, i.e., when the connection is lost
+         */
+        void expire(){
+            for(size_t i=0; i<count_; i++){
+                entries_[i].timeout = 0;
+                entries_[i].started = false;
+            }
+        }
+
+    private:
+        struct entry{
+            uint16_t stream_id;
+            bool started;
+            unsigned long timeout;
+            unsigned long deadline;
+            request_callback callback;
+        };
+
+        entry entries_[THINGER_MAX_PENDING_REQUESTS];
+        size_t count_;
+        uint16_t last_stream_id_;
+
+        entry* find(uint16_t stream_id){
+            for(size_t i=0; i<count_; i++){
+                if(entries_[i].stream_id==stream_id) return &entries_[i];
+            }
+            return NULL;
+        }
+
+        void remove(entry& request, request_callback& callback){
+            callback = request.callback;
+            // keep the requests packed, moving the last one to the free slot
+            entry& last = entries_[--count_];
+            if(&request!=&last) request = last;
+            last.callback = NULL;
+        }
+    };
+
+}
+
+#endif
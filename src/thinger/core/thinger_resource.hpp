@@ -72,6 +72,7 @@ private:
         std::function<void()> run;
         std::function<void(protoson::pson& io)> pson;
         std::function<void(protoson::pson& in, protoson::pson& out)> pson_in_pson_out;
+        std::function<void(protoson::pson_view& in)> raw;
     };
 
 #else
@@ -80,6 +81,7 @@ private:
         void (*run)();
         void (*pson)(protoson::pson& io);
         void (*pson_in_pson_out)(protoson::pson& in, protoson::pson& out);
+        void (*raw)(protoson::pson_view& in);
     };
 
 #endif
@@ -89,12 +91,20 @@ private:
     access_type access_type_;
     callback callback_;
 
+    // struct used as input or output, encoded and decoded with its schema (with an optional run callback)
+    const protoson::pson_schema_base* schema_;
+    void* object_;
+
+    // input read in place from the encoded payload
+    bool raw_input_;
+
     // used for allowing resource streaming (both periodically or by events)
     uint16_t stream_id_;
 
     // used for periodic stream events
     unsigned long streaming_freq_;
-    unsigned long last_streaming_;
+    // changed each time the stream is started or stopped, so outdated stream schedules can be discarded
+    uint16_t stream_schedule_;
 
     // TODO change to pointer so it is not using more than a pointer size if not used?
     thinger_map<thinger_resource> sub_resources_;
@@ -107,11 +117,19 @@ private:
             get_streaming_counter()--;
         }
         streaming_freq_ = streaming_freq;
-        last_streaming_ = 0;
+        stream_schedule_++;
+    }
+
+    // clear the input state of a previous struct or raw input definition
+    void reset_input(){
+        schema_ = NULL;
+        raw_input_ = false;
     }
 
 public:
-    thinger_resource() : io_type_(none), access_type_(PRIVATE), stream_id_(0), streaming_freq_(0), last_streaming_(0)
+    thinger_resource() : io_type_(none), access_type_(PRIVATE), schema_(NULL), object_(NULL), raw_input_(false),
+        stream_id_(0),
+        streaming_freq_(0), stream_schedule_(0)
     {}
 
     void disable_streaming(){
@@ -120,6 +138,7 @@ public:
             get_streaming_counter()--;
         }
         streaming_freq_ = 0;
+        stream_schedule_++;
     }
 
     bool stream_enabled(){
@@ -130,15 +149,15 @@ public:
         return stream_id_;
     }
 
-    bool stream_required(unsigned long timestamp){
-        // sample interval is activated
-        if(streaming_freq_>0){
-            if(timestamp-last_streaming_>=streaming_freq_){
-                last_streaming_ = timestamp;
-                return true;
-            }
-        }
-        return false;
+    /**
+     * @return interval between stream samples, or 0 if the resource is not sampled periodically
+     */
+    unsigned long get_stream_interval(){
+        return streaming_freq_;
+    }
+
+    uint16_t get_stream_schedule(){
+        return stream_schedule_;
     }
 
     thinger_resource * find(const char* res)
@@ -179,8 +198,12 @@ public:
     }
 
     void fill_api_io(protoson::pson_object& content){
-        if(io_type_ == pson_in){
-            callback_.pson(content["in"]);
+        if(schema_!=NULL){
+            if(io_type_ == pson_out && callback_.run) callback_.run();
+            schema_->fill(object_, content[io_type_ == pson_in ? "in" : "out"]);
+        }else if(io_type_ == pson_in){
+            // inputs read in place cannot describe their contents
+            if(!raw_input_) callback_.pson(content["in"]);
         }else if(io_type_ == pson_out){
             callback_.pson(content["out"]);
         }else if(io_type_ == pson_in_pson_out){
@@ -188,9 +211,39 @@ public:
         }
     }
 
+    /**
+     * Fill the message payload with the resource input and output, as in fill_api_io. Structs with a schema are
+     * encoded directly from the message.
+     */
+    void fill_api_io(thinger_message& message){
+        if(schema_!=NULL){
+            if(io_type_ == pson_out && callback_.run) callback_.run();
+            message.set_data(*schema_, object_, io_type_ == pson_in ? "in" : "out");
+        }else{
+            fill_api_io(message.get_data());
+        }
+    }
+
     void fill_output(protoson::pson& content){
         if(io_type_ == pson_out){
-            callback_.pson(content);
+            if(schema_!=NULL){
+                if(callback_.run) callback_.run();
+                schema_->fill(object_, content);
+            }else{
+                callback_.pson(content);
+            }
+        }
+    }
+
+    /**
+     * Fill the message payload with the resource output. Structs with a schema are encoded directly from the message.
+     */
+    void fill_output(thinger_message& message){
+        if(io_type_ == pson_out && schema_!=NULL){
+            if(callback_.run) callback_.run();
+            message.set_data(*schema_, object_);
+        }else{
+            fill_output(message.get_data());
         }
     }
 
@@ -208,6 +261,7 @@ public:
     void operator=(std::function<void()> run_function){
         io_type_ = run;
         callback_.run = run_function;
+        reset_input();
     }
 
     /**
@@ -216,6 +270,7 @@ public:
     void set_function(std::function<void()> run_function){
         io_type_ = run;
         callback_.run = run_function;
+        reset_input();
     }
 
     /**
@@ -224,6 +279,7 @@ public:
     void operator<<(std::function<void(protoson::pson&)> in_function){
         io_type_ = pson_in;
         callback_.pson = in_function;
+        reset_input();
     }
 
     /**
@@ -232,6 +288,7 @@ public:
     void set_input(std::function<void(protoson::pson&)> in_function){
         io_type_ = pson_in;
         callback_.pson = in_function;
+        reset_input();
     }
 
     /**
@@ -240,6 +297,7 @@ public:
     void operator>>(std::function<void(protoson::pson&)> out_function){
         io_type_ = pson_out;
         callback_.pson = out_function;
+        reset_input();
     }
 
     /**
@@ -248,6 +306,7 @@ public:
     void set_output(std::function<void(protoson::pson&)> out_function){
         io_type_ = pson_out;
         callback_.pson = out_function;
+        reset_input();
     }
 
     /**
@@ -256,6 +315,7 @@ public:
     void operator=(std::function<void(protoson::pson& in, protoson::pson& out)> pson_in_pson_out_function){
         io_type_ = pson_in_pson_out;
         callback_.pson_in_pson_out = pson_in_pson_out_function;
+        reset_input();
     }
 
     /**
@@ -264,6 +324,39 @@ public:
     void set_input_output(std::function<void(protoson::pson& in, protoson::pson& out)> pson_in_pson_out_function){
         io_type_ = pson_in_pson_out;
         callback_.pson_in_pson_out = pson_in_pson_out_function;
+        reset_input();
+    }
+
+    /**
+     * Establish a function with input parameters, that reads the encoded input in place without building a pson tree
+     */
+    void set_raw_input(std::function<void(protoson::pson_view& in)> in_function){
+        io_type_ = pson_in;
+        callback_.raw = in_function;
+        reset_input();
+        raw_input_ = true;
+    }
+
+    /**
+     * Establish a struct as the resource output, that is encoded with its schema without building a pson tree. The
+     * update function, if provided, is called with the struct before each output. The struct must outlive the
+     * resource.
+     */
+    template<class T, class F>
+    void set_output(const protoson::pson_schema<T>& schema, T& object, F update_function){
+        set_output(schema, object);
+        callback_.run = [update_function, &object](){ update_function(object); };
+    }
+
+    /**
+     * Establish a struct as the resource input, that is decoded with its schema without building a pson tree. The
+     * input function, if provided, is called with the struct after each input. The struct must outlive the
+     * resource.
+     */
+    template<class T, class F>
+    void set_input(const protoson::pson_schema<T>& schema, T& object, F in_function){
+        set_input(schema, object);
+        callback_.run = [in_function, &object](){ in_function(object); };
     }
 
 #else
@@ -274,6 +367,7 @@ public:
     void operator=(void (*run_function)()){
         io_type_ = run;
         callback_.run = run_function;
+        reset_input();
     }
 
     /**
@@ -282,6 +376,7 @@ public:
     void set_function(void (*run_function)()){
         io_type_ = run;
         callback_.run = run_function;
+        reset_input();
     }
 
     /**
@@ -290,6 +385,7 @@ public:
     void operator<<(void (*in_function)(protoson::pson& in)){
         io_type_ = pson_in;
         callback_.pson = in_function;
+        reset_input();
     }
 
     /**
@@ -298,6 +394,7 @@ public:
     void set_input(void (*in_function)(protoson::pson& in)){
         io_type_ = pson_in;
         callback_.pson = in_function;
+        reset_input();
     }
 
     /**
@@ -306,6 +403,7 @@ public:
     void operator>>(void (*out_function)(protoson::pson& out)){
         io_type_ = pson_out;
         callback_.pson = out_function;
+        reset_input();
     }
 
     /**
@@ -314,6 +412,7 @@ public:
     void set_output(void (*out_function)(protoson::pson& out)){
         io_type_ = pson_out;
         callback_.pson = out_function;
+        reset_input();
     }
 
     /**
@@ -322,6 +421,7 @@ public:
     void operator=(void (*pson_in_pson_out_function)(protoson::pson& in, protoson::pson& out)){
         io_type_ = pson_in_pson_out;
         callback_.pson_in_pson_out = pson_in_pson_out_function;
+        reset_input();
     }
 
     /**
@@ -330,10 +430,47 @@ public:
     void set_input_output(void (*pson_in_pson_out_function)(protoson::pson& in, protoson::pson& out)){
         io_type_ = pson_in_pson_out;
         callback_.pson_in_pson_out = pson_in_pson_out_function;
+        reset_input();
+    }
+
+    /**
+     * Establish a function with input parameters, that reads the encoded input in place without building a pson tree
+     */
+    void set_raw_input(void (*in_function)(protoson::pson_view& in)){
+        io_type_ = pson_in;
+        callback_.raw = in_function;
+        reset_input();
+        raw_input_ = true;
     }
 
 #endif
 
+    /**
+     * Establish a struct as the resource output, that is encoded with its schema without building a pson tree. The
+     * struct must outlive the resource.
+     */
+    template<class T>
+    void set_output(const protoson::pson_schema<T>& schema, T& object){
+        io_type_ = pson_out;
+        callback_.run = NULL;
+        schema_ = &schema;
+        object_ = &object;
+        raw_input_ = false;
+    }
+
+    /**
+     * Establish a struct as the resource input, that is decoded with its schema without building a pson tree. The
+     * struct must outlive the resource.
+     */
+    template<class T>
+    void set_input(const protoson::pson_schema<T>& schema, T& object){
+        io_type_ = pson_in;
+        callback_.run = NULL;
+        schema_ = &schema;
+        object_ = &object;
+        raw_input_ = false;
+    }
+
     /**
      * Handle a request and fill a possible response
      */
@@ -343,10 +480,23 @@ public:
             case thinger_message::NONE:
                 switch (io_type_){
                     case pson_in:
-                        callback_.pson(request);
+                        if(raw_input_){
+                            protoson::pson_view in;
+                            request.get_data(in);
+                            callback_.raw(in);
+                        }else if(schema_!=NULL){
+                            request.get_data(*schema_, object_);
+                            if(callback_.run) callback_.run();
+                        }else{
+                            callback_.pson(request);
+                        }
                         break;
                     case pson_out:
-                        callback_.pson(response);
+                        if(schema_!=NULL){
+                            fill_output(response);
+                        }else{
+                            callback_.pson(response);
+                        }
                         break;
                     case run:
                         callback_.run();
@@ -0,0 +1,156 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS S.L.
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef THINGER_RESOURCE_INDEX_HPP
+#define THINGER_RESOURCE_INDEX_HPP
+
+#include "pson.h"
+#include "thinger_map.hpp"
+#include "thinger_resource.hpp"
+
+#ifndef THINGER_RESOURCE_MAX_DEPTH
+    #define THINGER_RESOURCE_MAX_DEPTH 16
+#endif
+
+namespace thinger{
+
+    /**
+     * Hash index of all the resources in a resource tree, keyed by their full path, i.e., tire1/pressure, so a
+     * resource is found with a single lookup instead of searching each level by name. It is rebuilt when resources
+     * are added to any tree.
+     */
+    class thinger_resource_index {
+
+    public:
+        thinger_resource_index(protoson::memory_allocator& allocator) :
+            entries_(NULL), mask_(0), insertions_(0), allocator_(allocator)
+        {}
+
+        ~thinger_resource_index(){
+            allocator_.deallocate(entries_);
+        }
+
+        /**
+         * Rebuild the index if there are new resources since it was built
+         * @return false if there is no memory for the index
+         */
+        bool update(thinger_map<thinger_resource>& resources){
+            unsigned long insertions = thinger_map<thinger_resource>::get_insertions();
+            if(entries_!=NULL && insertions==insertions_) return true;
+            size_t count = count_resources(resources);
+            // keep the table at most half full, so probe sequences are short
+            size_t capacity = 8;
+            while(capacity < count*2) capacity *= 2;
+            if(capacity!=mask_+1 || entries_==NULL){
+                entry* entries = (entry*) allocator_.allocate(capacity*sizeof(entry));
+                if(entries==NULL) return false;
+                allocator_.deallocate(entries_);
+                entries_ = entries;
+                mask_ = capacity-1;
+            }
+            memset(entries_, 0, capacity*sizeof(entry));
+            add_resources(resources, NULL, hash_init, 1);
+            insertions_ = insertions;
+            return true;
+        }
+
+        /**
+         * Find a resource by its path
+         * @param path resource names from the root
+         * @param depth number of names in the path
+         * @return the resource, or NULL if it does not exist
+         */
+        thinger_resource* find(const char* const* path, size_t depth){
+            uint32_t hash = hash_init;
+            for(size_t i=0; i<depth; i++){
+                hash = hash_name(hash, path[i]);
+            }
+            for(size_t i=hash & mask_; entries_[i].resource!=NULL; i=(i+1) & mask_){
+                const entry& current = entries_[i];
+                if(current.hash==hash && current.depth==depth && matches(current, path)) return current.resource;
+            }
+            return NULL;
+        }
+
+    private:
+        struct entry{
+            thinger_resource* resource;
+            const entry* parent;
+            const char* key;
+            uint32_t hash;
+            uint32_t depth;
+        };
+
+        entry* entries_;
+        size_t mask_;
+        unsigned long insertions_;
+        protoson::memory_allocator& allocator_;
+
+        static const uint32_t hash_init = 2166136261U;
+
+        /**
+         * FNV-1a hash of a path, extended with a name and its terminator, so different paths do not produce the same
+         * byte sequence
+         */
+        static uint32_t hash_name(uint32_t hash, const char* name){
+            do{
+                hash = (hash ^ (uint8_t) *name) * 16777619U;
+            }while(*name++);
+            return hash;
+        }
+
+        static bool matches(const entry& found, const char* const* path){
+            const entry* current = &found;
+            for(size_t i=found.depth; i>0; i--, current=current->parent){
+                if(strcmp(current->key, path[i-1])!=0) return false;
+            }
+            return true;
+        }
+
+        static size_t count_resources(thinger_map<thinger_resource>& resources){
+            size_t count = 0;
+            for(thinger_map<thinger_resource>::entry* current = resources.begin(); current!=NULL; current = current->next_){
+                count += 1 + count_resources(current->value_.get_resources());
+            }
+            return count;
+        }
+
+        void add_resources(thinger_map<thinger_resource>& resources, const entry* parent, uint32_t parent_hash, uint32_t depth){
+            for(thinger_map<thinger_resource>::entry* current = resources.begin(); current!=NULL; current = current->next_){
+                uint32_t hash = hash_name(parent_hash, current->key_);
+                size_t i = hash & mask_;
+                while(entries_[i].resource!=NULL) i = (i+1) & mask_;
+                entry& added = entries_[i];
+                added.resource = &current->value_;
+                added.parent = parent;
+                added.key = current->key_;
+                added.hash = hash;
+                added.depth = depth;
+                add_resources(current->value_.get_resources(), &added, hash, depth+1);
+            }
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,196 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS S.L.
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef THINGER_STREAMS_HPP
+#define THINGER_STREAMS_HPP
+
+#include "pson.h"
+#include "thinger_resource.hpp"
+
+namespace thinger{
+
+    /**
+     * Schedule of the resources streamed periodically, kept as a min-heap ordered by their next sample deadline, so
+     * only the streams that are due are visited. Each sample is scheduled a whole number of intervals after the first
+     * one, so samples do not drift when they are handled late.
+     */
+    class thinger_streams {
+
+    public:
+        thinger_streams(protoson::memory_allocator& allocator) :
+            entries_(NULL), count_(0), capacity_(0), current_time_(0), timed_(false), allocator_(allocator)
+        {}
+
+        ~thinger_streams(){
+            allocator_.deallocate(entries_);
+        }
+
+        bool empty() const{
+            return count_==0;
+        }
+
+        /**
+         * Schedule the periodic samples of a resource after its stream is started. The first sample is due in the
+         * next call to next_due, and any previous schedule of the resource is discarded.
+         * @return false if there is no memory for the schedule
+         */
+        bool add(thinger_resource& resource){
+            if(count_==capacity_ && !grow()) return false;
+            entry& stream = entries_[count_];
+            stream.resource = &resource;
+            stream.schedule = resource.get_stream_schedule();
+            stream.deadline = current_time_;
+            stream.started = false;
+            sift_up(count_++);
+            return true;
+        }
+
+        /**
+         * Get a resource whose sample is due, scheduling its next sample
+         * @return the resource, or NULL if there are no samples due at the given time
+         */
+        thinger_resource* next_due(unsigned long current_time){
+            if(!timed_){
+                // streams added before knowing the time are due now
+                for(size_t i=0; i<count_; i++) entries_[i].deadline = current_time;
+                timed_ = true;
+            }
+            current_time_ = current_time;
+            while(count_>0){
+                entry& stream = entries_[0];
+                if(!valid(stream)){
+                    remove_first();
+                    continue;
+                }
+                // the difference is signed, so deadlines keep working when the time base wraps around
+                if((long)(current_time - stream.deadline) < 0) return NULL;
+                unsigned long interval = stream.resource->get_stream_interval();
+                if(!stream.started){
+                    // the first sample starts counting the intervals, whenever it is sent
+                    stream.deadline = current_time + interval;
+                    stream.started = true;
+                }else{
+                    // skip the samples that were missed, keeping the deadlines aligned with the interval
+                    stream.deadline += interval * ((current_time - stream.deadline) / interval + 1);
+                }
+                thinger_resource* resource = stream.resource;
+                sift_down(0);
+                return resource;
+            }
+            return NULL;
+        }
+
+        /**
+         * Deadline of the next sample, if any
+         * @return false if there are no streams scheduled
+         */
+        bool next_deadline(unsigned long& deadline){
+            while(count_>0 && !valid(entries_[0])){
+                remove_first();
+            }
+            if(count_==0) return false;
+            deadline = entries_[0].deadline;
+            return true;
+        }
+
+        /**
+         * Stop all the scheduled streams, i.e., when the connection is lost
+         */
+        void clear(){
+            for(size_t i=0; i<count_; i++){
+                if(valid(entries_[i])) entries_[i].resource->disable_streaming();
+            }
+            count_ = 0;
+        }
+
+    private:
+        struct entry{
+            thinger_resource* resource;
+            unsigned long deadline;
+            uint16_t schedule;
+            bool started;
+        };
+
+        entry* entries_;
+        size_t count_;
+        size_t capacity_;
+        // time of the last next_due call, when new streams are due
+        unsigned long current_time_;
+        bool timed_;
+        protoson::memory_allocator& allocator_;
+
+        /**
+         * A schedule is discarded when its stream was stopped, or started again with a new schedule
+         */
+        static bool valid(const entry& stream){
+            return stream.resource->get_stream_interval()>0 && stream.resource->get_stream_schedule()==stream.schedule;
+        }
+
+        static bool before(const entry& a, const entry& b){
+            return (long)(a.deadline - b.deadline) < 0;
+        }
+
+        bool grow(){
+            size_t capacity = capacity_>0 ? capacity_*2 : 4;
+            entry* entries = (entry*) allocator_.allocate(capacity*sizeof(entry));
+            if(entries==NULL) return false;
+            if(count_>0) memcpy(entries, entries_, count_*sizeof(entry));
+            allocator_.deallocate(entries_);
+            entries_ = entries;
+            capacity_ = capacity;
+            return true;
+        }
+
+        void remove_first(){
+            entries_[0] = entries_[--count_];
+            if(count_>0) sift_down(0);
+        }
+
+        void sift_up(size_t index){
+            entry stream = entries_[index];
+            while(index>0){
+                size_t parent = (index-1)/2;
+                if(!before(stream, entries_[parent])) break;
+                entries_[index] = entries_[parent];
+                index = parent;
+            }
+            entries_[index] = stream;
+        }
+
+        void sift_down(size_t index){
+            entry stream = entries_[index];
+            while(true){
+                size_t child = 2*index+1;
+                if(child>=count_) break;
+                if(child+1<count_ && before(entries_[child+1], entries_[child])) child++;
+                if(!before(entries_[child], stream)) break;
+                entries_[index] = entries_[child];
+                index = child;
+            }
+            entries_[index] = stream;
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,579 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS SL
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef PSON_JSON_H
+#define PSON_JSON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include "core/pson.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef PSON_JSON_MAX_DEPTH
+#define PSON_JSON_MAX_DEPTH 64
+#endif
+
+namespace protoson {
+
+    /**
+     * Find the first character of a JSON string that cannot be copied verbatim, i.e., a quote, a backslash or a
+     * control character. Checks 16 characters per step when SSE2 is available.
+     * @return pointer to the character found, or end if there is none
+     */
+    inline const char* json_string_run(const char* str, const char* end){
+#ifdef __SSE2__
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        while(end-str>=16){
+            __m128i chunk = _mm_loadu_si128((const __m128i*) str);
+            __m128i special = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                    _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+            int mask = _mm_movemask_epi8(special);
+            if(mask!=0) return str + __builtin_ctz(mask);
+            str += 16;
+        }
+#endif
+        while(str<end && *str!='"' && *str!='\\' && (uint8_t)*str>=0x20) str++;
+        return str;
+    }
+
+    /**
+     * Parser of JSON text that builds the pson value directly, in a single pass. Object members are appended
+     * in order without looking up previous keys, so duplicated keys are kept as they come.
+     */
+    class pson_json_decoder{
+    public:
+        pson_json_decoder() : start_(NULL), position_(NULL), end_(NULL), depth_(0){
+        }
+
+        /**
+         * Parse a JSON document, which must hold a single value, optionally surrounded by whitespace
+         * @return true if the document was valid and the value could be allocated
+         */
+        bool decode(const char* json, size_t size, pson& value){
+            start_ = position_ = json;
+            end_ = json + size;
+            depth_ = 0;
+            return parse_value(value) && (skip_whitespace(), position_==end_);
+        }
+
+        bool decode(const std::string& json, pson& value){
+            return decode(json.data(), json.size(), value);
+        }
+
+        /**
+         * Offset in the document where parsing stopped, useful for locating an error
+         */
+        size_t offset() const{
+            return position_ - start_;
+        }
+
+    private:
+        const char* start_;
+        const char* position_;
+        const char* end_;
+        uint16_t depth_;
+        std::string scratch_;
+
+        void skip_whitespace(){
+            while(position_<end_ && (*position_==' ' || *position_=='\n' || *position_=='\r' || *position_=='\t')){
+                position_++;
+            }
+        }
+
+        bool consume(char c){
+            skip_whitespace();
+            if(position_<end_ && *position_==c){
+                position_++;
+                return true;
+            }
+            return false;
+        }
+
+        bool parse_value(pson& value){
+            skip_whitespace();
+            if(position_==end_) return false;
+            switch(*position_){
+                case '{':
+                    return parse_object(value);
+                case '[':
+                    return parse_array(value);
+                case '"':
+                    return parse_string(value);
+                case 't':
+                    if(!parse_literal("true", 4)) return false;
+                    value = true;
+                    return true;
+                case 'f':
+                    if(!parse_literal("false", 5)) return false;
+                    value = false;
+                    return true;
+                case 'n':
+                    if(!parse_literal("null", 4)) return false;
+                    value.set_null();
+                    return true;
+                default:
+                    return parse_number(value);
+            }
+        }
+
+        bool parse_literal(const char* literal, size_t size){
+            if((size_t)(end_-position_)<size || memcmp(position_, literal, size)!=0) return false;
+            position_ += size;
+            return true;
+        }
+
+        bool parse_object(pson& value){
+            if(++depth_>PSON_JSON_MAX_DEPTH) return false;
+            position_++;
+            // replace any previous value, as the pson decoder does, instead of appending to it
+            value.set_null();
+            pson_object& object = value;
+            if(value.get_type()!=pson::object_field) return false;
+            if(!consume('}')){
+                do{
+                    skip_whitespace();
+                    const char* name;
+                    size_t size;
+                    if(position_==end_ || *position_!='"' || !parse_string(name, size)) return false;
+                    pson_pair* pair = object.create_item();
+                    if(pair==NULL || !pair->set_name(name, size)) return false;
+                    if(!consume(':') || !parse_value(pair->value())) return false;
+                }while(consume(','));
+                if(!consume('}')) return false;
+            }
+            depth_--;
+            return true;
+        }
+
+        bool parse_array(pson& value){
+            if(++depth_>PSON_JSON_MAX_DEPTH) return false;
+            position_++;
+            value.set_null();
+            pson_array& array = value;
+            if(value.get_type()!=pson::array_field) return false;
+            if(!consume(']')){
+                do{
+                    pson* item = array.create_item();
+                    if(item==NULL || !parse_value(*item)) return false;
+                }while(consume(','));
+                if(!consume(']')) return false;
+            }
+            depth_--;
+            return true;
+        }
+
+        bool parse_string(pson& value){
+            const char* str;
+            size_t size;
+            if(!parse_string(str, size)) return false;
+            if(size==0){
+                value = "";
+            }else if(char* destination = value.allocate_string(size)){
+                memcpy(destination, str, size);
+            }else{
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * Parse the string at the current position. Strings without escapes are returned in place, other ones
+         * are unescaped into the scratch buffer, which is valid until the next string is parsed.
+         */
+        bool parse_string(const char*& str, size_t& size){
+            const char* begin = ++position_;
+            position_ = json_string_run(position_, end_);
+            if(position_<end_ && *position_=='"'){
+                str = begin;
+                size = position_++ - begin;
+                return true;
+            }
+            scratch_.assign(begin, position_);
+            while(position_<end_){
+                char c = *position_;
+                if(c=='"'){
+                    position_++;
+                    str = scratch_.data();
+                    size = scratch_.size();
+                    return true;
+                }else if(c=='\\'){
+                    if(!parse_escape()) return false;
+                }else if((uint8_t)c<0x20){
+                    return false;
+                }else{
+                    const char* run = json_string_run(position_, end_);
+                    scratch_.append(position_, run);
+                    position_ = run;
+                }
+            }
+            return false;
+        }
+
+        bool parse_escape(){
+            if(end_-position_<2) return false;
+            char c = position_[1];
+            position_ += 2;
+            switch(c){
+                case '"': scratch_ += '"'; return true;
+                case '\\': scratch_ += '\\'; return true;
+                case '/': scratch_ += '/'; return true;
+                case 'b': scratch_ += '\b'; return true;
+                case 'f': scratch_ += '\f'; return true;
+                case 'n': scratch_ += '\n'; return true;
+                case 'r': scratch_ += '\r'; return true;
+                case 't': scratch_ += '\t'; return true;
+                case 'u': break;
+                default: return false;
+            }
+            uint32_t code;
+            if(!parse_hex(code)) return false;
+            if(code>=0xD800 && code<=0xDBFF){
+                // a high surrogate must be followed by the escaped low surrogate
+                uint32_t low;
+                if(end_-position_<2 || position_[0]!='\\' || position_[1]!='u') return false;
+                position_ += 2;
+                if(!parse_hex(low) || low<0xDC00 || low>0xDFFF) return false;
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            }else if(code>=0xDC00 && code<=0xDFFF){
+                return false;
+            }
+            if(code<0x80){
+                scratch_ += (char) code;
+            }else if(code<0x800){
+                scratch_ += (char) (0xC0 | (code >> 6));
+                scratch_ += (char) (0x80 | (code & 0x3F));
+            }else if(code<0x10000){
+                scratch_ += (char) (0xE0 | (code >> 12));
+                scratch_ += (char) (0x80 | ((code >> 6) & 0x3F));
+                scratch_ += (char) (0x80 | (code & 0x3F));
+            }else{
+                scratch_ += (char) (0xF0 | (code >> 18));
+                scratch_ += (char) (0x80 | ((code >> 12) & 0x3F));
+                scratch_ += (char) (0x80 | ((code >> 6) & 0x3F));
+                scratch_ += (char) (0x80 | (code & 0x3F));
+            }
+            return true;
+        }
+
+        bool parse_hex(uint32_t& code){
+            if(end_-position_<4) return false;
+            code = 0;
+            for(uint8_t i=0; i<4; i++){
+                char c = *position_++;
+                code <<= 4;
+                if(c>='0' && c<='9') code |= c - '0';
+                else if(c>='a' && c<='f') code |= c - 'a' + 10;
+                else if(c>='A' && c<='F') code |= c - 'A' + 10;
+                else return false;
+            }
+            return true;
+        }
+
+        /**
+         * Parse a number. Integers that fit in 64 bits are accumulated directly as varints, while fractions,
+         * exponents and larger integers are converted with strtod.
+         */
+        bool parse_number(pson& value){
+            const char* begin = position_;
+            bool negative = position_<end_ && *position_=='-';
+            if(negative) position_++;
+            const char* digits = position_;
+            uint64_t integer = 0;
+            bool overflow = false;
+            while(position_<end_ && *position_>='0' && *position_<='9'){
+                uint8_t digit = *position_++ - '0';
+                overflow |= integer > (UINT64_MAX - digit) / 10;
+                integer = integer * 10 + digit;
+            }
+            size_t count = position_ - digits;
+            if(count==0 || (count>1 && *digits=='0')) return false;
+            bool fraction = false;
+            if(position_<end_ && *position_=='.'){
+                fraction = true;
+                const char* decimals = ++position_;
+                while(position_<end_ && *position_>='0' && *position_<='9') position_++;
+                if(position_==decimals) return false;
+            }
+            if(position_<end_ && (*position_=='e' || *position_=='E')){
+                fraction = true;
+                if(++position_<end_ && (*position_=='+' || *position_=='-')) position_++;
+                const char* exponent = position_;
+                while(position_<end_ && *position_>='0' && *position_<='9') position_++;
+                if(position_==exponent) return false;
+            }
+            if(!fraction && !overflow){
+                if(integer==0 || (integer==1 && !negative)){
+                    value = (uint8_t) integer;
+                }else{
+                    value.set_varint(integer, negative);
+                }
+                return true;
+            }
+            // strtod requires a null terminated number, and the document may not be
+            char number[64];
+            size_t size = position_ - begin;
+            if(size>=sizeof(number)){
+                scratch_.assign(begin, size);
+                value = strtod(scratch_.c_str(), NULL);
+            }else{
+                memcpy(number, begin, size);
+                number[size] = 0;
+                value = strtod(number, NULL);
+            }
+            return true;
+        }
+    };
+
+    /**
+     * Writer of JSON text straight from encoded pson, without building the pson value. Bytes are written as
+     * base64 strings, and non finite numbers as null.
+     */
+    class pson_json_encoder{
+    public:
+        pson_json_encoder() : position_(NULL), end_(NULL), depth_(0), json_(NULL){
+        }
+
+        /**
+         * Append the JSON text of the pson value encoded in the buffer
+         * @return true if the buffer holds a single valid pson value
+         */
+        bool encode(const uint8_t* buffer, size_t size, std::string& json){
+            position_ = buffer;
+            end_ = buffer + size;
+            depth_ = 0;
+            json_ = &json;
+            return write_value() && position_==end_;
+        }
+
+    private:
+        const uint8_t* position_;
+        const uint8_t* end_;
+        uint16_t depth_;
+        std::string* json_;
+
+        bool read_varint(uint64_t& value){
+            uint8_t size = pson_varint_decode(position_, end_-position_, value);
+            position_ += size;
+            return size>0;
+        }
+
+        bool read_length(const uint8_t*& data, uint64_t& size){
+            if(!read_varint(size) || size>(uint64_t)(end_-position_)) return false;
+            data = position_;
+            position_ += size;
+            return true;
+        }
+
+        bool write_value(){
+            uint64_t tag;
+            if(!read_varint(tag)) return false;
+            uint64_t value;
+            const uint8_t* data;
+            switch(tag >> 3){
+                case pson::varint_field:
+                case pson::svarint_field:
+                    if(!read_varint(value)) return false;
+                    write_integer(value, (tag >> 3)==pson::svarint_field);
+                    return true;
+                case pson::float_field: {
+                    float number;
+                    if((size_t)(end_-position_)<sizeof(number)) return false;
+                    memcpy(&number, position_, sizeof(number));
+                    position_ += sizeof(number);
+                    write_number(number, true);
+                    return true;
+                }
+                case pson::double_field: {
+                    double number;
+                    if((size_t)(end_-position_)<sizeof(number)) return false;
+                    memcpy(&number, position_, sizeof(number));
+                    position_ += sizeof(number);
+                    write_number(number, false);
+                    return true;
+                }
+                case pson::true_field:
+                    json_->append("true", 4);
+                    return true;
+                case pson::false_field:
+                    json_->append("false", 5);
+                    return true;
+                case pson::zero_field:
+                    *json_ += '0';
+                    return true;
+                case pson::one_field:
+                    *json_ += '1';
+                    return true;
+                case pson::empty_string:
+                case pson::empty_bytes:
+                    json_->append("\"\"", 2);
+                    return true;
+                case pson::null_field:
+                case pson::empty:
+                    json_->append("null", 4);
+                    return true;
+                case pson::string_field:
+                    if(!read_length(data, value)) return false;
+                    write_string((const char*) data, value);
+                    return true;
+                case pson::bytes_field:
+                    if(!read_length(data, value)) return false;
+                    write_base64(data, value);
+                    return true;
+                case pson::object_field:
+                    return write_object();
+                case pson::array_field:
+                    return write_array();
+                default:
+                    return false;
+            }
+        }
+
+        bool write_object(){
+            const uint8_t* data;
+            uint64_t size;
+            if(++depth_>PSON_JSON_MAX_DEPTH || !read_length(data, size)) return false;
+            const uint8_t* end = end_;
+            position_ = data;
+            end_ = data + size;
+            *json_ += '{';
+            while(position_<end_){
+                const uint8_t* name;
+                uint64_t name_size;
+                if(position_!=data) *json_ += ',';
+                if(!read_length(name, name_size)) return false;
+                write_string((const char*) name, name_size);
+                *json_ += ':';
+                if(!write_value()) return false;
+            }
+            *json_ += '}';
+            end_ = end;
+            depth_--;
+            return true;
+        }
+
+        bool write_array(){
+            const uint8_t* data;
+            uint64_t size;
+            if(++depth_>PSON_JSON_MAX_DEPTH || !read_length(data, size)) return false;
+            const uint8_t* end = end_;
+            position_ = data;
+            end_ = data + size;
+            *json_ += '[';
+            while(position_<end_){
+                if(position_!=data) *json_ += ',';
+                if(!write_value()) return false;
+            }
+            *json_ += ']';
+            end_ = end;
+            depth_--;
+            return true;
+        }
+
+        void write_integer(uint64_t value, bool negative){
+            char digits[21];
+            char* digit = digits + sizeof(digits);
+            do{
+                *--digit = '0' + value % 10;
+                value /= 10;
+            }while(value>0);
+            if(negative) *--digit = '-';
+            json_->append(digit, digits + sizeof(digits) - digit);
+        }
+
+        /**
+         * Write the shortest decimal representation that reads back as the same float or double
+         */
+        void write_number(double value, bool single){
+            if(!isfinite(value)){
+                json_->append("null", 4);
+                return;
+            }
+            char number[32];
+            int size = 0;
+            for(int precision = single ? 6 : 15; precision <= (single ? 9 : 17); precision++){
+                size = snprintf(number, sizeof(number), "%.*g", precision, value);
+                if(single ? strtof(number, NULL)==(float)value : strtod(number, NULL)==value) break;
+            }
+            json_->append(number, size);
+        }
+
+        void write_string(const char* str, size_t size){
+            static const char hex[] = "0123456789abcdef";
+            const char* end = str + size;
+            *json_ += '"';
+            while(str<end){
+                const char* run = json_string_run(str, end);
+                json_->append(str, run);
+                if(run==end) break;
+                char c = *run;
+                switch(c){
+                    case '"': json_->append("\\\"", 2); break;
+                    case '\\': json_->append("\\\\", 2); break;
+                    case '\n': json_->append("\\n", 2); break;
+                    case '\r': json_->append("\\r", 2); break;
+                    case '\t': json_->append("\\t", 2); break;
+                    case '\b': json_->append("\\b", 2); break;
+                    case '\f': json_->append("\\f", 2); break;
+                    default: {
+                        char escape[6] = {'\\', 'u', '0', '0', hex[(uint8_t) c >> 4], hex[c & 0xF]};
+                        json_->append(escape, sizeof(escape));
+                    }
+                }
+                str = run + 1;
+            }
+            *json_ += '"';
+        }
+
+        void write_base64(const uint8_t* data, size_t size){
+            static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            json_->reserve(json_->size() + (size + 2) / 3 * 4 + 2);
+            *json_ += '"';
+            size_t i = 0;
+            for(; i+3<=size; i+=3){
+                uint32_t group = (data[i] << 16) | (data[i+1] << 8) | data[i+2];
+                char encoded[4] = {alphabet[group >> 18], alphabet[(group >> 12) & 0x3F],
+                                   alphabet[(group >> 6) & 0x3F], alphabet[group & 0x3F]};
+                json_->append(encoded, 4);
+            }
+            if(i<size){
+                uint32_t group = data[i] << 16;
+                if(i+1<size) group |= data[i+1] << 8;
+                char encoded[4] = {alphabet[group >> 18], alphabet[(group >> 12) & 0x3F],
+                                   i+1<size ? alphabet[(group >> 6) & 0x3F] : '=', '='};
+                json_->append(encoded, 4);
+            }
+            *json_ += '"';
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,431 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS SL
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef SLAB_MEMORY_ALLOCATOR_H
+#define SLAB_MEMORY_ALLOCATOR_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include "core/pson.h"
+
+namespace protoson {
+
+    /**
+     * Thread safe allocator that serves small objects from fixed size classes carved out of aligned memory chunks.
+     * Each thread keeps its own cache of free objects, so most allocations and deallocations do not require any
+     * synchronization. Objects released in excess by a thread are returned to a lock-free list shared by all threads.
+     * Objects bigger than the biggest size class are served by malloc.
+     *
+     * Objects are aligned to the biggest power of two dividing their class size, up to alignof(max_align_t), so the
+     * 24 and 40 byte classes are only 8 byte aligned. This is enough for any type fitting in the requested size, as
+     * the size of a type is always a multiple of its alignment, but not for over-aligned buffers of arbitrary size.
+     *
+     * Releasing a pointer that was not allocated here, or releasing a big object twice, is detected and counted in
+     * the invalid deallocations, without touching the memory. Double frees of small objects are not detected.
+     */
+    class slab_memory_allocator : public memory_allocator{
+    public:
+        // size classes tuned to pson nodes (pson, pson_pair, containers, and their first item blocks) and small values
+        static const size_t classes = 9;
+        static const size_t max_object_size = 128;
+        static const size_t chunk_size = 64*1024;
+        static const size_t max_chunks = 1024;
+
+        struct statistics{
+            size_t object_size;
+            size_t chunks;
+            size_t in_use;
+            size_t high_water;
+        };
+
+    private:
+        static const size_t chunk_header = 16;
+        static_assert(chunk_header % alignof(max_align_t) == 0, "chunk objects must keep the chunk alignment");
+        static const size_t cache_batch = 32;
+        static const size_t publish_batch = 8;
+        static const size_t cache_slots = 4;
+        static const size_t registry_size = max_chunks*2;
+
+        struct free_object{
+            free_object* next_;
+        };
+
+        struct size_class{
+            std::atomic<free_object*> free_;
+            std::atomic<long> in_use_;
+            std::atomic<long> high_water_;
+            std::atomic<size_t> chunks_;
+            // chunk currently being carved (guarded by the allocator mutex)
+            uint8_t* carve_;
+            uint8_t* carve_end_;
+        };
+
+        struct thread_cache{
+            uint64_t owner_;
+            free_object* free_[classes];
+            size_t count_[classes];
+            // allocations minus deallocations not yet published in the class statistics
+            long balance_[classes];
+        };
+
+        struct thread_caches{
+            thread_cache caches_[cache_slots];
+
+            thread_caches(){
+                memset(caches_, 0, sizeof(caches_));
+            }
+
+            ~thread_caches(){
+                for(size_t i=0; i<cache_slots; i++){
+                    release(caches_[i]);
+                }
+            }
+        };
+
+        uint64_t id_;
+        std::mutex mutex_;
+        size_class classes_[classes];
+        std::atomic<uintptr_t> registry_[registry_size];
+        std::atomic<size_t> chunks_;
+        std::atomic<long> large_in_use_;
+        std::atomic<long> large_high_water_;
+        std::atomic<size_t> invalid_deallocations_;
+        // objects served by malloc, so foreign pointers and double frees are not mistaken for them
+        std::mutex large_mutex_;
+        std::unordered_set<void*> large_;
+
+        static size_t object_size(size_t index){
+            static const size_t sizes[classes] = {8, 16, 24, 32, 40, 48, 64, 96, 128};
+            return sizes[index];
+        }
+
+        static size_t class_index(size_t size){
+            static const uint8_t indexes[max_object_size/8 + 1] = {0, 0, 1, 2, 3, 4, 5, 6, 6, 7, 7, 7, 7, 8, 8, 8, 8};
+            return indexes[(size + 7) >> 3];
+        }
+
+        static void update_high_water(std::atomic<long>& high_water, long value){
+            long current = high_water.load(std::memory_order_relaxed);
+            while(value>current && !high_water.compare_exchange_weak(current, value, std::memory_order_relaxed)){}
+        }
+
+        static std::mutex& live_mutex(){
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        static std::vector<slab_memory_allocator*>& live_allocators(){
+            static std::vector<slab_memory_allocator*> allocators;
+            return allocators;
+        }
+
+        static thread_caches& local_caches(){
+            static thread_local thread_caches caches;
+            return caches;
+        }
+
+        /**
+         * Return the cache objects to its allocator, if it is still alive
+         */
+        static void release(thread_cache& cache){
+            if(cache.owner_==0) return;
+            std::lock_guard<std::mutex> lock(live_mutex());
+            std::vector<slab_memory_allocator*>& allocators = live_allocators();
+            for(size_t i=0; i<allocators.size(); i++){
+                if(allocators[i]->id_==cache.owner_){
+                    for(size_t index=0; index<classes; index++){
+                        allocators[i]->flush(cache, index, cache.count_[index]);
+                    }
+                    break;
+                }
+            }
+            memset(&cache, 0, sizeof(thread_cache));
+        }
+
+        thread_cache& get_cache(){
+            thread_caches& caches = local_caches();
+            for(size_t i=0; i<cache_slots; i++){
+                if(caches.caches_[i].owner_==id_) return caches.caches_[i];
+            }
+            for(size_t i=0; i<cache_slots; i++){
+                if(caches.caches_[i].owner_==0){
+                    caches.caches_[i].owner_ = id_;
+                    return caches.caches_[i];
+                }
+            }
+            // all slots in use by other allocators, so evict the last one
+            thread_cache& cache = caches.caches_[cache_slots-1];
+            release(cache);
+            cache.owner_ = id_;
+            return cache;
+        }
+
+        static size_t registry_slot(uintptr_t chunk){
+            return (size_t)((chunk / chunk_size) * 2654435761u) % registry_size;
+        }
+
+        uint8_t* find_chunk(const void* ptr){
+            uintptr_t chunk = (uintptr_t) ptr & ~(uintptr_t)(chunk_size-1);
+            for(size_t slot = registry_slot(chunk);; slot = (slot + 1) % registry_size){
+                uintptr_t current = registry_[slot].load(std::memory_order_acquire);
+                if(current==chunk) return (uint8_t*) chunk;
+                if(current==0) return NULL;
+            }
+        }
+
+        // must be called with the allocator mutex held
+        uint8_t* new_chunk(size_t index){
+            if(chunks_.load(std::memory_order_relaxed)>=max_chunks) return NULL;
+            void* memory = NULL;
+            if(posix_memalign(&memory, chunk_size, chunk_size)!=0) return NULL;
+            uint8_t* chunk = (uint8_t*) memory;
+            chunk[0] = (uint8_t) index;
+            size_t slot = registry_slot((uintptr_t) chunk);
+            while(registry_[slot].load(std::memory_order_relaxed)!=0) slot = (slot + 1) % registry_size;
+            registry_[slot].store((uintptr_t) chunk, std::memory_order_release);
+            chunks_.fetch_add(1, std::memory_order_relaxed);
+            classes_[index].chunks_.fetch_add(1, std::memory_order_relaxed);
+            return chunk;
+        }
+
+        /**
+         * Fill the thread cache with objects released by other threads, or with new objects carved from a chunk
+         */
+        bool refill(thread_cache& cache, size_t index){
+            size_class& sc = classes_[index];
+            free_object* list = sc.free_.exchange(NULL, std::memory_order_acquire);
+            if(list==NULL){
+                size_t size = object_size(index);
+                std::lock_guard<std::mutex> lock(mutex_);
+                for(size_t i=0; i<cache_batch; i++){
+                    if(sc.carve_==NULL || sc.carve_+size>sc.carve_end_){
+                        uint8_t* chunk = new_chunk(index);
+                        if(chunk==NULL) break;
+                        sc.carve_ = chunk + chunk_header;
+                        sc.carve_end_ = chunk + chunk_size;
+                    }
+                    free_object* object = (free_object*) sc.carve_;
+                    sc.carve_ += size;
+                    object->next_ = list;
+                    list = object;
+                }
+                if(list==NULL) return false;
+            }
+            size_t count = 0;
+            free_object* last = list;
+            for(free_object* current = list; current!=NULL; current = current->next_){
+                last = current;
+                count++;
+            }
+            last->next_ = cache.free_[index];
+            cache.free_[index] = list;
+            cache.count_[index] += count;
+            publish(cache, index);
+            return true;
+        }
+
+        /**
+         * Move the given number of objects from the thread cache to the shared free list of the class
+         */
+        void flush(thread_cache& cache, size_t index, size_t count){
+            publish(cache, index);
+            if(count==0 || cache.free_[index]==NULL) return;
+            free_object* first = cache.free_[index];
+            free_object* last = first;
+            size_t moved = 1;
+            while(moved<count && last->next_!=NULL){
+                last = last->next_;
+                moved++;
+            }
+            cache.free_[index] = last->next_;
+            cache.count_[index] -= moved;
+            size_class& sc = classes_[index];
+            free_object* head = sc.free_.load(std::memory_order_relaxed);
+            do{
+                last->next_ = head;
+            }while(!sc.free_.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        void publish(thread_cache& cache, size_t index){
+            if(cache.balance_[index]==0) return;
+            size_class& sc = classes_[index];
+            long in_use = sc.in_use_.fetch_add(cache.balance_[index], std::memory_order_relaxed) + cache.balance_[index];
+            update_high_water(sc.high_water_, in_use);
+            cache.balance_[index] = 0;
+        }
+
+        static uint64_t next_id(){
+            static std::atomic<uint64_t> id(0);
+            return ++id;
+        }
+
+    public:
+        slab_memory_allocator() : id_(next_id()), chunks_(0), large_in_use_(0), large_high_water_(0),
+            invalid_deallocations_(0){
+            for(size_t i=0; i<classes; i++){
+                classes_[i].free_.store(NULL);
+                classes_[i].in_use_.store(0);
+                classes_[i].high_water_.store(0);
+                classes_[i].chunks_.store(0);
+                classes_[i].carve_ = NULL;
+                classes_[i].carve_end_ = NULL;
+            }
+            for(size_t i=0; i<registry_size; i++){
+                registry_[i].store(0);
+            }
+            std::lock_guard<std::mutex> lock(live_mutex());
+            live_allocators().push_back(this);
+        }
+
+        /**
+         * Release all the memory chunks. No thread may be using the allocator at this point.
+         */
+        virtual ~slab_memory_allocator(){
+            {
+                std::lock_guard<std::mutex> lock(live_mutex());
+                std::vector<slab_memory_allocator*>& allocators = live_allocators();
+                for(size_t i=0; i<allocators.size(); i++){
+                    if(allocators[i]==this){
+                        allocators.erase(allocators.begin()+i);
+                        break;
+                    }
+                }
+            }
+            // drop the cache of the current thread, as its objects are about to be released
+            thread_caches& caches = local_caches();
+            for(size_t i=0; i<cache_slots; i++){
+                if(caches.caches_[i].owner_==id_) memset(&caches.caches_[i], 0, sizeof(thread_cache));
+            }
+            for(size_t i=0; i<registry_size; i++){
+                uintptr_t chunk = registry_[i].load();
+                if(chunk!=0) free((void*) chunk);
+            }
+            for(std::unordered_set<void*>::iterator it=large_.begin(); it!=large_.end(); ++it){
+                free(*it);
+            }
+        }
+
+        using memory_allocator::allocate;
+
+        virtual void *allocate(size_t size) {
+            if(size<=max_object_size){
+                size_t index = class_index(size);
+                thread_cache& cache = get_cache();
+                if(cache.free_[index]!=NULL || refill(cache, index)){
+                    free_object* object = cache.free_[index];
+                    cache.free_[index] = object->next_;
+                    cache.count_[index]--;
+                    if(++cache.balance_[index]>=(long)publish_batch) publish(cache, index);
+                    return object;
+                }
+            }
+            // big objects, or chunks exhausted
+            void* memory = malloc(size);
+            if(memory!=NULL){
+                {
+                    std::lock_guard<std::mutex> lock(large_mutex_);
+                    large_.insert(memory);
+                }
+                update_high_water(large_high_water_, large_in_use_.fetch_add(1, std::memory_order_relaxed) + 1);
+            }
+            return memory;
+        }
+
+        virtual void deallocate(void *ptr) {
+            if(ptr==NULL) return;
+            uint8_t* chunk = find_chunk(ptr);
+            if(chunk==NULL){
+                {
+                    std::lock_guard<std::mutex> lock(large_mutex_);
+                    if(large_.erase(ptr)==0){
+                        invalid_deallocations_.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    }
+                }
+                large_in_use_.fetch_sub(1, std::memory_order_relaxed);
+                free(ptr);
+                return;
+            }
+            size_t index = chunk[0];
+            thread_cache& cache = get_cache();
+            free_object* object = (free_object*) ptr;
+            object->next_ = cache.free_[index];
+            cache.free_[index] = object;
+            cache.count_[index]++;
+            if(--cache.balance_[index]<=-(long)publish_batch) publish(cache, index);
+            // keep the thread cache bounded
+            if(cache.count_[index]>=cache_batch*4){
+                flush(cache, index, cache_batch*2);
+            }
+        }
+
+        /**
+         * Get the usage statistics of a size class. Object counts are updated by each thread in batches, so they may
+         * lag behind the real usage by up to publish_batch objects per thread.
+         */
+        statistics get_statistics(size_t index){
+            statistics stats;
+            size_class& sc = classes_[index];
+            long in_use = sc.in_use_.load(std::memory_order_relaxed);
+            stats.object_size = object_size(index);
+            stats.chunks = sc.chunks_.load(std::memory_order_relaxed);
+            stats.in_use = in_use > 0 ? (size_t) in_use : 0;
+            stats.high_water = (size_t) sc.high_water_.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        /**
+         * Get the usage statistics of the objects served by malloc (object_size is 0 as they are not sized)
+         */
+        statistics get_large_statistics(){
+            statistics stats;
+            long in_use = large_in_use_.load(std::memory_order_relaxed);
+            stats.object_size = 0;
+            stats.chunks = 0;
+            stats.in_use = in_use > 0 ? (size_t) in_use : 0;
+            stats.high_water = (size_t) large_high_water_.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        /**
+         * Number of deallocations of pointers that were not allocated here or were already released, which are ignored
+         */
+        size_t get_invalid_deallocations(){
+            return invalid_deallocations_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Bytes reserved by the allocator for serving small objects
+         */
+        size_t reserved_bytes(){
+            return chunks_.load(std::memory_order_relaxed) * chunk_size;
+        }
+    };
+
+}
+
+#endif
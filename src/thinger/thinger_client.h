@@ -32,20 +32,36 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <unistd.h>
+
+#ifdef THINGER_SLAB_ALLOCATOR
+    #define PSON_CUSTOM_DEFAULT_ALLOCATOR
+#endif
+
 #include "core/thinger.h"
 
-using namespace protoson;
+#ifdef THINGER_SLAB_ALLOCATOR
+    #include "slab_memory_allocator.h"
 
-dynamic_memory_allocator alloc;
-memory_allocator& protoson::pool = alloc;
+    inline protoson::memory_allocator& protoson::default_allocator(){
+        static slab_memory_allocator allocator;
+        return allocator;
+    }
+#endif
+
+using namespace protoson;
+using thinger::thinger_io_span;
+using thinger::thinger_io_buffer;
 
 #ifndef THINGER_SERVER
     #define THINGER_SERVER "iot.thinger.io"
@@ -59,6 +75,22 @@ memory_allocator& protoson::pool = alloc;
     #define RECONNECTION_TIMEOUT_SECONDS 15
 #endif
 
+#ifndef THINGER_INPUT_BUFFER_SIZE
+    #define THINGER_INPUT_BUFFER_SIZE 4096
+#endif
+
+#ifndef THINGER_COALESCE_SIZE
+    #define THINGER_COALESCE_SIZE 1400
+#endif
+
+#ifndef THINGER_COALESCE_MILLIS
+    #define THINGER_COALESCE_MILLIS 10
+#endif
+
+#ifndef THINGER_IOV_SIZE
+    #define THINGER_IOV_SIZE 16
+#endif
+
 
 class thinger_client : public thinger::thinger {
 
@@ -80,10 +112,27 @@ public:
         THINGER_STOP_REQUEST
     };
 
-    thinger_client(const char* user, const char* device, const char* device_credential, const char* thinger_server = THINGER_SERVER) :
-      sockfd(-1), username_(user), device_id_(device), device_password_(device_credential), thinger_server_(thinger_server),
-      out_buffer_(NULL), out_size_(0), buffer_size_(0)
+    /**
+     * Counters of the socket operations, to compare the read requests issued by the decoder with the actual
+     * socket reads (or SSL reads) required to serve them, and the written messages with the socket writes (each
+     * one sent with TCP_NODELAY, so it roughly matches the sent packets). Counted since start_millis.
+     */
+    struct io_statistics{
+        unsigned long read_requests;
+        unsigned long read_calls;
+        unsigned long write_requests;
+        unsigned long write_calls;
+        unsigned long bytes_read;
+        unsigned long bytes_written;
+        unsigned long start_millis;
+    };
+
+    thinger_client(const char* user, const char* device, const char* device_credential, const char* thinger_server = THINGER_SERVER,
+                   memory_allocator& allocator = default_allocator()) :
+      thinger::thinger(allocator), sockfd(-1), username_(user), device_id_(device), device_password_(device_credential), thinger_server_(thinger_server),
+      out_size_(0), out_since_(0), coalesce_millis_(THINGER_COALESCE_MILLIS), in_start_(0), in_end_(0), readable_(false), io_stats_()
     {
+        io_stats_.start_millis = millis();
         #if DAEMON
           daemonize();
         #endif
@@ -121,35 +170,82 @@ protected:
             thinger_state_listener(SOCKET_DISCONNECTED);
         }
         sockfd = -1;
+        // discard any input or output from the previous connection
+        in_start_ = in_end_ = 0;
+        out_size_ = 0;
     }
 
+    /**
+     * Serve the requested bytes from the input buffer, that is filled with reads as large as the available data, so
+     * the decoder can read the message byte by byte without issuing a socket read for each one
+     */
     virtual bool read(char* buffer, size_t size){
-        if(sockfd==-1) return false;
-        ssize_t read_size = ::read(sockfd, buffer, size);
-        if(read_size!=size){
-            disconnected();
+        while(size>0){
+            size_t read_size = 0;
+            if(!read_some(buffer, size, read_size, true)) return false;
+            buffer += read_size;
+            size -= read_size;
+        }
+        return true;
+    }
+
+    /**
+     * Serve the available bytes from the input buffer, refilling it from the socket only if it can be read without
+     * blocking, or if waiting is allowed
+     */
+    virtual bool read_some(char* buffer, size_t size, size_t& bytes_read, bool wait=false){
+        io_stats_.read_requests++;
+        bytes_read = 0;
+        if(size==0) return true;
+        if(in_start_==in_end_){
+            if(!wait && !socket_readable()) return true;
+            in_start_ = in_end_ = 0;
+            // large reads go straight to the destination buffer
+            bool direct = size >= THINGER_INPUT_BUFFER_SIZE;
+            ssize_t read_size = receive(direct ? (uint8_t*) buffer : in_buffer_, direct ? size : THINGER_INPUT_BUFFER_SIZE);
+            if(read_size<=0){
+                disconnected();
+                return false;
+            }
+            if(direct){
+                bytes_read = read_size;
+                return true;
+            }
+            in_end_ = read_size;
         }
-        return read_size == size;
+        size_t available = in_end_ - in_start_;
+        bytes_read = size < available ? size : available;
+        memcpy(buffer, &in_buffer_[in_start_], bytes_read);
+        in_start_ += bytes_read;
+        return true;
+    }
+
+    /**
+     * @return true if there is received data pending to be decoded
+     */
+    virtual bool input_pending(){
+        return in_start_!=in_end_;
     }
 
     virtual bool write(const char* buffer, size_t size, bool flush=false){
         if(size>0){
-            if(size+out_size_>buffer_size_){
-                buffer_size_ = out_size_ + size;
-                out_buffer_ = (uint8_t*) realloc(out_buffer_, buffer_size_);
-            }
-            memcpy(&out_buffer_[out_size_], buffer, size);
-            out_size_ += size;
+            io_stats_.write_requests++;
+            if(!append(buffer, size)) return false;
         }
-        if(flush && out_size_>0){
-            bool success = to_socket(out_buffer_, out_size_);
-            out_size_ = 0;
-            if(!success){
-                disconnected();
-            }
-            return success;
+        return !(flush || output_due()) || flush_output(NULL, 0);
+    }
+
+    /**
+     * Write the given spans. When flushing, they are sent after the buffered data with a single scatter-gather
+     * write, so they are not copied to the output buffer.
+     */
+    virtual bool writev(const thinger_io_span* spans, size_t count, bool flush=false){
+        io_stats_.write_requests++;
+        if(flush) return flush_output(spans, count);
+        for(size_t i=0; i<count; i++){
+            if(!append(spans[i].data, spans[i].size)) return false;
         }
-        return true;
+        return !output_due() || flush_output(NULL, 0);
     }
 
     virtual void thinger_state_listener(THINGER_STATE state){
@@ -329,21 +425,34 @@ public:
 
     void handle(){
         if(handle_connection()){
+            // decode any buffered message before waiting for the socket
+            if(input_pending()){
+                thinger::thinger::handle(millis(), true);
+                return;
+            }
+
             fd_set rfds;
             struct timeval tv;
 
             FD_ZERO(&rfds);
             FD_SET(sockfd, &rfds);
 
-            tv.tv_sec = 1;
-            tv.tv_usec = 0;
+            // wait for input until the next stream sample or timeout is due (at most one second)
+            long wait = (long)(next_deadline() - millis());
+            if(wait<0) wait = 0;
+            if(wait>1000) wait = 1000;
+            tv.tv_sec = wait / 1000;
+            tv.tv_usec = (wait % 1000) * 1000;
 
             int retval = select(sockfd+1, &rfds, NULL, NULL, &tv);
             if (retval == -1){
                 disconnected();
             } else {
                 bool data_available = retval>0 && FD_ISSET(sockfd, &rfds);
+                // the first socket read does not need to check again if it would block
+                readable_ = data_available;
                 thinger::thinger::handle(millis(), data_available);
+                readable_ = false;
             }
         }
     }
@@ -352,12 +461,168 @@ public:
         state_listener_ = state_listener;
     }
 
+    const io_statistics& get_io_statistics() const{
+        return io_stats_;
+    }
+
+    /**
+     * Clear the io statistics, so they are counted from now on
+     */
+    void reset_io_statistics(){
+        io_stats_ = io_statistics();
+        io_stats_.start_millis = millis();
+    }
+
+    /**
+     * Socket writes per second since the io statistics were reset (or the client was created), that roughly matches
+     * the sent packets per second
+     */
+    double get_send_rate(){
+        unsigned long elapsed = millis() - io_stats_.start_millis;
+        return elapsed>0 ? io_stats_.write_calls * 1000.0 / elapsed : 0;
+    }
+
+    /**
+     * Set the maximum time the coalesced output can be kept buffered while writing other messages, if write
+     * coalescing is enabled. Buffered output is also written once it reaches THINGER_COALESCE_SIZE bytes.
+     */
+    void set_coalescing_latency(unsigned long millis){
+        coalesce_millis_ = millis;
+    }
+
 protected:
 
     virtual bool to_socket(const uint8_t* buffer, size_t size){
         if(sockfd==-1) return false;
         ssize_t written = ::write(sockfd, buffer, size);
-        return size == written;
+        return written >= 0 && (size_t) written == size;
+    }
+
+    /**
+     * Write all the spans to the socket, in order, with as few system calls as possible
+     * @return true if all the data was written
+     */
+    virtual bool to_socket(const thinger_io_span* spans, size_t count){
+        if(sockfd==-1) return false;
+        struct iovec iov[THINGER_IOV_SIZE];
+        size_t index = 0;
+        size_t offset = 0;
+        while(true){
+            // skip the spans already written
+            while(index<count && offset==spans[index].size){
+                index++;
+                offset = 0;
+            }
+            if(index==count) return true;
+            int iov_count = 0;
+            for(size_t i=index; i<count && iov_count<THINGER_IOV_SIZE; i++){
+                size_t start = i==index ? offset : 0;
+                iov[iov_count].iov_base = (uint8_t*) spans[i].data + start;
+                iov[iov_count++].iov_len = spans[i].size - start;
+            }
+            ssize_t written = ::writev(sockfd, iov, iov_count);
+            if(written<0){
+                if(errno==EINTR) continue;
+                return false;
+            }
+            // advance over the written data, that may end in the middle of a span
+            size_t remaining = written;
+            while(remaining>0){
+                size_t left = spans[index].size - offset;
+                if(remaining<left){
+                    offset += remaining;
+                    break;
+                }
+                remaining -= left;
+                index++;
+                offset = 0;
+            }
+        }
+    }
+
+    /**
+     * Read up to size bytes from the socket, blocking only if there is no data available
+     * @return the number of bytes read, or 0 or less if the connection was closed or failed
+     */
+    virtual ssize_t from_socket(uint8_t* buffer, size_t size){
+        if(sockfd==-1) return -1;
+        ssize_t read_size;
+        do{
+            read_size = ::recv(sockfd, buffer, size, 0);
+        }while(read_size<0 && errno==EINTR);
+        return read_size;
+    }
+
+    bool append(const void* buffer, size_t size){
+        if(size==0) return true;
+        if(!out_buffer_.ensure(out_size_ + size)) return false;
+        if(out_size_==0) out_since_ = millis();
+        memcpy(out_buffer_.data() + out_size_, buffer, size);
+        out_size_ += size;
+        return true;
+    }
+
+    /**
+     * @return true if the buffered output is too large or too old to keep waiting for more messages
+     */
+    bool output_due(){
+        return out_size_>0 && (out_size_>=THINGER_COALESCE_SIZE || millis()-out_since_>=coalesce_millis_);
+    }
+
+    /**
+     * Send the buffered data followed by the given spans, and release the output buffer
+     * @return true if the data was written
+     */
+    bool flush_output(const thinger_io_span* spans, size_t count){
+        if(!out_spans_.ensure((count+1)*sizeof(thinger_io_span))) return false;
+        thinger_io_span* output = (thinger_io_span*) out_spans_.data();
+        size_t output_count = 0;
+        size_t output_size = 0;
+        if(out_size_>0){
+            output[output_count].data = out_buffer_.data();
+            output[output_count++].size = out_size_;
+            output_size += out_size_;
+        }
+        for(size_t i=0; i<count; i++){
+            if(spans[i].size==0) continue;
+            output[output_count++] = spans[i];
+            output_size += spans[i].size;
+        }
+        if(output_count==0) return true;
+        io_stats_.write_calls++;
+        io_stats_.bytes_written += output_size;
+        bool success = output_count==1 ?
+                       to_socket((const uint8_t*) output[0].data, output[0].size) :
+                       to_socket(output, output_count);
+        out_buffer_.release(out_size_);
+        out_size_ = 0;
+        if(!success){
+            disconnected();
+        }
+        return success;
+    }
+
+    /**
+     * @return true if the socket can be read without blocking
+     */
+    virtual bool socket_readable(){
+        if(readable_){
+            readable_ = false;
+            return true;
+        }
+        if(sockfd==-1) return false;
+        struct pollfd socket_poll;
+        socket_poll.fd = sockfd;
+        socket_poll.events = POLLIN;
+        socket_poll.revents = 0;
+        return poll(&socket_poll, 1, 0) > 0;
+    }
+
+    ssize_t receive(uint8_t* buffer, size_t size){
+        io_stats_.read_calls++;
+        ssize_t read_size = from_socket(buffer, size);
+        if(read_size>0) io_stats_.bytes_read += read_size;
+        return read_size;
     }
 
     int sockfd;
@@ -366,9 +631,16 @@ protected:
     const char* device_id_;
     const char* device_password_;
     std::function<void(THINGER_STATE)> state_listener_;
-    uint8_t* out_buffer_;
+    thinger_io_buffer out_buffer_;
+    thinger_io_buffer out_spans_;
     size_t out_size_;
-    size_t buffer_size_;
+    unsigned long out_since_;
+    unsigned long coalesce_millis_;
+    uint8_t in_buffer_[THINGER_INPUT_BUFFER_SIZE];
+    size_t in_start_;
+    size_t in_end_;
+    bool readable_;
+    io_statistics io_stats_;
 
 };
 
@@ -32,8 +32,9 @@
 class thinger_tls_client : public thinger_client {
 
 public:
-	thinger_tls_client(const char* user, const char* device, const char* device_credential, const char* thinger_server = THINGER_SERVER) :
-		thinger_client(user, device, device_credential, thinger_server), sslCtx(NULL), ssl(NULL), thinger_server(thinger_server)
+	thinger_tls_client(const char* user, const char* device, const char* device_credential, const char* thinger_server = THINGER_SERVER,
+					   memory_allocator& allocator = default_allocator()) :
+		thinger_client(user, device, device_credential, thinger_server, allocator), sslCtx(NULL), ssl(NULL), thinger_server(thinger_server)
     {
 		SSL_library_init();
     }
@@ -97,27 +98,54 @@ protected:
 		thinger_client::disconnected();
 	}
 
-	virtual bool read(char* buffer, size_t size){
-		if(ssl==NULL) return false;
-		int read_size = SSL_read(ssl, buffer, size);
-		if(read_size!=size){
-			disconnected();
-		}
-		return read_size == size;
+	virtual bool input_pending(){
+		return thinger_client::input_pending() || (ssl!=NULL && SSL_pending(ssl)>0);
 	}
 
 protected:
 
+	/**
+	 * A readable socket may still hold a partial TLS record, so SSL_read can block until the record is complete
+	 */
+	virtual bool socket_readable(){
+		return (ssl!=NULL && SSL_pending(ssl)>0) || thinger_client::socket_readable();
+	}
+
 	virtual bool to_socket(const uint8_t* buffer, size_t size){
 		if(ssl==NULL) return false;
 		int write_size = SSL_write(ssl, buffer, size);
 		return write_size == size;
 	}
 
+	/**
+	 * TLS records cannot be scattered, so the spans are gathered in a staging buffer and written with a single
+	 * SSL_write, instead of sending a record (and its overhead) for each span
+	 */
+	virtual bool to_socket(const thinger_io_span* spans, size_t count){
+		size_t size = 0;
+		for(size_t i=0; i<count; i++) size += spans[i].size;
+		if(!tls_buffer_.ensure(size)) return false;
+		uint8_t* buffer = tls_buffer_.data();
+		size_t offset = 0;
+		for(size_t i=0; i<count; i++){
+			memcpy(buffer + offset, spans[i].data, spans[i].size);
+			offset += spans[i].size;
+		}
+		bool success = to_socket(buffer, size);
+		tls_buffer_.release(size);
+		return success;
+	}
+
+	virtual ssize_t from_socket(uint8_t* buffer, size_t size){
+		if(ssl==NULL) return -1;
+		return SSL_read(ssl, buffer, size);
+	}
+
 private:
 	SSL_CTX *sslCtx;
 	SSL *ssl;
 	const char* thinger_server;
+	thinger_io_buffer tls_buffer_;
 };
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef THINGER_TEST_H
+#define THINGER_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// checks a condition, exiting with an error that points to the failed check
+#define CHECK(condition) \
+    do{ \
+        if(!(condition)){ \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    }while(0)
+
+#endif
@@ -0,0 +1,120 @@
+// The buffer encoder reserves each length prefix before the contents, with the width of the cached size (or one byte),
+// and rewrites it once the contents are known, moving them if the final width differs. Long strings and bytes are not
+// copied, but referenced from the output spans at their offset in the buffer. Prefixes growing and shrinking around
+// referenced values must shift only the values after them, and the joined spans must match the encoding of an encoder
+// writing lengths before their contents.
+
+#include "thinger/core/pson.h"
+#include "thinger/core/thinger_encoder.hpp"
+#include "test.h"
+#include <string>
+#include <vector>
+
+using namespace protoson;
+using namespace thinger;
+
+static std::string reference(pson& data){
+    std::vector<uint8_t> buffer(pson_encoded_size(data));
+    pson_buffer_encoder encoder(buffer.data(), buffer.size());
+    encoder.encode(data);
+    CHECK(encoder.bytes_written()==buffer.size());
+    return std::string((const char*) buffer.data(), buffer.size());
+}
+
+// join the spans of the encoder, checking how many of them reference values outside the buffer
+static std::string joined(thinger_buffer_encoder& encoder, size_t borrowed){
+    size_t count;
+    const thinger_io_span* spans = encoder.get_spans(count);
+    CHECK(spans!=NULL);
+    std::string output;
+    for(size_t i=0; i<count; i++){
+        CHECK(spans[i].size>0);
+        output.append((const char*) spans[i].data, spans[i].size);
+    }
+    CHECK(count>=borrowed+1 && count<=2*borrowed+1);
+    CHECK(output.size()==encoder.bytes_written());
+    return output;
+}
+
+static void check(thinger_buffer_encoder& encoder, pson& data, size_t borrowed){
+    encoder.reset();
+    encoder.encode(data);
+    CHECK(encoder.is_valid());
+    CHECK(joined(encoder, borrowed)==reference(data));
+}
+
+int main(){
+    const std::string borrowed(THINGER_ENCODER_BORROW_SIZE, 'b');
+    const std::string huge(20000, 'h');
+    thinger_buffer_encoder encoder;
+
+    // values of the borrow size are referenced in place, and shorter ones copied
+    {
+        pson data;
+        data["short"] = std::string(THINGER_ENCODER_BORROW_SIZE-1, 's').c_str();
+        data["long"] = borrowed.c_str();
+        encoder.reset();
+        encoder.encode(data);
+        size_t count;
+        const thinger_io_span* spans = encoder.get_spans(count);
+        CHECK(count==2);
+        CHECK(spans[1].data==data["long"].get_value() && spans[1].size==borrowed.size());
+        CHECK(joined(encoder, 1)==reference(data));
+    }
+
+    // prefixes reserved with one byte grow around referenced values, at several levels
+    {
+        pson data;
+        data["before"] = borrowed.c_str();
+        pson& level1 = data["level1"];
+        level1["text"] = borrowed.c_str();
+        pson& level2 = level1["level2"];
+        level2["first"] = borrowed.c_str();
+        level2["value"] = 7;
+        level2["second"] = huge.c_str();
+        level1["after"] = borrowed.c_str();
+        data["last"] = 1;
+        ((pson_object&) level2).invalidate_encoded_size();
+        ((pson_object&) level1).invalidate_encoded_size();
+        check(encoder, data, 5);
+
+        // the second encoding reserves the cached sizes, so nothing is moved
+        check(encoder, data, 5);
+    }
+
+    // prefixes reserved with a stale cached size shrink around referenced values
+    {
+        pson data;
+        data["before"] = borrowed.c_str();
+        pson& nested = data["nested"];
+        pson& text = nested["text"];
+        text = huge.c_str();
+        pson& kept = nested["kept"];
+        kept = borrowed.c_str();
+        nested["value"] = 3;
+        check(encoder, data, 3);
+
+        // modified through a reference, so the nested object keeps a size needing a 3 byte prefix
+        text = "short";
+        size_t cached;
+        CHECK(((pson_object&) nested).get_encoded_size(cached) && pson_varint_size(cached)==3);
+        check(encoder, data, 2);
+
+        // down to a single byte prefix, with no referenced value inside
+        kept = "short too";
+        text = 1;
+        check(encoder, data, 1);
+    }
+
+    // empty containers and values after them
+    {
+        pson data;
+        pson_object& empty = data["empty"];
+        (void) empty;
+        pson_array& array = data["array"];
+        array.add(borrowed.c_str()).add(1).add(borrowed.c_str());
+        data["tail"] = borrowed.c_str();
+        check(encoder, data, 3);
+    }
+    return 0;
+}
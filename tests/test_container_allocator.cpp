@@ -0,0 +1,114 @@
+// Objects and arrays keep the allocator that was active when they were created, and release their blocks and items
+// under it, so a tree built under one scope can be destroyed or extended under any other. Containers created under an
+// arena guard keep the guarded allocator, as the guard is usually gone when they are destroyed.
+
+#include "thinger/core/pson.h"
+#include "test.h"
+#include <set>
+
+using namespace protoson;
+
+// allocator that fails the test on releasing memory it did not allocate
+class checked_allocator : public memory_allocator{
+public:
+    std::set<void*> live;
+
+    using memory_allocator::allocate;
+
+    virtual void *allocate(size_t size){
+        void* ptr = malloc(size);
+        live.insert(ptr);
+        return ptr;
+    }
+
+    virtual void deallocate(void *ptr){
+        if(ptr==NULL) return;
+        CHECK(live.erase(ptr)==1);
+        free(ptr);
+    }
+};
+
+static void build(pson& data){
+    pson_object& object = data;
+    object["name"] = "a string that is not stored inline";
+    pson_array& array = object["values"];
+    for(int i=0; i<100; i++) array.add(i);
+    // enough keys to build the object index
+    for(int i=0; i<32; i++){
+        char key[16];
+        snprintf(key, sizeof(key), "key%d", i);
+        object[key] = i;
+    }
+    CHECK(object.find("key20")!=NULL);
+}
+
+// a tree built under one allocator is released to it when destroyed under another scope
+static void test_destroy_under_other_scope(){
+    checked_allocator builder;
+    checked_allocator other;
+    pson* data;
+    {
+        memory_scope scope(builder);
+        data = builder.allocate<pson>();
+        build(*data);
+    }
+    CHECK(!builder.live.empty());
+    {
+        memory_scope scope(other);
+        builder.destroy(data);
+    }
+    CHECK(builder.live.empty());
+    CHECK(other.live.empty());
+}
+
+// containers grow with their own allocator, even if another scope is active
+static void test_grow_under_other_scope(){
+    checked_allocator builder;
+    checked_allocator other;
+    {
+        memory_scope scope(builder);
+        pson data;
+        pson_array& array = data;
+        array.add(1);
+        {
+            memory_scope inner(other);
+            for(int i=0; i<1000; i++) array.add(i);
+            array.clear();
+        }
+        CHECK(other.live.empty());
+    }
+    CHECK(builder.live.empty());
+}
+
+// containers created under a guard keep its upstream, so they can be destroyed once the guard is gone
+static void test_guard(){
+    checked_allocator upstream;
+    {
+        memory_scope scope(upstream);
+        arena_memory_allocator arena(upstream);
+        CHECK(arena.reserve(4096));
+        pson* data;
+        {
+            memory_scope arena_scope(arena);
+            data = arena.allocate<pson>();
+            build(*data);
+        }
+        {
+            arena_guard_allocator guard(arena, upstream);
+            memory_scope guard_scope(guard);
+            pson_object& object = *data;
+            object["created"]["value"] = "replaced by a value that is not stored inline";
+            object["name"] = "also replaced by a value that is not stored inline";
+            ((pson_array&) object["values"]).add(1000);
+        }
+        arena.destroy(data);
+    }
+    CHECK(upstream.live.empty());
+}
+
+int main(){
+    test_destroy_under_other_scope();
+    test_grow_under_other_scope();
+    test_guard();
+    return 0;
+}
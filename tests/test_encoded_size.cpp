@@ -0,0 +1,102 @@
+// Encoders writing lengths after their contents cache the encoded size of containers. A failed encoding must not
+// cache any size, reading values must keep it, and values modified through references held across encodings must
+// never be encoded with a stale length by the encoders that write lengths before their contents.
+
+#include "thinger/core/pson.h"
+#include "thinger/core/pson_writer.h"
+#include "thinger/core/thinger_encoder.hpp"
+#include "test.h"
+#include <string>
+
+using namespace protoson;
+using namespace thinger;
+
+// allocator that fails any allocation above a size limit
+class limited_allocator : public memory_allocator{
+public:
+    limited_allocator(size_t limit) : limit_(limit){}
+
+    using memory_allocator::allocate;
+
+    virtual void *allocate(size_t size){
+        return size<=limit_ ? malloc(size) : NULL;
+    }
+
+    virtual void deallocate(void *ptr){
+        free(ptr);
+    }
+
+private:
+    size_t limit_;
+};
+
+int main(){
+    pson data;
+    pson& nested = data["nested"];
+    nested["text"] = std::string(1024, 'x').c_str();
+    nested["value"] = 1;
+    pson_object& object = nested;
+    size_t size;
+
+    // the writer cannot grow to hold the nested object
+    limited_allocator allocator(256);
+    {
+        pson_writer writer(allocator);
+        writer.value(data);
+        CHECK(!writer.is_valid());
+    }
+    CHECK(!object.get_encoded_size(size));
+
+    // a successful encoding caches the right size
+    {
+        pson_writer writer;
+        writer.value(data);
+        CHECK(writer.is_valid());
+    }
+    CHECK(object.get_encoded_size(size));
+    object.invalidate_encoded_size();
+    CHECK(size==pson_encoded_size(object));
+
+    // reading values keeps the cached size
+    pson_encoded_size(data);
+    CHECK(object.get_encoded_size(size));
+    CHECK((int) data["nested"]["value"]==1);
+    CHECK(((pson_container<pson_pair>&) object)[0]!=NULL);
+    CHECK(object.get_encoded_size(size));
+
+    // modify the nested object through a reference held across encodings
+    pson& text = nested["text"];
+    thinger_buffer_encoder backpatched;
+    backpatched.encode(data);
+    text = std::string(300, 'y').c_str();
+    nested["value"] = 123456;
+    backpatched.reset();
+    backpatched.encode(data);
+    size_t count;
+    const thinger_io_span* spans = backpatched.get_spans(count);
+    std::string expected;
+    for(size_t i=0; i<count; i++) expected.append((const char*) spans[i].data, spans[i].size);
+    CHECK(expected.size()==pson_encoded_size(data));
+
+    // encoders that size the contents first, as used by writes to the connection and by views
+    std::string output(expected.size()*2, 0);
+    pson_buffer_encoder buffer_encoder((uint8_t*) &output[0], output.size());
+    text = std::string(200, 'z').c_str();
+    buffer_encoder.encode(data);
+    pson decoded;
+    pson_buffer_decoder decoder((uint8_t*) &output[0], buffer_encoder.bytes_written());
+    CHECK(decoder.decode(decoded) && decoder.bytes_read()==buffer_encoder.bytes_written());
+    CHECK(strlen((const char*) decoded["nested"]["text"])==200);
+    CHECK((int) decoded["nested"]["value"]==123456);
+
+    text = "short";
+    thinger_memory_encoder memory_encoder((uint8_t*) &output[0], output.size());
+    memory_encoder.encode(data);
+    CHECK(memory_encoder.bytes_written()==pson_encoded_size(data));
+    pson short_decoded;
+    pson_buffer_decoder short_decoder((uint8_t*) &output[0], memory_encoder.bytes_written());
+    CHECK(short_decoder.decode(short_decoded) && strcmp((const char*) short_decoded["nested"]["text"], "short")==0);
+
+    printf("ok\n");
+    return 0;
+}
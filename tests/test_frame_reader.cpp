@@ -0,0 +1,175 @@
+// The frame reader only reads what the io can serve without blocking, so a frame may arrive over many calls. Headers
+// split inside their varints and bodies split at any point must resume where they stopped, bodies started in a
+// destination that is not available on the next call must be kept, and the next frame must start clean after reset.
+
+#include "thinger/core/thinger_decoder.hpp"
+#include "test.h"
+#include <string>
+#include <vector>
+
+using namespace thinger;
+
+// io serving its data in chunks of the scheduled sizes, where 0 means there is no data available on that call
+class chunked_io : public thinger_io{
+public:
+    std::string data;
+    std::vector<size_t> chunks;
+    size_t position;
+    size_t calls;
+    bool closed;
+
+    chunked_io() : position(0), calls(0), closed(false){}
+
+    virtual bool read(char* buffer, size_t size){
+        if(position+size>data.size()) return false;
+        memcpy(buffer, data.data() + position, size);
+        position += size;
+        return true;
+    }
+
+    virtual bool write(const char*, size_t, bool){
+        return true;
+    }
+
+    virtual bool read_some(char* buffer, size_t size, size_t& bytes_read, bool){
+        bytes_read = 0;
+        size_t available = data.size() - position;
+        if(available==0) return !closed;
+        size_t chunk = calls<chunks.size() ? chunks[calls] : available;
+        calls++;
+        bytes_read = chunk<size ? chunk : size;
+        if(bytes_read>available) bytes_read = available;
+        memcpy(buffer, data.data() + position, bytes_read);
+        position += bytes_read;
+        return true;
+    }
+};
+
+static void append_varint(std::string& data, uint32_t value){
+    while(value>=0x80){
+        data += (char) (value | 0x80);
+        value >>= 7;
+    }
+    data += (char) value;
+}
+
+static std::string frame(uint32_t type, const std::string& body){
+    std::string data;
+    append_varint(data, type);
+    append_varint(data, body.size());
+    return data + body;
+}
+
+static std::string body(size_t size, char seed){
+    std::string data;
+    for(size_t i=0; i<size; i++) data += (char) (seed + i % 23);
+    return data;
+}
+
+// headers split inside the size varint, and a body split across calls that started in a destination
+static void test_split_frame(){
+    chunked_io io;
+    std::string payload = body(300, 'a');
+    io.data = frame(1, payload);
+    // type, first size byte, nothing, second size byte, then the body in pieces
+    size_t chunks[] = {1, 1, 0, 1, 10, 0, 1, 200, 0, 89};
+    io.chunks.assign(chunks, chunks + sizeof(chunks)/sizeof(chunks[0]));
+    thinger_frame_reader reader(io);
+
+    CHECK(reader.read_header()==thinger_frame_reader::FRAME_INCOMPLETE);
+    CHECK(reader.read_header()==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(reader.type()==1 && reader.size()==300);
+
+    // the first destination is overwritten after the call, as a message reserved again would be
+    std::vector<uint8_t> first(300);
+    CHECK(reader.read_body(first.data())==thinger_frame_reader::FRAME_INCOMPLETE);
+    CHECK(reader.body_started());
+    memset(first.data(), 0, first.size());
+
+    CHECK(reader.read_body(NULL)==thinger_frame_reader::FRAME_INCOMPLETE);
+    std::vector<uint8_t> second(300);
+    CHECK(reader.read_body(second.data())==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(reader.body()==second.data());
+    CHECK(memcmp(second.data(), payload.data(), payload.size())==0);
+    CHECK(io.position==io.data.size());
+}
+
+// a body read whole into its destination is not copied, and frames read one after another start clean
+static void test_consecutive_frames(){
+    chunked_io io;
+    std::string payload = body(200, 'k');
+    io.data = frame(1, payload) + frame(2, "") + frame(1, "abc");
+    thinger_frame_reader reader(io);
+
+    std::vector<uint8_t> destination(200);
+    CHECK(reader.read_header()==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(reader.type()==1 && reader.size()==200);
+    CHECK(reader.read_body(destination.data())==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(reader.body()==destination.data());
+    CHECK(memcmp(destination.data(), payload.data(), payload.size())==0);
+    reader.reset();
+
+    // empty bodies complete with no data
+    CHECK(reader.read_header()==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(reader.type()==2 && reader.size()==0);
+    CHECK(reader.read_body(NULL)==thinger_frame_reader::FRAME_COMPLETE);
+    reader.reset();
+
+    CHECK(reader.read_header()==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(reader.type()==1 && reader.size()==3);
+    CHECK(reader.read_body(NULL)==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(memcmp(reader.body(), "abc", 3)==0);
+    reader.reset();
+
+    // no more frames
+    CHECK(reader.read_header()==thinger_frame_reader::FRAME_INCOMPLETE);
+}
+
+// a frame reset after an incomplete body does not leak its state into the next one
+static void test_reset_partial(){
+    chunked_io io;
+    io.data = frame(1, body(100, 'x'));
+    size_t chunks[] = {1, 1, 50, 0};
+    io.chunks.assign(chunks, chunks + sizeof(chunks)/sizeof(chunks[0]));
+    thinger_frame_reader reader(io);
+    CHECK(reader.read_header()==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(reader.read_body(NULL)==thinger_frame_reader::FRAME_INCOMPLETE);
+    CHECK(reader.body_started());
+    reader.reset();
+    CHECK(!reader.body_started() && reader.body()==NULL);
+
+    // the rest of the old body is discarded, and a new frame follows
+    io.data = frame(3, "next");
+    io.position = 0;
+    CHECK(reader.read_header()==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(reader.type()==3 && reader.size()==4);
+    std::vector<uint8_t> destination(4);
+    CHECK(reader.read_body(destination.data())==thinger_frame_reader::FRAME_COMPLETE);
+    CHECK(memcmp(destination.data(), "next", 4)==0);
+}
+
+// malformed headers and closed connections are errors
+static void test_errors(){
+    {
+        chunked_io io;
+        io.data = std::string("\x01\xFF\xFF\xFF\xFF\xFF\x01", 7);
+        thinger_frame_reader reader(io);
+        CHECK(reader.read_header()==thinger_frame_reader::FRAME_ERROR);
+    }
+    {
+        chunked_io io;
+        io.data = frame(1, body(10, 'c')).substr(0, 6);
+        io.closed = true;
+        thinger_frame_reader reader(io);
+        CHECK(reader.read_header()==thinger_frame_reader::FRAME_COMPLETE);
+        CHECK(reader.read_body(NULL)==thinger_frame_reader::FRAME_ERROR);
+    }
+}
+
+int main(){
+    test_split_frame();
+    test_consecutive_frames();
+    test_reset_partial();
+    test_errors();
+    return 0;
+}
@@ -0,0 +1,151 @@
+// The JSON decoder builds pson values straight from the text, and the JSON encoder writes the text straight from
+// encoded pson. Documents are decoded, encoded as pson and written back as JSON, covering escapes and unicode,
+// nesting up to the depth limit, and numbers around the 64 bit integer and float boundaries. Malformed documents must
+// be rejected, and the string scanner must stop at the same characters wherever they fall in its 16 byte steps.
+
+#include "thinger/pson_json.h"
+#include "test.h"
+#include <string>
+#include <vector>
+
+using namespace protoson;
+
+static bool decode(const std::string& json, pson& value){
+    pson_json_decoder decoder;
+    return decoder.decode(json, value);
+}
+
+static std::string export_json(pson& value){
+    std::vector<uint8_t> buffer(pson_encoded_size(value));
+    pson_buffer_encoder encoder(buffer.data(), buffer.size());
+    encoder.encode(value);
+    CHECK(encoder.bytes_written()==buffer.size());
+    std::string json;
+    pson_json_encoder json_encoder;
+    CHECK(json_encoder.encode(buffer.data(), buffer.size(), json));
+    return json;
+}
+
+// decode the document and write it back, expecting the given text
+static void round_trip(const std::string& json, const std::string& expected){
+    pson value;
+    CHECK(decode(json, value));
+    std::string output = export_json(value);
+    if(output!=expected) fprintf(stderr, "%s -> %s\n", json.c_str(), output.c_str());
+    CHECK(output==expected);
+}
+
+static void test_escapes(){
+    round_trip("\"plain\"", "\"plain\"");
+    round_trip("\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"", "\"\\\"\\\\/\\b\\f\\n\\r\\t\"");
+    // control characters without a short escape are written as \u00XX
+    round_trip("\"\\u0001\\u001f\"", "\"\\u0001\\u001f\"");
+    // unicode escapes are decoded to utf-8, which is written back verbatim
+    round_trip("\"\\u00e9\\u20AC\\ud83d\\ude00\"", "\"\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80\"");
+    round_trip("\"caf\xC3\xA9\"", "\"caf\xC3\xA9\"");
+    // escapes after a run of plain characters, and keys with escapes
+    round_trip("{\"a\\nb\":\"0123456789abcdef0123\\\"x\"}", "{\"a\\nb\":\"0123456789abcdef0123\\\"x\"}");
+
+    // null characters are kept in strings stored out of the value
+    std::string text = "\"" + std::string(40, 'n') + "\\u0000" + std::string(40, 'n') + "\"";
+    round_trip(text, text);
+    round_trip("\"\"", "\"\"");
+}
+
+// decoding replaces the previous value, as the pson decoder does
+static void test_replace(){
+    pson value;
+    CHECK(decode("{\"a\":[1,2],\"b\":\"a string that is not stored inline\"}", value));
+    CHECK(decode("{\"c\":3}", value));
+    CHECK(export_json(value)=="{\"c\":3}");
+    CHECK(decode("[1]", value) && decode("[2]", value));
+    CHECK(export_json(value)=="[2]");
+    CHECK(decode("\"text\"", value) && decode("{}", value));
+    CHECK(export_json(value)=="{}");
+}
+
+static void test_nesting(){
+    round_trip(" { \"a\" : [ 1 , { \"b\" : [ ] } , { } ] , \"c\" : null } ",
+               "{\"a\":[1,{\"b\":[]},{}],\"c\":null}");
+    // duplicated keys are kept in order
+    round_trip("{\"k\":1,\"k\":2}", "{\"k\":1,\"k\":2}");
+    round_trip("[true,false,null,\"\",[[]]]", "[true,false,null,\"\",[[]]]");
+
+    std::string nested;
+    for(int i=0; i<PSON_JSON_MAX_DEPTH; i++) nested += i%2==0 ? "[" : "{\"k\":";
+    nested += "0";
+    for(int i=PSON_JSON_MAX_DEPTH-1; i>=0; i--) nested += i%2==0 ? "]" : "}";
+    round_trip(nested, nested);
+
+    pson value;
+    CHECK(!decode("[" + nested + "]", value));
+}
+
+static void test_numbers(){
+    round_trip("[0,1,-0,2,-1,127,128,-128]", "[0,1,0,2,-1,127,128,-128]");
+    round_trip("[18446744073709551615,-9223372036854775808]", "[18446744073709551615,-9223372036854775808]");
+    // past 64 bits integers become floating point numbers
+    round_trip("[18446744073709551616,100000000000000000001]", "[1.8446744e+19,1e+20]");
+    // numbers within 1e-5 of a float are kept as floats, and written with the shortest text reading back the same value
+    round_trip("[0.5,0.1,-2.25,1e3,1E-2]", "[0.5,0.1,-2.25,1000,0.01]");
+    round_trip("[3.141592653589793,1e300,123456789.123,-4e-300]", "[3.1415927,1e+300,123456789.123,-0]");
+
+    pson value;
+    CHECK(decode("-9223372036854775808", value));
+    CHECK(value.get_type()==pson::svarint_field && (long long) value==INT64_MIN);
+    CHECK(decode("0.1", value) && (float) value==0.1f);
+    CHECK(decode("123456789.123", value) && value.get_type()==pson::double_field);
+    // numbers longer than the inline conversion buffer
+    std::string digits = "0." + std::string(80, '3');
+    CHECK(decode(digits, value) && (double) value > 0.333 && (double) value < 0.334);
+}
+
+static void test_invalid(){
+    static const char* documents[] = {
+        "", " ", "{", "[", "[1,]", "{\"a\":1,}", "{\"a\"}", "{a:1}", "[1 2]", "\"open", "\"tab\there\"",
+        "\"\\x\"", "\"\\u12\"", "\"\\ud800\"", "\"\\udc00\"", "\"\\ud800\\u0041\"", "01", "-", "1.", ".5", "1e",
+        "+1", "tru", "nul", "1 2", "[1]]", "{}x"
+    };
+    for(size_t i=0; i<sizeof(documents)/sizeof(documents[0]); i++){
+        pson value;
+        if(decode(documents[i], value)) fprintf(stderr, "accepted: %s\n", documents[i]);
+        CHECK(!decode(documents[i], value));
+    }
+
+    // encoded pson that is truncated or followed by more data is rejected on export
+    pson value;
+    CHECK(decode("{\"key\":[1,\"text\"]}", value));
+    std::vector<uint8_t> buffer(pson_encoded_size(value) + 1);
+    pson_buffer_encoder encoder(buffer.data(), buffer.size());
+    encoder.encode(value);
+    std::string json;
+    pson_json_encoder json_encoder;
+    CHECK(!json_encoder.encode(buffer.data(), buffer.size() - 2, json));
+    CHECK(!json_encoder.encode(buffer.data(), buffer.size(), json));
+}
+
+// the scanner stops at the same character as a byte by byte scan, wherever it falls
+static void test_string_run(){
+    static const char specials[] = {'"', '\\', '\0', '\x1f', '\n'};
+    for(size_t s=0; s<sizeof(specials); s++){
+        for(size_t position=0; position<40; position++){
+            // bytes above 0x7f are not special
+            std::string str(48, '\xE9');
+            str[position] = specials[s];
+            CHECK(json_string_run(str.data(), str.data() + str.size()) == str.data() + position);
+            CHECK(json_string_run(str.data(), str.data() + position) == str.data() + position);
+        }
+    }
+    std::string plain(33, ' ');
+    CHECK(json_string_run(plain.data(), plain.data() + plain.size()) == plain.data() + plain.size());
+}
+
+int main(){
+    test_escapes();
+    test_replace();
+    test_nesting();
+    test_numbers();
+    test_invalid();
+    test_string_run();
+    return 0;
+}
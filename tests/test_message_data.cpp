@@ -0,0 +1,114 @@
+// Encoded payloads are decoded in place only when nothing else references them: a view taken over the payload, or
+// the writer a payload was set from, must keep their bytes after the payload is accessed as a pson.
+
+#include "thinger/core/thinger_message.hpp"
+#include "thinger/core/pson_schema.h"
+#include "test.h"
+#include <string>
+
+using namespace thinger;
+using namespace protoson;
+
+struct sample{
+    char name[64];
+    int level;
+};
+
+static const pson_schema_field sample_fields[] = {
+    PSON_FIELD(sample, name), PSON_FIELD(sample, level)
+};
+
+static const pson_schema<sample> sample_schema(sample_fields);
+
+static void check_sample(thinger_message& message){
+    sample value = {"", 0};
+    CHECK(message.get_data(sample_schema, value));
+    CHECK(strcmp(value.name, "a string long enough to be stored out of line")==0);
+    CHECK(value.level==3);
+}
+
+static void write_payload(pson_writer& writer){
+    writer.begin_object();
+    writer.field("name", "a string long enough to be stored out of line");
+    writer.field("level", 3);
+    writer.key("blob").bytes("\x01\x02\x03", 3);
+    writer.end_object();
+}
+
+static void check_payload(pson& data){
+    CHECK(strcmp((const char*) data["name"], "a string long enough to be stored out of line")==0);
+    CHECK((int) data["level"]==3);
+    CHECK(data["blob"].is_bytes());
+}
+
+int main(){
+    size_t size;
+
+    // the writer is never modified by the message
+    {
+        pson_writer writer;
+        write_payload(writer);
+        CHECK(writer.is_valid());
+        std::string written((const char*) writer.data(), writer.size());
+
+        thinger_message message;
+        message.set_data(writer);
+        check_payload(message.get_data());
+        CHECK(written==std::string((const char*) writer.data(), writer.size()));
+    }
+
+    // a view keeps the payload bytes after the payload is decoded
+    {
+        pson_writer writer;
+        write_payload(writer);
+        std::string frame((const char*) writer.data(), writer.size());
+
+        thinger_message message;
+        message.set_encoded_data((uint8_t*) &frame[0], frame.size());
+        pson_view view;
+        CHECK(message.get_data(view));
+        std::string viewed((const char*) view.data(), view.size());
+        check_payload(message.get_data());
+        CHECK(viewed==std::string((const char*) view.data(), view.size()));
+        const char* name;
+        CHECK(view.find("name", name, size) && size==strlen("a string long enough to be stored out of line"));
+    }
+
+    // a payload only used as a pson is decoded in place
+    {
+        pson_writer writer;
+        write_payload(writer);
+        std::string frame((const char*) writer.data(), writer.size());
+
+        thinger_message message;
+        message.set_encoded_data((uint8_t*) &frame[0], frame.size());
+        check_payload(message.get_data());
+        const char* name = message.get_data()["name"];
+        CHECK(name>=frame.data() && name<frame.data()+frame.size());
+    }
+
+    // the accessors can be used in any order
+    {
+        pson_writer writer;
+        write_payload(writer);
+        std::string frame((const char*) writer.data(), writer.size());
+
+        thinger_message message;
+        message.set_encoded_data((uint8_t*) &frame[0], frame.size());
+        check_sample(message);
+        pson_view view;
+        CHECK(message.get_data(view));
+        check_sample(message);
+        check_payload(message.get_data());
+        check_sample(message);
+        CHECK(view.find("level", size) && size==3);
+        message.get_data()["level"] = 4;
+        pson_view updated;
+        CHECK(message.get_data(updated));
+        CHECK(updated.find("level", size) && size==4);
+        CHECK(view.find("level", size) && size==3);
+    }
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,189 @@
+// The pson writer encodes values as they are written, so it is the caller who keeps the structure. Well formed
+// sequences must encode as the equivalent pson tree does, while keys outside objects, values without keys, mismatched
+// or missing ends, extra top level values and nesting past PSON_WRITER_MAX_DEPTH must leave the writer invalid
+// until it is reset. A reset writer reuses its buffer without allocating.
+
+#include "thinger/core/pson_writer.h"
+#include "test.h"
+#include <string>
+#include <vector>
+
+using namespace protoson;
+
+// malloc allocator that counts its allocations
+class counting_allocator : public memory_allocator{
+public:
+    size_t allocations;
+
+    counting_allocator() : allocations(0){}
+
+    using memory_allocator::allocate;
+
+    virtual void *allocate(size_t size){
+        allocations++;
+        return malloc(size);
+    }
+
+    virtual void deallocate(void *ptr){
+        free(ptr);
+    }
+};
+
+static std::string encoded(pson& value){
+    std::vector<uint8_t> buffer(pson_encoded_size(value));
+    pson_buffer_encoder encoder(buffer.data(), buffer.size());
+    encoder.encode(value);
+    CHECK(encoder.bytes_written()==buffer.size());
+    return std::string((const char*) buffer.data(), buffer.size());
+}
+
+static std::string written(pson_writer& writer){
+    CHECK(writer.is_valid());
+    return std::string((const char*) writer.data(), writer.size());
+}
+
+// the written values encode as the same values assigned to a pson tree
+static void test_matches_tree(){
+    const std::string text(300, 't');
+    pson data;
+    data["zero"] = 0;
+    data["one"] = 1;
+    data["negative"] = -1234567;
+    data["big"] = 0xFFFFFFFFFFULL;
+    data["integral"] = 3.0;
+    data["float"] = 21.5;
+    data["double"] = 123456789.123;
+    data["on"] = true;
+    data["empty"] = "";
+    data["text"] = text.c_str();
+    data["null"].set_null();
+    data["bytes"].set_bytes("\x01\x02\x03", 3);
+    pson_array& array = data["array"];
+    array.add(1).add("a").add(false);
+    ((pson_object&) data["nested"])["inner"] = "value";
+    // a container with more than 127 bytes, so its reserved length prefix grows
+    pson_array& large = data["large"];
+    for(int i=0; i<100; i++) large.add(i*1000);
+
+    pson inner;
+    inner["inner"] = "value";
+
+    pson_writer writer;
+    writer.begin_object()
+        .field("zero", 0).field("one", 1).field("negative", -1234567).field("big", 0xFFFFFFFFFFULL)
+        .field("integral", 3.0).field("float", 21.5).field("double", 123456789.123).field("on", true)
+        .field("empty", "").field("text", text.c_str())
+        .key("null").null()
+        .key("bytes").bytes("\x01\x02\x03", 3)
+        .key("array").begin_array().value(1).value("a").value(false).end_array()
+        .field("nested", inner)
+        .key("large").begin_array();
+    for(int i=0; i<100; i++) writer.value(i*1000);
+    writer.end_array().end_object();
+    CHECK(written(writer)==encoded(data));
+
+    // a single value outside containers
+    pson single;
+    single = "top level";
+    writer.reset();
+    writer.value("top level");
+    CHECK(written(writer)==encoded(single));
+}
+
+// each misuse leaves the writer invalid
+static void test_misuse(){
+    pson_writer writer;
+
+    writer.reset();
+    writer.key("outside");
+    CHECK(!writer.is_valid());
+
+    writer.reset();
+    writer.begin_array().key("in array").end_array();
+    CHECK(!writer.is_valid());
+
+    writer.reset();
+    writer.begin_object().value(1).end_object();
+    CHECK(!writer.is_valid());
+
+    writer.reset();
+    writer.begin_object().key("a").key("b").value(1).end_object();
+    CHECK(!writer.is_valid());
+
+    writer.reset();
+    writer.begin_object().key("dangling").end_object();
+    CHECK(!writer.is_valid());
+
+    writer.reset();
+    writer.begin_object().end_array();
+    CHECK(!writer.is_valid());
+
+    writer.reset();
+    writer.begin_array().end_object();
+    CHECK(!writer.is_valid());
+
+    writer.reset();
+    writer.end_object();
+    CHECK(!writer.is_valid());
+
+    // open containers and empty writers are not valid
+    writer.reset();
+    writer.begin_array().value(1);
+    CHECK(!writer.is_valid());
+    writer.reset();
+    CHECK(!writer.is_valid());
+
+    // a single value can be written at the top level
+    writer.reset();
+    writer.value(1).value(2);
+    CHECK(!writer.is_valid());
+    writer.reset();
+    writer.begin_array().end_array().begin_array().end_array();
+    CHECK(!writer.is_valid());
+
+    // errors are kept by the values written after them
+    writer.reset();
+    writer.begin_object().value(1).key("a").value(2).end_object();
+    CHECK(!writer.is_valid());
+
+    // nesting up to the limit is valid, and past it is not
+    writer.reset();
+    for(int i=0; i<PSON_WRITER_MAX_DEPTH; i++) writer.begin_array();
+    for(int i=0; i<PSON_WRITER_MAX_DEPTH; i++) writer.end_array();
+    CHECK(writer.is_valid());
+    writer.reset();
+    for(int i=0; i<=PSON_WRITER_MAX_DEPTH; i++) writer.begin_array();
+    for(int i=0; i<=PSON_WRITER_MAX_DEPTH; i++) writer.end_array();
+    CHECK(!writer.is_valid());
+
+    // a reset writer is usable again
+    writer.reset();
+    writer.begin_object().field("after", "errors").end_object();
+    pson data;
+    data["after"] = "errors";
+    CHECK(written(writer)==encoded(data));
+}
+
+// a reset writer reuses its buffer
+static void test_reuse(){
+    counting_allocator allocator;
+    pson_writer writer(allocator);
+    const std::string text(1000, 'r');
+    for(int i=0; i<10; i++){
+        writer.reset();
+        writer.begin_object().field("text", text.c_str()).field("index", i).end_object();
+        CHECK(writer.is_valid());
+    }
+    CHECK(allocator.allocations>0 && allocator.allocations<=5);
+    size_t allocations = allocator.allocations;
+    writer.reset();
+    writer.begin_object().field("text", text.c_str()).end_object();
+    CHECK(allocator.allocations==allocations);
+}
+
+int main(){
+    test_matches_tree();
+    test_misuse();
+    test_reuse();
+    return 0;
+}
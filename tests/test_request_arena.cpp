@@ -0,0 +1,141 @@
+// Resource callbacks may replace the values of a request decoded over the message arena. The values allocated by the
+// callbacks come from the client allocator, and the arena memory must never be released to it. The arena is sized
+// for the frame and its nodes, without reserving node memory for string and bytes payloads.
+
+#include "thinger/core/thinger.h"
+#include "test.h"
+#include <set>
+#include <string>
+
+using namespace thinger;
+using namespace protoson;
+
+// allocator that fails the test on releasing memory it did not allocate
+class checked_allocator : public memory_allocator{
+public:
+    std::set<void*> live;
+    size_t largest;
+
+    checked_allocator() : largest(0){}
+
+    using memory_allocator::allocate;
+
+    virtual void *allocate(size_t size){
+        void* ptr = malloc(size);
+        live.insert(ptr);
+        if(size>largest) largest = size;
+        return ptr;
+    }
+
+    virtual void deallocate(void *ptr){
+        if(ptr==NULL) return;
+        CHECK(live.erase(ptr)==1);
+        free(ptr);
+    }
+};
+
+// client reading frames from memory
+class memory_client : public thinger{
+public:
+    memory_client(memory_allocator& allocator) : thinger(allocator), position_(0){}
+
+    std::string input;
+    std::string output;
+
+    virtual bool read(char* buffer, size_t size){
+        if(input.size()-position_<size) return false;
+        memcpy(buffer, &input[position_], size);
+        position_ += size;
+        return true;
+    }
+
+    virtual bool read_some(char* buffer, size_t size, size_t& bytes_read, bool wait){
+        bytes_read = input.size()-position_ < size ? input.size()-position_ : size;
+        memcpy(buffer, &input[position_], bytes_read);
+        position_ += bytes_read;
+        return bytes_read>0 || !wait;
+    }
+
+    virtual bool input_pending(){
+        return position_<input.size();
+    }
+
+    virtual bool write(const char* buffer, size_t size, bool /*flush*/){
+        if(buffer!=NULL) output.append(buffer, size);
+        return true;
+    }
+
+    void request(const char* resource, pson& data){
+        thinger_message message;
+        message.set_stream_id(1);
+        message.resources().add(resource);
+        message.set_data(data);
+        thinger_buffer_encoder encoder;
+        encoder.encode_frame(message);
+        size_t count;
+        const thinger_io_span* spans = encoder.get_spans(count);
+        for(size_t i=0; i<count; i++) input.append((const char*) spans[i].data, spans[i].size);
+        while(input_pending()) handle(0, true);
+    }
+
+private:
+    size_t position_;
+};
+
+int main(){
+    checked_allocator allocator;
+    {
+        memory_client client(allocator);
+        int calls = 0;
+
+        // replace decoded containers, strings, and bytes, and add new values
+        client["config"] << [&](pson& in){
+            in["cfg"] = 0;
+            in["name"] = "a new name that does not fit inline";
+            in["list"] = "replaced";
+            in["blob"].set_bytes("xy", 2);
+            in["new"]["nested"] = "value allocated by the callback";
+            calls++;
+        };
+
+        // move and copy decoded values, and replace the whole input
+        client["echo"] = [&](pson& in, pson& out){
+            out["copy"] = in["cfg"];
+            out["moved"] = (pson&&) in["list"];
+            in = 5;
+            calls++;
+        };
+
+        pson data;
+        data["cfg"]["mode"] = "a string long enough to be stored out of line";
+        data["cfg"]["level"] = 3;
+        data["name"] = "the original name, also stored out of line";
+        pson_array& list = data["list"];
+        list.add(1).add("two, as a long string in an array");
+        uint8_t bytes[64] = {0};
+        data["blob"].set_bytes(bytes, sizeof(bytes));
+
+        client.request("config", data);
+        client.request("echo", data);
+        CHECK(calls==2);
+        CHECK(!client.output.empty());
+
+        // a large upload reserves the frame and a bounded amount of node memory
+        client["upload"] << [&](pson& in){
+            CHECK(in["file"].is_bytes());
+            calls++;
+        };
+        pson upload;
+        std::string file(1024*1024, 'x');
+        upload["file"].set_bytes(file.data(), file.size());
+        allocator.largest = 0;
+        client.request("upload", upload);
+        CHECK(calls==3);
+        CHECK(allocator.largest >= file.size());
+        CHECK(allocator.largest < file.size() + 2*THINGER_MESSAGE_TREE_RESERVE);
+    }
+    // everything the callbacks allocated was released with the client allocator
+    CHECK(allocator.live.empty());
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,174 @@
+// The resource index finds resources by the hash of their full path, so paths with the same hash, either at the same
+// depth or at different ones, must be told apart by their names, and missing paths must not match a resource with the
+// same hash. Lookups over a random tree must match searching each level by name, and the index must be rebuilt, and
+// grown, only when resources are added.
+
+#include "thinger/core/thinger_resource_index.hpp"
+#include "test.h"
+#include <string>
+#include <vector>
+
+using namespace thinger;
+
+// malloc allocator that counts its allocations, and fails them while failing is set
+class counting_allocator : public protoson::memory_allocator{
+public:
+    size_t allocations;
+    bool failing;
+
+    counting_allocator() : allocations(0), failing(false){}
+
+    using protoson::memory_allocator::allocate;
+
+    virtual void *allocate(size_t size){
+        if(failing) return NULL;
+        allocations++;
+        return malloc(size);
+    }
+
+    virtual void deallocate(void *ptr){
+        free(ptr);
+    }
+};
+
+static uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*, so runs are reproducible
+static uint64_t random64(){
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+// search each level by name, as done without the index
+static thinger_resource* search(thinger_map<thinger_resource>& resources, const char* const* path, size_t depth){
+    if(depth==0) return NULL;
+    thinger_resource* resource = resources.find(path[0]);
+    for(size_t i=1; i<depth && resource!=NULL; i++){
+        resource = resource->find(path[i]);
+    }
+    return resource;
+}
+
+// FNV-1a hashes of these paths are the same
+static void test_collisions(){
+    static const char* same_depth[] = {"f1hl4ys", "ga0oaqn"};
+    static const char* nested[] = {"node", "480d3yf"};
+    static const char* top = "8x16pzq";
+
+    counting_allocator allocator;
+    thinger_resource_index index(allocator);
+    thinger_map<thinger_resource> resources;
+
+    // missing paths with the hash of an indexed one
+    thinger_resource& first = resources[same_depth[0]];
+    CHECK(index.update(resources));
+    CHECK(index.find(same_depth, 1)==&first);
+    CHECK(index.find(same_depth + 1, 1)==NULL);
+    thinger_resource& child = resources[nested[0]][nested[1]];
+    CHECK(index.update(resources));
+    CHECK(index.find(nested, 2)==&child);
+    CHECK(index.find(&top, 1)==NULL);
+
+    // both paths of each colliding pair are indexed
+    thinger_resource& second = resources[same_depth[1]];
+    thinger_resource& top_resource = resources[top];
+    CHECK(index.update(resources));
+    CHECK(index.find(same_depth, 1)==&first);
+    CHECK(index.find(same_depth + 1, 1)==&second);
+    CHECK(index.find(nested, 2)==&child);
+    CHECK(index.find(&top, 1)==&top_resource);
+    CHECK(index.find(nested, 1)==&resources[nested[0]]);
+    CHECK(index.find(nested, 0)==NULL);
+}
+
+// lookups over a random tree match searching each level
+static void test_random_tree(){
+    counting_allocator allocator;
+    thinger_resource_index index(allocator);
+    thinger_map<thinger_resource> resources;
+
+    // resource keys are not copied, so names must outlive the tree
+    std::vector<std::string> names;
+    names.reserve(64);
+    for(int i=0; i<64; i++) names.push_back("n" + std::to_string(i));
+
+    std::vector<std::vector<const char*> > paths;
+    for(int i=0; i<600; i++){
+        std::vector<const char*> path;
+        size_t depth = random64() % 5 + 1;
+        // few names per level, so paths share prefixes and names repeat at different levels
+        for(size_t level=0; level<depth; level++) path.push_back(names[random64() % (level==0 ? 8 : 16)].c_str());
+        paths.push_back(path);
+        // add some paths, and lookup the other ones as missing
+        if(i%3!=0){
+            thinger_resource* resource = &resources[path[0]];
+            for(size_t level=1; level<depth; level++) resource = &(*resource)[path[level]];
+        }
+        if(i%50==0) CHECK(index.update(resources));
+    }
+    CHECK(index.update(resources));
+    size_t found = 0;
+    for(size_t i=0; i<paths.size(); i++){
+        thinger_resource* expected = search(resources, &paths[i][0], paths[i].size());
+        CHECK(index.find(&paths[i][0], paths[i].size())==expected);
+        if(expected!=NULL) found++;
+        // every prefix of a path is found too
+        for(size_t depth=1; depth<paths[i].size(); depth++){
+            CHECK(index.find(&paths[i][0], depth)==search(resources, &paths[i][0], depth));
+        }
+    }
+    CHECK(found>=paths.size()*2/3);
+}
+
+// the index is rebuilt only after insertions, growing its table with the number of resources
+static void test_rebuild(){
+    counting_allocator allocator;
+    thinger_resource_index index(allocator);
+    thinger_map<thinger_resource> resources;
+    static const char* names[] = {"a", "b", "c", "d", "e", "f", "g", "h", "i", "j"};
+
+    resources[names[0]];
+    CHECK(index.update(resources));
+    CHECK(allocator.allocations==1);
+    CHECK(index.update(resources));
+    CHECK(allocator.allocations==1);
+
+    // rebuilt over the same table while it is at most half full
+    resources[names[0]][names[1]];
+    resources[names[2]];
+    CHECK(index.update(resources));
+    CHECK(allocator.allocations==1);
+    CHECK(index.find(names, 2)==&resources[names[0]][names[1]]);
+
+    // and grown past it
+    for(size_t i=3; i<sizeof(names)/sizeof(names[0]); i++) resources[names[i]];
+    CHECK(index.update(resources));
+    CHECK(allocator.allocations==2);
+    for(size_t i=2; i<sizeof(names)/sizeof(names[0]); i++){
+        CHECK(index.find(names + i, 1)==&resources[names[i]]);
+    }
+
+    // resources added to another tree also rebuild it, with no changes
+    thinger_map<thinger_resource> other;
+    other[names[0]];
+    CHECK(index.update(resources));
+    CHECK(index.find(names, 1)==&resources[names[0]]);
+
+    // no memory to grow the table
+    counting_allocator failing;
+    thinger_resource_index empty(failing);
+    failing.failing = true;
+    CHECK(!empty.update(resources));
+    failing.failing = false;
+    CHECK(empty.update(resources));
+    CHECK(empty.find(names + 4, 1)==&resources[names[4]]);
+}
+
+int main(){
+    test_collisions();
+    test_random_tree();
+    test_rebuild();
+    return 0;
+}
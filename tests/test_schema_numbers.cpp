@@ -0,0 +1,58 @@
+// Structs encoded with a schema must produce the same bytes as the pson tree filled from them, so whole numbers in
+// float and double members are encoded as integers, and doubles that fit a float as floats.
+
+#include "thinger/core/pson.h"
+#include "thinger/core/pson_schema.h"
+#include "test.h"
+
+using namespace protoson;
+
+struct sample{
+    float single;
+    double number;
+};
+
+static const pson_schema_field sample_fields[] = {
+    PSON_FIELD(sample, single), PSON_FIELD(sample, number)
+};
+
+static const pson_schema<sample> sample_schema(sample_fields);
+
+static void check_sample(float single, double number){
+    sample value = {single, number};
+
+    uint8_t schema_bytes[64];
+    pson_buffer_encoder schema_encoder(schema_bytes, sizeof(schema_bytes));
+    sample_schema.encode(schema_encoder, value);
+    CHECK(sample_schema.encoded_size(value)==schema_encoder.bytes_written());
+
+    pson tree;
+    sample_schema.fill(value, tree);
+    uint8_t tree_bytes[64];
+    pson_buffer_encoder tree_encoder(tree_bytes, sizeof(tree_bytes));
+    tree_encoder.encode(tree);
+
+    CHECK(schema_encoder.bytes_written()==tree_encoder.bytes_written());
+    CHECK(memcmp(schema_bytes, tree_bytes, tree_encoder.bytes_written())==0);
+
+    // the encoded numbers are decoded back to the same values
+    sample decoded = {-1, -1};
+    pson_buffer_decoder decoder(schema_bytes, schema_encoder.bytes_written());
+    CHECK(sample_schema.decode(decoder, decoded));
+    CHECK(decoded.single==single);
+    CHECK(decoded.number==number || decoded.number==(double)(float)number);
+}
+
+int main(){
+    check_sample(0, 0);
+    check_sample(1, 1);
+    check_sample(-1, -1);
+    check_sample(25, 1024);
+    check_sample(-300, -70000);
+    check_sample(21.5f, 21.5);
+    check_sample(0.1f, 0.1);
+    check_sample(3.25f, 1e15);
+    check_sample(-2.75f, 3.141592653589793);
+    printf("ok\n");
+    return 0;
+}
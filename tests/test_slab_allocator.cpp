@@ -0,0 +1,170 @@
+// The slab allocator serves small objects from the cache of the calling thread, refilled from chunks or from the
+// shared free list where other threads return the objects they release in excess. Objects are checked for alignment
+// and overlapping while moving through both paths. Objects served by malloc are tracked, so releasing them twice, or
+// releasing foreign pointers, is ignored and counted.
+
+#include "thinger/slab_memory_allocator.h"
+#include "test.h"
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace protoson;
+
+// fill each object with its own pattern, so objects handed out twice are detected on verify
+static void fill(std::vector<void*>& objects, size_t size){
+    for(size_t i=0; i<objects.size(); i++){
+        memset(objects[i], (int) (i & 0xFF), size);
+    }
+}
+
+static void verify(std::vector<void*>& objects, size_t size){
+    for(size_t i=0; i<objects.size(); i++){
+        uint8_t* bytes = (uint8_t*) objects[i];
+        for(size_t j=0; j<size; j++){
+            CHECK(bytes[j]==(uint8_t) (i & 0xFF));
+        }
+    }
+}
+
+static size_t in_use(slab_memory_allocator& allocator){
+    size_t total = 0;
+    for(size_t i=0; i<slab_memory_allocator::classes; i++){
+        total += allocator.get_statistics(i).in_use;
+    }
+    return total;
+}
+
+static void test_alignment(){
+    slab_memory_allocator allocator;
+    for(size_t size=1; size<=slab_memory_allocator::max_object_size; size++){
+        std::vector<void*> objects;
+        for(size_t i=0; i<64; i++){
+            void* ptr = allocator.allocate(size);
+            CHECK(ptr!=NULL);
+            // any type fitting in the size is aligned to a power of two dividing its size
+            size_t alignment = alignof(max_align_t);
+            while(size % alignment != 0 && alignment>1) alignment /= 2;
+            CHECK((uintptr_t) ptr % alignment == 0);
+            CHECK((uintptr_t) ptr % 8 == 0);
+            objects.push_back(ptr);
+        }
+        fill(objects, size);
+        verify(objects, size);
+        for(size_t i=0; i<objects.size(); i++) allocator.deallocate(objects[i]);
+    }
+}
+
+// objects released by the thread are served again from its cache, without reserving more chunks
+static void test_thread_cache(){
+    slab_memory_allocator allocator;
+    std::vector<void*> objects;
+    for(size_t i=0; i<1000; i++) objects.push_back(allocator.allocate(32));
+    fill(objects, 32);
+    verify(objects, 32);
+    size_t reserved = allocator.reserved_bytes();
+    CHECK(reserved>0);
+    for(size_t i=0; i<objects.size(); i++) allocator.deallocate(objects[i]);
+
+    for(size_t round=0; round<10; round++){
+        for(size_t i=0; i<objects.size(); i++) objects[i] = allocator.allocate(32);
+        fill(objects, 32);
+        verify(objects, 32);
+        for(size_t i=0; i<objects.size(); i++) allocator.deallocate(objects[i]);
+    }
+    CHECK(allocator.reserved_bytes()==reserved);
+    CHECK(allocator.get_statistics(3).high_water>=1000);
+    CHECK(allocator.get_invalid_deallocations()==0);
+}
+
+// objects allocated by one thread and released by others reach the shared free list, and are served from there
+static void test_free_list(){
+    slab_memory_allocator allocator;
+    const size_t threads = 4;
+    const size_t count = 2000;
+    std::vector<void*> objects[threads];
+    for(size_t t=0; t<threads; t++){
+        for(size_t i=0; i<count; i++) objects[t].push_back(allocator.allocate(48));
+        fill(objects[t], 48);
+    }
+    size_t reserved = allocator.reserved_bytes();
+
+    // each thread releases the objects of the main thread, and returns its cache to the allocator on exit
+    std::vector<std::thread> workers;
+    for(size_t t=0; t<threads; t++){
+        workers.push_back(std::thread([&allocator, &objects, t](){
+            verify(objects[t], 48);
+            for(size_t i=0; i<objects[t].size(); i++) allocator.deallocate(objects[t][i]);
+        }));
+    }
+    for(size_t t=0; t<threads; t++) workers[t].join();
+    // the main thread publishes its statistics in batches of 8 objects
+    CHECK(in_use(allocator)<8);
+
+    // all the released objects are served again without new chunks
+    std::vector<void*> reused;
+    for(size_t i=0; i<threads*count; i++) reused.push_back(allocator.allocate(48));
+    fill(reused, 48);
+    verify(reused, 48);
+    CHECK(allocator.reserved_bytes()==reserved);
+
+    // concurrent allocations from all the threads never hand out the same object twice
+    std::vector<void*> concurrent[threads];
+    workers.clear();
+    for(size_t t=0; t<threads; t++){
+        workers.push_back(std::thread([&allocator, &concurrent, t](){
+            for(size_t round=0; round<20; round++){
+                for(size_t i=0; i<count; i++) concurrent[t].push_back(allocator.allocate(48));
+                fill(concurrent[t], 48);
+                verify(concurrent[t], 48);
+                for(size_t i=0; i<count/2; i++){
+                    allocator.deallocate(concurrent[t].back());
+                    concurrent[t].pop_back();
+                }
+            }
+        }));
+    }
+    for(size_t t=0; t<threads; t++) workers[t].join();
+    for(size_t t=0; t<threads; t++){
+        verify(concurrent[t], 48);
+        for(size_t i=0; i<concurrent[t].size(); i++) allocator.deallocate(concurrent[t][i]);
+    }
+    for(size_t i=0; i<reused.size(); i++) allocator.deallocate(reused[i]);
+    CHECK(allocator.get_invalid_deallocations()==0);
+}
+
+static void test_large(){
+    slab_memory_allocator allocator;
+    void* large = allocator.allocate(1024);
+    CHECK(large!=NULL);
+    CHECK(allocator.get_large_statistics().in_use==1);
+    allocator.deallocate(large);
+    CHECK(allocator.get_large_statistics().in_use==0);
+    CHECK(allocator.get_invalid_deallocations()==0);
+
+    // releasing twice is ignored
+    void* twice = allocator.allocate(512);
+    void* other = allocator.allocate(512);
+    allocator.deallocate(twice);
+    allocator.deallocate(twice);
+    CHECK(allocator.get_large_statistics().in_use==1);
+    CHECK(allocator.get_invalid_deallocations()==1);
+
+    // pointers from other allocators are not released, and do not change the statistics
+    void* foreign = malloc(16);
+    allocator.deallocate(foreign);
+    CHECK(allocator.get_large_statistics().in_use==1);
+    CHECK(allocator.get_invalid_deallocations()==2);
+    free(foreign);
+
+    // remaining big objects are released with the allocator
+    (void) other;
+}
+
+int main(){
+    test_alignment();
+    test_thread_cache();
+    test_free_list();
+    test_large();
+    return 0;
+}
@@ -0,0 +1,160 @@
+// Periodic streams are kept in a heap ordered by their next deadline. The schedule is checked against a plain list of
+// deadlines while streams with different intervals are started, stopped and restarted at random, so every heap
+// reordering is covered: each step must return exactly the streams that are due, with deadlines kept aligned to their
+// intervals when samples are handled late, also across a wrap around of the time base.
+
+#include "thinger/core/thinger_streams.hpp"
+#include "test.h"
+#include <limits.h>
+#include <vector>
+
+using namespace thinger;
+
+static uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*, so runs are reproducible
+static uint64_t random64(){
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+// start or stop a resource stream as a server request does
+static void stream(thinger_resource& resource, unsigned long interval){
+    thinger_message request;
+    thinger_message response;
+    request.set_signal_flag(interval>0 ? thinger_message::START_STREAM : thinger_message::STOP_STREAM);
+    request.set_stream_id(1);
+    if(interval>0) request.get_data() = interval;
+    resource.handle_request(request, response);
+    CHECK(resource.get_stream_interval()==interval);
+}
+
+// streams with their expected deadlines
+struct model{
+    std::vector<thinger_resource> resources;
+    std::vector<unsigned long> deadlines;
+    std::vector<bool> active;
+    std::vector<bool> pending;
+    unsigned long last_time;
+
+    explicit model(size_t count) :
+        resources(count), deadlines(count), active(count), pending(count), last_time(0){}
+
+    void start(thinger_streams& streams, size_t index, unsigned long interval){
+        stream(resources[index], interval);
+        CHECK(streams.add(resources[index]));
+        active[index] = true;
+        // due on the next step, and ordered by the time of the previous one
+        deadlines[index] = last_time;
+        pending[index] = true;
+    }
+
+    void stop(size_t index){
+        stream(resources[index], 0);
+        active[index] = false;
+    }
+
+    bool due(size_t index, unsigned long time) const{
+        return active[index] && (pending[index] || (long)(time - deadlines[index]) >= 0);
+    }
+
+    // check the streams returned at the given time, updating the expected deadlines
+    void step(thinger_streams& streams, unsigned long time){
+        last_time = time;
+        std::vector<bool> returned(resources.size());
+        unsigned long previous = 0;
+        bool first = true;
+        while(thinger_resource* resource = streams.next_due(time)){
+            size_t index = resource - &resources[0];
+            CHECK(index<resources.size() && due(index, time) && !returned[index]);
+            // returned in deadline order
+            CHECK(first || (long)(deadlines[index] - previous) >= 0);
+            previous = deadlines[index];
+            first = false;
+            returned[index] = true;
+            unsigned long interval = resource->get_stream_interval();
+            if(pending[index]){
+                // intervals are counted from the first sample
+                deadlines[index] = time + interval;
+                pending[index] = false;
+            }else{
+                deadlines[index] += interval * ((time - deadlines[index]) / interval + 1);
+            }
+            CHECK((long)(deadlines[index] - time) > 0);
+        }
+        bool any = false;
+        unsigned long next = 0;
+        for(size_t i=0; i<resources.size(); i++){
+            CHECK(returned[i] || !due(i, time));
+            if(!active[i]) continue;
+            if(!any || (long)(deadlines[i] - next) < 0) next = deadlines[i];
+            any = true;
+        }
+        unsigned long deadline;
+        CHECK(streams.next_deadline(deadline)==any);
+        CHECK(!any || deadline==next);
+    }
+};
+
+// random starts, stops, restarts and time steps
+static void test_random(unsigned long start_time){
+    model streams_model(40);
+    thinger_streams streams(protoson::current_allocator());
+    unsigned long time = start_time;
+    streams_model.step(streams, time);
+    for(int i=0; i<3000; i++){
+        size_t index = random64() % streams_model.resources.size();
+        switch(random64() % 8){
+            case 0:
+            case 1:
+                // start, or restart with a new interval
+                streams_model.start(streams, index, random64() % 500 + 1);
+                break;
+            case 2:
+                if(streams_model.active[index]) streams_model.stop(index);
+                break;
+            default:
+                // mostly short steps, and some long ones that miss samples
+                time += random64() % 4==0 ? random64() % 2000 : random64() % 50;
+                streams_model.step(streams, time);
+        }
+    }
+    streams.clear();
+    for(size_t i=0; i<streams_model.resources.size(); i++){
+        CHECK(streams_model.resources[i].get_stream_interval()==0);
+    }
+    CHECK(!streams.next_deadline(time) && streams.next_due(time)==NULL);
+}
+
+// samples handled late keep their deadlines aligned to the interval
+static void test_late(){
+    thinger_streams streams(protoson::current_allocator());
+    thinger_resource resource;
+    stream(resource, 100);
+    CHECK(streams.add(resource));
+    CHECK(streams.next_due(1000)==&resource);
+    CHECK(streams.next_due(1000)==NULL);
+    CHECK(streams.next_due(1099)==NULL);
+    CHECK(streams.next_due(1350)==&resource);
+    unsigned long deadline;
+    CHECK(streams.next_deadline(deadline) && deadline==1400);
+    CHECK(streams.next_due(1350)==NULL);
+
+    // a restarted stream discards its previous schedule, and is due on the next call
+    stream(resource, 30);
+    CHECK(streams.add(resource));
+    CHECK(streams.next_due(1351)==&resource);
+    CHECK(streams.next_deadline(deadline) && deadline==1381);
+    CHECK(streams.next_due(1351)==NULL);
+    streams.clear();
+}
+
+int main(){
+    test_late();
+    test_random(0);
+    // deadlines wrapping around the time base
+    test_random(ULONG_MAX - 30000);
+    return 0;
+}
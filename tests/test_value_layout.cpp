@@ -0,0 +1,117 @@
+// A pson value takes two pointers. Numbers and short strings are kept in it, while values that do not fit, as doubles
+// and big varints on 32-bit targets, are boxed in allocated memory. Values are checked across the storage boundaries
+// when assigned, copied, borrowed, and encoded and decoded, and no memory may be left allocated once released.
+
+#include "thinger/core/pson.h"
+#include "test.h"
+#include <set>
+#include <string>
+
+using namespace protoson;
+
+// allocator that fails the test on releasing memory it did not allocate
+class checked_allocator : public memory_allocator{
+public:
+    std::set<void*> live;
+
+    using memory_allocator::allocate;
+
+    virtual void *allocate(size_t size){
+        void* ptr = malloc(size);
+        live.insert(ptr);
+        return ptr;
+    }
+
+    virtual void deallocate(void *ptr){
+        if(ptr==NULL) return;
+        CHECK(live.erase(ptr)==1);
+        free(ptr);
+    }
+};
+
+static const uint64_t varints[] = {
+    2, 127, 128, 0xFFFFFFFFULL, 0x100000000ULL, 0xFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFULL, 0x100000000000000ULL,
+    0x7FFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL
+};
+
+static const double doubles[] = {0.1, -1e300, 3.141592653589793, 1e-300};
+
+static void fill(pson_array& array){
+    for(size_t i=0; i<sizeof(varints)/sizeof(varints[0]); i++){
+        array.create_item()->set_varint(varints[i]);
+        array.create_item()->set_varint(varints[i], true);
+    }
+    for(size_t i=0; i<sizeof(doubles)/sizeof(doubles[0]); i++){
+        array.create_item()->set_double(doubles[i]);
+    }
+    array.add(1.5f);
+    // strings around the inline size on all targets
+    std::string str;
+    for(size_t size=0; size<40; size++){
+        array.add(str.c_str());
+        str += (char) ('a' + size % 26);
+    }
+}
+
+static void verify(pson_array& array){
+    size_t index = 0;
+    for(size_t i=0; i<sizeof(varints)/sizeof(varints[0]); i++){
+        pson& positive = *array[index++];
+        pson& negative = *array[index++];
+        CHECK(positive.get_type()==pson::varint_field && positive.get_varint()==varints[i]);
+        CHECK(negative.get_type()==pson::svarint_field && negative.get_varint()==varints[i]);
+    }
+    for(size_t i=0; i<sizeof(doubles)/sizeof(doubles[0]); i++){
+        pson& value = *array[index++];
+        CHECK(value.get_type()==pson::double_field && (double) value==doubles[i]);
+    }
+    CHECK((float) *array[index++]==1.5f);
+    std::string str;
+    for(size_t size=0; size<40; size++){
+        pson& value = *array[index++];
+        CHECK(strcmp((const char*) value, str.c_str())==0);
+        CHECK(size==0 || value.get_size()==size);
+        str += (char) ('a' + size % 26);
+    }
+    CHECK(index==array.size());
+}
+
+int main(){
+    CHECK(sizeof(pson)==2*sizeof(void*));
+
+    checked_allocator allocator;
+    {
+        memory_scope scope(allocator);
+        pson data;
+        fill(data);
+        verify(data);
+
+        // copies own their values
+        pson copy(data);
+        verify(copy);
+
+        // views reference the values, and release nothing
+        pson view;
+        view.borrow(data);
+        verify(view);
+
+        // encoded and decoded values match, also over the values replaced on decoding
+        uint8_t buffer[2048];
+        pson_buffer_encoder encoder(buffer, sizeof(buffer));
+        encoder.encode(data);
+        CHECK(encoder.bytes_written()>0 && encoder.bytes_written()<sizeof(buffer));
+        pson_buffer_decoder decoder(buffer, encoder.bytes_written());
+        CHECK(decoder.decode(copy));
+        verify(copy);
+
+        // replacing values releases the previous ones
+        pson& value = *((pson_array&) data)[0];
+        value = 0.25;
+        value.set_varint(0xFFFFFFFFFFFFFFFFULL);
+        value = "a string that is not stored inline";
+        value.set_double(0.1);
+        CHECK((double) value==0.1);
+    }
+    CHECK(allocator.live.empty());
+    return 0;
+}
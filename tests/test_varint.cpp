@@ -0,0 +1,107 @@
+// The varint kernels encode and decode with word operations where the target allows them. They are compared with a
+// byte by byte reference over random values of every size (up to 10 byte varints), random input bytes, and input
+// truncated at the end of the buffer, that is allocated with its exact size so reading past it can be detected.
+
+#include "thinger/core/pson.h"
+#include "test.h"
+
+using namespace protoson;
+
+static uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*, so runs are reproducible
+static uint64_t random64(){
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+// random value with a random number of significant bits, so all the varint sizes are equally tested
+static uint64_t random_value(){
+    uint8_t bits = random64() % 65;
+    return bits==0 ? 0 : random64() >> (64-bits);
+}
+
+static uint8_t reference_encode(uint8_t* buffer, uint64_t value){
+    uint8_t size = 0;
+    do{
+        buffer[size] = (uint8_t) (value & 0x7F);
+        value >>= 7;
+        if(value) buffer[size] |= 0x80;
+        size++;
+    }while(value);
+    return size;
+}
+
+static uint8_t reference_decode(const uint8_t* buffer, size_t available, uint64_t& value){
+    value = 0;
+    for(uint8_t i=0; i<10 && i<available; i++){
+        value |= (uint64_t)(buffer[i] & 0x7F) << (7*i);
+        if(buffer[i] < 0x80) return i+1;
+    }
+    return 0;
+}
+
+static void check_value(uint64_t value){
+    uint8_t expected[10];
+    uint8_t expected_size = reference_encode(expected, value);
+    CHECK(pson_varint_size(value)==expected_size);
+
+    // the encoder may write up to 10 bytes
+    uint8_t encoded[10];
+    memset(encoded, 0xAA, sizeof(encoded));
+    CHECK(pson_varint_encode(encoded, value)==expected_size);
+    CHECK(memcmp(encoded, expected, expected_size)==0);
+
+    // decode at the end of a buffer of the exact size, and also followed by more input
+    for(size_t extra=0; extra<=10; extra+=10){
+        size_t available = expected_size + extra;
+        uint8_t* input = (uint8_t*) malloc(available);
+        memcpy(input, expected, expected_size);
+        for(size_t i=expected_size; i<available; i++) input[i] = (uint8_t) random64();
+        uint64_t decoded = ~value;
+        CHECK(pson_varint_decode(input, available, decoded)==expected_size);
+        CHECK(decoded==value);
+        free(input);
+    }
+
+    // truncated varints are never complete
+    for(size_t available=0; available<expected_size; available++){
+        uint8_t* input = (uint8_t*) malloc(available + 1);
+        memcpy(input, expected, available);
+        uint64_t decoded;
+        CHECK(pson_varint_decode(input, available, decoded)==0);
+        free(input);
+    }
+}
+
+static void check_input(size_t available){
+    uint8_t* input = (uint8_t*) malloc(available + 1);
+    for(size_t i=0; i<available; i++){
+        // mostly continuation bytes, so long and unterminated varints are frequent
+        uint8_t byte = (uint8_t) random64();
+        input[i] = random64() % 8 ? (byte | 0x80) : byte;
+    }
+    uint64_t value = 0, expected_value = 0;
+    uint8_t expected_size = reference_decode(input, available, expected_value);
+    CHECK(pson_varint_decode(input, available, value)==expected_size);
+    if(expected_size>0) CHECK(value==expected_value);
+    free(input);
+}
+
+int main(){
+    const uint64_t edges[] = {0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 0xFFFFFFFFULL, 0x100000000ULL,
+                              (1ULL<<49)-1, 1ULL<<49, (1ULL<<56)-1, 1ULL<<56, (1ULL<<63)-1, 1ULL<<63, ~0ULL};
+    for(size_t i=0; i<sizeof(edges)/sizeof(edges[0]); i++){
+        check_value(edges[i]);
+    }
+    for(size_t i=0; i<200000; i++){
+        check_value(random_value());
+    }
+    for(size_t i=0; i<200000; i++){
+        check_input(random64() % 16);
+    }
+    printf("ok\n");
+    return 0;
+}